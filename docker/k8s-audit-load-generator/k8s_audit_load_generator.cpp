@@ -0,0 +1,652 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+// Sends k8s audit events to falco's embedded webserver at a fixed
+// rate, to size the webhook for a given audit volume. The events are
+// taken from jsonl files like the ones in test/trace_files/k8s_audit,
+// and are sent one per request (as an Event) or several per request
+// (as an EventList).
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using namespace std;
+
+void usage(char *program)
+{
+	printf("Usage %s [options]\n\n", program);
+	printf("Options:\n");
+	printf("     -h/--help: show this help\n");
+	printf("     -d/--dir <dir>: directory containing jsonl files with one k8s audit event per line\n");
+	printf("          (default: ./test/trace_files/k8s_audit)\n");
+	printf("     -H/--host <host>: host running falco (default: 127.0.0.1)\n");
+	printf("     -P/--port <port>: port of falco's webserver (default: 8765)\n");
+	printf("     -e/--endpoint <path>: k8s audit endpoint (default: /k8s_audit)\n");
+	printf("     -r/--rate <events/sec>: target event rate. 0 means as fast as possible (default: 1000)\n");
+	printf("     -b/--batch <num>: events per request. With more than 1, events are sent as an EventList (default: 1)\n");
+	printf("     -c/--connections <num>: number of concurrent connections (default: 4)\n");
+	printf("     -t/--duration <secs>: how long to send events for (default: 10)\n");
+	printf("     -p/--falco-pid <pid>: pid of falco, to report its cpu usage per thousand events\n");
+	printf("     -s/--same-ids: send events with their original auditIDs. By default each event\n");
+	printf("          sent gets a new, unique auditID\n");
+	printf("\n");
+	printf("Latency is measured from the time a request was scheduled to be sent (according to\n");
+	printf("the target rate) until its response was read, so time spent waiting for a free\n");
+	printf("connection is included.\n");
+}
+
+// A k8s audit event, along with where its auditID value starts so
+// it can be replaced in place.
+struct audit_event {
+	string json;
+	size_t id_pos;
+	size_t id_len;
+};
+
+static const string s_audit_id_key = "\"auditID\":\"";
+
+static bool load_events(const string &dir, vector<audit_event> &events)
+{
+	DIR *d = opendir(dir.c_str());
+	if(d == NULL)
+	{
+		fprintf(stderr, "Could not open directory %s: %s\n", dir.c_str(), strerror(errno));
+		return false;
+	}
+
+	vector<string> files;
+	struct dirent *ent;
+	while((ent = readdir(d)) != NULL)
+	{
+		string name = ent->d_name;
+		if(name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0)
+		{
+			files.push_back(dir + "/" + name);
+		}
+	}
+	closedir(d);
+
+	sort(files.begin(), files.end());
+
+	for(auto &file : files)
+	{
+		ifstream ifs(file);
+		string line;
+
+		while(getline(ifs, line))
+		{
+			if(line.empty())
+			{
+				continue;
+			}
+
+			audit_event ev;
+			ev.json = line;
+			ev.id_pos = string::npos;
+			ev.id_len = 0;
+
+			size_t pos = line.find(s_audit_id_key);
+			if(pos != string::npos)
+			{
+				size_t end = line.find('"', pos + s_audit_id_key.size());
+				if(end != string::npos)
+				{
+					ev.id_pos = pos + s_audit_id_key.size();
+					ev.id_len = end - ev.id_pos;
+				}
+			}
+
+			events.push_back(ev);
+		}
+	}
+
+	return true;
+}
+
+static void append_event(string &body, const audit_event &ev, bool same_ids, uint64_t seq)
+{
+	if(same_ids || ev.id_pos == string::npos)
+	{
+		body += ev.json;
+		return;
+	}
+
+	char id[64];
+	snprintf(id, sizeof(id), "%08x-%04x-4%03x-8%03x-%012" PRIx64,
+		 (uint32_t) getpid(), (uint32_t) (seq >> 48) & 0xffff,
+		 (uint32_t) (seq >> 36) & 0xfff, (uint32_t) (seq >> 24) & 0xfff,
+		 (uint64_t) (seq & 0xffffffffffffULL));
+
+	body.append(ev.json, 0, ev.id_pos);
+	body += id;
+	body.append(ev.json, ev.id_pos + ev.id_len, string::npos);
+}
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t when)
+{
+	struct timespec ts;
+	ts.tv_sec = when / 1000000000ULL;
+	ts.tv_nsec = when % 1000000000ULL;
+
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	{
+	}
+}
+
+// Returns the utime+stime of the given process, in clock ticks, or
+// -1 if it could not be read.
+static int64_t process_cpu_ticks(int pid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	ifstream ifs(path);
+	string stat;
+	if(!getline(ifs, stat))
+	{
+		return -1;
+	}
+
+	// The command name (field 2) may contain spaces, so skip
+	// past its closing parenthesis. utime and stime are fields
+	// 14 and 15, i.e. the 12th and 13th after the name.
+	size_t pos = stat.rfind(')');
+	if(pos == string::npos)
+	{
+		return -1;
+	}
+
+	const char *p = stat.c_str() + pos + 1;
+	unsigned long utime, stime;
+	if(sscanf(p, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+	{
+		return -1;
+	}
+
+	return utime + stime;
+}
+
+struct config {
+	string dir = "test/trace_files/k8s_audit";
+	string host = "127.0.0.1";
+	string port = "8765";
+	string endpoint = "/k8s_audit";
+	double rate = 1000;
+	uint32_t batch = 1;
+	uint32_t connections = 4;
+	uint32_t duration = 10;
+	int falco_pid = 0;
+	bool same_ids = false;
+};
+
+struct stats {
+	uint64_t requests_accepted = 0;
+	uint64_t requests_rejected = 0;
+	uint64_t requests_failed = 0;
+	uint64_t events_accepted = 0;
+	vector<uint64_t> latencies_ns;
+};
+
+// A keep-alive http connection to falco. Reconnects as needed.
+class connection
+{
+public:
+	connection(const config &cfg)
+		: m_cfg(cfg), m_fd(-1)
+	{
+	}
+
+	~connection()
+	{
+		disconnect();
+	}
+
+	// Send the request and read the response. Returns the http
+	// status, or -1 on a connection error.
+	int post(const string &body)
+	{
+		if(m_fd < 0 && !connect())
+		{
+			return -1;
+		}
+
+		m_req = "POST " + m_cfg.endpoint + " HTTP/1.1\r\n"
+			"Host: " + m_cfg.host + "\r\n"
+			"Content-Type: application/json\r\n"
+			"Content-Length: " + to_string(body.size()) + "\r\n"
+			"\r\n";
+		m_req += body;
+
+		if(!send_all(m_req))
+		{
+			// The server may have closed an idle keep-alive
+			// connection. Retry once on a fresh one.
+			disconnect();
+			if(!connect() || !send_all(m_req))
+			{
+				disconnect();
+				return -1;
+			}
+		}
+
+		int status = read_response();
+		if(status < 0)
+		{
+			disconnect();
+		}
+
+		return status;
+	}
+
+private:
+	bool connect()
+	{
+		struct addrinfo hints, *res;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		if(getaddrinfo(m_cfg.host.c_str(), m_cfg.port.c_str(), &hints, &res) != 0)
+		{
+			return false;
+		}
+
+		m_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		if(m_fd < 0 || ::connect(m_fd, res->ai_addr, res->ai_addrlen) != 0)
+		{
+			freeaddrinfo(res);
+			disconnect();
+			return false;
+		}
+		freeaddrinfo(res);
+
+		int one = 1;
+		setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		m_buf.clear();
+
+		return true;
+	}
+
+	void disconnect()
+	{
+		if(m_fd >= 0)
+		{
+			close(m_fd);
+			m_fd = -1;
+		}
+	}
+
+	bool send_all(const string &data)
+	{
+		size_t sent = 0;
+		while(sent < data.size())
+		{
+			ssize_t n = send(m_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+			if(n <= 0)
+			{
+				return false;
+			}
+			sent += n;
+		}
+		return true;
+	}
+
+	bool fill()
+	{
+		char buf[4096];
+		ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+		if(n <= 0)
+		{
+			return false;
+		}
+		m_buf.append(buf, n);
+		return true;
+	}
+
+	int read_response()
+	{
+		size_t hdr_end;
+		while((hdr_end = m_buf.find("\r\n\r\n")) == string::npos)
+		{
+			if(!fill())
+			{
+				return -1;
+			}
+		}
+
+		int status = 0;
+		if(sscanf(m_buf.c_str(), "HTTP/%*d.%*d %d", &status) != 1)
+		{
+			return -1;
+		}
+
+		string headers = m_buf.substr(0, hdr_end);
+		transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+
+		bool close_conn = (headers.find("\r\nconnection: close") != string::npos);
+
+		size_t content_length = 0;
+		size_t pos = headers.find("\r\ncontent-length:");
+		if(pos != string::npos)
+		{
+			content_length = strtoul(headers.c_str() + pos + 17, NULL, 10);
+		}
+		else
+		{
+			// No length, so the body ends when the server
+			// closes the connection.
+			while(fill())
+			{
+			}
+			m_buf.clear();
+			disconnect();
+			return status;
+		}
+
+		while(m_buf.size() < hdr_end + 4 + content_length)
+		{
+			if(!fill())
+			{
+				return -1;
+			}
+		}
+
+		m_buf.erase(0, hdr_end + 4 + content_length);
+
+		if(close_conn)
+		{
+			disconnect();
+		}
+
+		return status;
+	}
+
+	const config &m_cfg;
+	int m_fd;
+	string m_req;
+	string m_buf;
+};
+
+static void sender(const config &cfg,
+		   const vector<audit_event> &events,
+		   atomic<uint64_t> &next_request,
+		   uint64_t start_ns, uint64_t end_ns,
+		   stats &st)
+{
+	connection conn(cfg);
+	string body;
+
+	while(true)
+	{
+		uint64_t req = next_request++;
+		uint64_t sched_ns = start_ns;
+
+		if(cfg.rate > 0)
+		{
+			sched_ns += (uint64_t) (req * cfg.batch * 1000000000.0 / cfg.rate);
+		}
+
+		if(sched_ns >= end_ns || (cfg.rate == 0 && now_ns() >= end_ns))
+		{
+			break;
+		}
+
+		sleep_until_ns(sched_ns);
+
+		if(cfg.rate == 0)
+		{
+			sched_ns = now_ns();
+		}
+
+		body.clear();
+
+		uint64_t first = req * cfg.batch;
+		if(cfg.batch == 1)
+		{
+			append_event(body, events[first % events.size()], cfg.same_ids, first);
+		}
+		else
+		{
+			body += "{\"kind\":\"EventList\",\"apiVersion\":\"audit.k8s.io/v1beta1\",\"items\":[";
+			for(uint64_t i = first; i < first + cfg.batch; i++)
+			{
+				if(i != first)
+				{
+					body += ",";
+				}
+				append_event(body, events[i % events.size()], cfg.same_ids, i);
+			}
+			body += "]}";
+		}
+
+		int status = conn.post(body);
+		uint64_t done_ns = now_ns();
+
+		if(status < 0)
+		{
+			st.requests_failed++;
+		}
+		else if(status == 200)
+		{
+			st.requests_accepted++;
+			st.events_accepted += cfg.batch;
+			st.latencies_ns.push_back(done_ns - sched_ns);
+		}
+		else
+		{
+			st.requests_rejected++;
+			st.latencies_ns.push_back(done_ns - sched_ns);
+		}
+	}
+}
+
+static double percentile_ms(vector<uint64_t> &sorted, double pct)
+{
+	if(sorted.empty())
+	{
+		return 0;
+	}
+
+	size_t idx = (size_t) ((sorted.size() - 1) * pct / 100);
+	return sorted[idx] / 1000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	config cfg;
+	int op;
+	int long_index = 0;
+
+	static struct option long_options[] =
+	{
+		{"help", no_argument, 0, 'h'},
+		{"dir", required_argument, 0, 'd'},
+		{"host", required_argument, 0, 'H'},
+		{"port", required_argument, 0, 'P'},
+		{"endpoint", required_argument, 0, 'e'},
+		{"rate", required_argument, 0, 'r'},
+		{"batch", required_argument, 0, 'b'},
+		{"connections", required_argument, 0, 'c'},
+		{"duration", required_argument, 0, 't'},
+		{"falco-pid", required_argument, 0, 'p'},
+		{"same-ids", no_argument, 0, 's'},
+		{0, 0, 0, 0}
+	};
+
+	while((op = getopt_long(argc, argv,
+				"hd:H:P:e:r:b:c:t:p:s",
+				long_options, &long_index)) != -1)
+	{
+		switch(op)
+		{
+		case 'h':
+			usage(argv[0]);
+			exit(1);
+		case 'd':
+			cfg.dir = optarg;
+			break;
+		case 'H':
+			cfg.host = optarg;
+			break;
+		case 'P':
+			cfg.port = optarg;
+			break;
+		case 'e':
+			cfg.endpoint = optarg;
+			break;
+		case 'r':
+			cfg.rate = atof(optarg);
+			break;
+		case 'b':
+			cfg.batch = atoi(optarg);
+			break;
+		case 'c':
+			cfg.connections = atoi(optarg);
+			break;
+		case 't':
+			cfg.duration = atoi(optarg);
+			break;
+		case 'p':
+			cfg.falco_pid = atoi(optarg);
+			break;
+		case 's':
+			cfg.same_ids = true;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if(cfg.batch == 0 || cfg.connections == 0 || cfg.duration == 0 || cfg.rate < 0)
+	{
+		fprintf(stderr, "Batch size, connections and duration must be positive, rate must not be negative\n");
+		exit(1);
+	}
+
+	vector<audit_event> events;
+	if(!load_events(cfg.dir, events))
+	{
+		exit(1);
+	}
+
+	if(events.empty())
+	{
+		fprintf(stderr, "No k8s audit events found in %s\n", cfg.dir.c_str());
+		exit(1);
+	}
+
+	printf("Sending %zu distinct events to %s:%s%s, rate=%s, batch=%u, connections=%u, duration=%us\n",
+	       events.size(), cfg.host.c_str(), cfg.port.c_str(), cfg.endpoint.c_str(),
+	       (cfg.rate == 0 ? "unlimited" : (to_string((uint64_t) cfg.rate) + " evts/sec").c_str()),
+	       cfg.batch, cfg.connections, cfg.duration);
+
+	int64_t cpu_start = (cfg.falco_pid ? process_cpu_ticks(cfg.falco_pid) : -1);
+
+	atomic<uint64_t> next_request(0);
+	vector<stats> thread_stats(cfg.connections);
+	vector<thread> threads;
+
+	uint64_t start_ns = now_ns();
+	uint64_t end_ns = start_ns + cfg.duration * 1000000000ULL;
+
+	for(uint32_t i = 0; i < cfg.connections; i++)
+	{
+		threads.emplace_back(sender, std::cref(cfg), std::cref(events),
+				     std::ref(next_request), start_ns, end_ns,
+				     std::ref(thread_stats[i]));
+	}
+
+	for(auto &t : threads)
+	{
+		t.join();
+	}
+
+	double elapsed = (now_ns() - start_ns) / 1000000000.0;
+
+	int64_t cpu_end = (cfg.falco_pid ? process_cpu_ticks(cfg.falco_pid) : -1);
+
+	stats total;
+	for(auto &st : thread_stats)
+	{
+		total.requests_accepted += st.requests_accepted;
+		total.requests_rejected += st.requests_rejected;
+		total.requests_failed += st.requests_failed;
+		total.events_accepted += st.events_accepted;
+		total.latencies_ns.insert(total.latencies_ns.end(), st.latencies_ns.begin(), st.latencies_ns.end());
+	}
+
+	sort(total.latencies_ns.begin(), total.latencies_ns.end());
+
+	printf("Elapsed time: %.3lf secs\n", elapsed);
+	printf("Requests accepted: %" PRIu64 ", rejected: %" PRIu64 ", failed (connection errors): %" PRIu64 "\n",
+	       total.requests_accepted, total.requests_rejected, total.requests_failed);
+	printf("Events accepted: %" PRIu64 " (%.1lf evts/sec)\n",
+	       total.events_accepted, total.events_accepted / elapsed);
+	printf("Latency (ms): p50=%.3lf p90=%.3lf p99=%.3lf p99.9=%.3lf max=%.3lf\n",
+	       percentile_ms(total.latencies_ns, 50),
+	       percentile_ms(total.latencies_ns, 90),
+	       percentile_ms(total.latencies_ns, 99),
+	       percentile_ms(total.latencies_ns, 99.9),
+	       percentile_ms(total.latencies_ns, 100));
+
+	if(cfg.falco_pid)
+	{
+		if(cpu_start < 0 || cpu_end < 0)
+		{
+			printf("Could not read cpu usage of falco (pid %d)\n", cfg.falco_pid);
+		}
+		else
+		{
+			double cpu_ms = (cpu_end - cpu_start) * 1000.0 / sysconf(_SC_CLK_TCK);
+			printf("Falco cpu: %.1lf ms total, %.2lf ms per thousand events, %.1lf%% of one cpu\n",
+			       cpu_ms,
+			       (total.events_accepted == 0 ? 0.0 : cpu_ms * 1000 / total.events_accepted),
+			       cpu_ms / 10 / elapsed);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,886 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// In-process microbenchmarks for the hot paths of the falco
+// engine. Everything runs offline against the trace files in
+// test/trace_files and the rules files in rules/. Results are written
+// as json so they can be compared across builds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "falco_engine.h"
+#include "falco_engine_version.h"
+#include "arena.h"
+#include "json_evt.h"
+#include "json_writer.h"
+#include "k8s_audit_shards.h"
+#include "token_bucket.h"
+
+using namespace std;
+
+// Set by the build to point into the source tree
+#ifndef FALCO_BENCH_TRACE_DIR
+#define FALCO_BENCH_TRACE_DIR "test/trace_files"
+#endif
+
+#ifndef FALCO_BENCH_RULES_DIR
+#define FALCO_BENCH_RULES_DIR "rules"
+#endif
+
+// Every heap allocation made by the benchmark goes through these, so
+// the number of allocations of a piece of code can be measured.
+static atomic<uint64_t> s_num_allocs(0);
+
+void *operator new(size_t size)
+{
+	s_num_allocs++;
+	void *ptr = malloc(size ? size : 1);
+	if(ptr == NULL)
+	{
+		throw bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+	free(ptr);
+}
+
+// The resident set size of the process, in bytes.
+static uint64_t resident_bytes()
+{
+	uint64_t pages_total = 0, pages_resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if(f == NULL)
+	{
+		return 0;
+	}
+	if(fscanf(f, "%" SCNu64 " %" SCNu64, &pages_total, &pages_resident) != 2)
+	{
+		pages_resident = 0;
+	}
+	fclose(f);
+
+	return pages_resident * sysconf(_SC_PAGESIZE);
+}
+
+// Runs benchmarks and collects their results.
+class bench_runner
+{
+public:
+	bench_runner(uint32_t num_warmup, uint32_t num_samples, const string &filter)
+		: m_num_warmup(num_warmup), m_num_samples(num_samples), m_filter(filter)
+	{
+	}
+
+	bool selected(const string &name)
+	{
+		return (m_filter == "" || name.find(m_filter) != string::npos);
+	}
+
+	// Time fn, which performs batch operations per call. fn is
+	// first called m_num_warmup times without measuring, then
+	// m_num_samples times, each sample giving the average time
+	// of one operation.
+	void run(const string &name, uint64_t batch, function<void()> fn)
+	{
+		if(!selected(name))
+		{
+			return;
+		}
+
+		for(uint32_t i = 0; i < m_num_warmup; i++)
+		{
+			fn();
+		}
+
+		vector<double> samples;
+		samples.reserve(m_num_samples);
+
+		for(uint32_t i = 0; i < m_num_samples; i++)
+		{
+			auto start = chrono::steady_clock::now();
+			fn();
+			auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+			samples.push_back((double) ns / batch);
+		}
+
+		add_result(name, batch, samples);
+	}
+
+	// Add a result whose per-operation samples were collected
+	// by the caller.
+	void add_result(const string &name, uint64_t batch, vector<double> &samples)
+	{
+		if(samples.empty())
+		{
+			return;
+		}
+
+		sort(samples.begin(), samples.end());
+
+		double sum = 0;
+		for(auto s : samples)
+		{
+			sum += s;
+		}
+		double mean = sum / samples.size();
+
+		double var = 0;
+		for(auto s : samples)
+		{
+			var += (s - mean) * (s - mean);
+		}
+		double stddev = sqrt(var / samples.size());
+
+		nlohmann::json res = {
+			{"name", name},
+			{"batch", batch},
+			{"samples", samples.size()},
+			{"ns_per_op", {
+					{"min", samples.front()},
+					{"median", percentile(samples, 50)},
+					{"mean", mean},
+					{"p95", percentile(samples, 95)},
+					{"p99", percentile(samples, 99)},
+					{"max", samples.back()},
+					{"stddev", stddev}
+				}
+			}
+		};
+
+		fprintf(stderr, "%-70s %12.1f ns/op (median, +/- %.1f)\n", name.c_str(), percentile(samples, 50), stddev);
+
+		m_results.push_back(res);
+	}
+
+	nlohmann::json &results()
+	{
+		return m_results;
+	}
+
+	uint32_t num_samples()
+	{
+		return m_num_samples;
+	}
+
+private:
+	// samples must be sorted
+	static double percentile(vector<double> &samples, uint32_t pct)
+	{
+		size_t idx = (samples.size() - 1) * pct / 100;
+		return samples[idx];
+	}
+
+	uint32_t m_num_warmup;
+	uint32_t m_num_samples;
+	string m_filter;
+	nlohmann::json m_results = nlohmann::json::array();
+};
+
+static list<string> dir_files(const string &dir, const string &suffix)
+{
+	list<string> files;
+
+	DIR *d = opendir(dir.c_str());
+	if(d == NULL)
+	{
+		return files;
+	}
+
+	struct dirent *ent;
+	while((ent = readdir(d)) != NULL)
+	{
+		string name = ent->d_name;
+		if(name.size() > suffix.size() &&
+		   name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+		{
+			files.push_back(dir + "/" + name);
+		}
+	}
+	closedir(d);
+
+	files.sort();
+
+	return files;
+}
+
+// Read all k8s audit events from the jsonl trace files
+static void read_k8s_audit_events(falco_engine *engine, json_event_list &evts, vector<string> &lines)
+{
+	for(auto &file : dir_files(string(FALCO_BENCH_TRACE_DIR) + "/k8s_audit", ".json"))
+	{
+		ifstream ifs(file);
+		string line;
+
+		while(getline(ifs, line))
+		{
+			if(line == "")
+			{
+				continue;
+			}
+
+			nlohmann::json j = nlohmann::json::parse(line);
+			engine->parse_k8s_audit_json(j, evts);
+			lines.push_back(line);
+		}
+	}
+}
+
+static void bench_load_rules(bench_runner &runner, sinsp *inspector)
+{
+	for(auto &rules : {"falco_rules.yaml", "k8s_audit_rules.yaml"})
+	{
+		string filename = string(FALCO_BENCH_RULES_DIR) + "/" + rules;
+
+		runner.run(string("falco_engine::load_rules/") + rules, 1, [&]() {
+				falco_engine engine;
+				engine.set_inspector(inspector);
+				engine.load_rules_file(filename, false, true);
+			});
+	}
+}
+
+// Count how many k8s audit rules are run per event, on average, once
+// the verb/resource guards have narrowed down the candidates, against
+// the number of k8s audit rules.
+static void count_k8s_audit_candidates(sinsp *inspector, json_event_list &evts, nlohmann::json &stats)
+{
+	falco_engine engine;
+	engine.set_inspector(inspector);
+	engine.load_rules_file(string(FALCO_BENCH_RULES_DIR) + "/k8s_audit_rules.yaml", false, true);
+
+	falco_engine::rule_result res;
+	for(auto &evt : evts)
+	{
+		engine.process_k8s_audit_event(&evt, res);
+	}
+
+	map<string, pair<uint64_t, uint64_t>> counts;
+	engine.get_rule_counts(counts);
+
+	uint64_t num_evaluated = 0;
+	for(auto &it : counts)
+	{
+		num_evaluated += it.second.first;
+	}
+
+	double per_event = (double) num_evaluated / evts.size();
+
+	fprintf(stderr, "k8s audit: %zu events, %zu rules, %.2f rules run per event\n",
+		evts.size(), counts.size(), per_event);
+
+	stats["k8s_audit_candidates"] = {
+		{"events", evts.size()},
+		{"rules", counts.size()},
+		{"rules_run_per_event", per_event}
+	};
+}
+
+static void bench_k8s_audit(bench_runner &runner, sinsp *inspector, falco_engine *engine, nlohmann::json &stats)
+{
+	json_event_list evts;
+	vector<string> lines;
+	read_k8s_audit_events(engine, evts, lines);
+
+	if(evts.empty())
+	{
+		fprintf(stderr, "No k8s audit events found in %s/k8s_audit, skipping k8s audit benchmarks\n", FALCO_BENCH_TRACE_DIR);
+		return;
+	}
+
+	count_k8s_audit_candidates(inspector, evts, stats);
+
+	// This times the whole engine call, falco_ruleset::run plus
+	// sampling and filling in the result. The events are reused
+	// by every run, so their cached fields are cleared to
+	// extract them again each time.
+	falco_engine::rule_result res;
+	runner.run("falco_engine::process_k8s_audit_event", evts.size(), [&]() {
+			for(auto &evt : evts)
+			{
+				evt.clear_fields();
+				engine->process_k8s_audit_event(&evt, res);
+			}
+		});
+
+	// The same, through the batch API, for a few batch sizes
+	vector<json_event *> evt_ptrs;
+	for(auto &evt : evts)
+	{
+		evt_ptrs.push_back(&evt);
+	}
+
+	vector<falco_engine::rule_match> matches;
+	for(size_t batch_size : {1, 16, 256})
+	{
+		runner.run("falco_engine::process_k8s_audit_events/batch_" + to_string(batch_size), evt_ptrs.size(), [&]() {
+				for(auto evt : evt_ptrs)
+				{
+					evt->clear_fields();
+				}
+
+				for(size_t i = 0; i < evt_ptrs.size(); i += batch_size)
+				{
+					engine->process_k8s_audit_events(evt_ptrs.data() + i,
+									 min(batch_size, evt_ptrs.size() - i),
+									 matches);
+				}
+			});
+	}
+
+	// Parsing and processing, with the events fully parsed or
+	// backed by a structural index of the raw json.
+	runner.run("falco_engine::parse_k8s_audit_json+process", lines.size(), [&]() {
+			for(auto &line : lines)
+			{
+				json_event_list line_evts;
+				nlohmann::json j = nlohmann::json::parse(line);
+				engine->parse_k8s_audit_json(j, line_evts);
+				for(auto &evt : line_evts)
+				{
+					engine->process_k8s_audit_event(&evt, res);
+				}
+			}
+		});
+
+	runner.run("falco_engine::parse_k8s_audit_raw+process", lines.size(), [&]() {
+			for(auto &line : lines)
+			{
+				json_event_list line_evts;
+				shared_ptr<json_index> doc = make_shared<json_index>();
+				string errstr;
+				doc->index(line.data(), line.size(), errstr);
+				engine->parse_k8s_audit_raw(doc, line_evts);
+				for(auto &evt : line_evts)
+				{
+					engine->process_k8s_audit_event(&evt, res);
+				}
+			}
+		});
+
+	// The heap allocations made while parsing and processing the
+	// events of each line, with the events kept in a list on the
+	// heap or in an arena, and the resident set size after each.
+	nlohmann::json allocs = nlohmann::json::object();
+	for(bool use_arena : {false, true})
+	{
+		arena evts_arena;
+		uint64_t num_evts = 0;
+		uint64_t start = s_num_allocs;
+
+		for(auto &line : lines)
+		{
+			json_event_list line_evts((arena_allocator<json_event>(use_arena ? &evts_arena : NULL)));
+			shared_ptr<json_index> doc = make_shared<json_index>();
+			string errstr;
+			doc->index(line.data(), line.size(), errstr);
+			engine->parse_k8s_audit_raw(doc, line_evts);
+			for(auto &evt : line_evts)
+			{
+				engine->process_k8s_audit_event(&evt, res);
+			}
+			num_evts += line_evts.size();
+			line_evts.clear();
+			evts_arena.reset();
+		}
+
+		allocs[use_arena ? "arena" : "heap"] = {
+			{"allocs_per_event", (num_evts > 0 ? double(s_num_allocs - start) / num_evts : 0)},
+			{"resident_bytes", resident_bytes()}
+		};
+	}
+	stats["k8s_audit_parse_allocs"] = allocs;
+
+	// Checking the events on several workers, each with its own
+	// clone of the engine, in batches of the size the api server
+	// sends to webhooks. The events per second for each number of
+	// workers go in the stats.
+	nlohmann::json shards_eps = nlohmann::json::object();
+	for(uint32_t num_workers : {1, 2, 4, 8})
+	{
+		string name = "k8s_audit_shards::process_events/workers_" + to_string(num_workers);
+		if(!runner.selected(name))
+		{
+			continue;
+		}
+
+		k8s_audit_shards shards(engine, num_workers);
+		size_t batch_size = 400;
+		uint64_t num_matches = 0;
+
+		runner.run(name, evt_ptrs.size(), [&]() {
+				for(auto evt : evt_ptrs)
+				{
+					evt->clear_fields();
+				}
+
+				for(size_t i = 0; i < evt_ptrs.size(); i += batch_size)
+				{
+					shards.process_events(evt_ptrs.data() + i,
+							      min(batch_size, evt_ptrs.size() - i),
+							      [&](falco_engine::rule_result &res) {
+								      num_matches++;
+							      });
+				}
+			});
+
+		double median = runner.results().back()["ns_per_op"]["median"];
+		shards_eps[to_string(num_workers)] = (median > 0 ? 1e9 / median : 0);
+	}
+	stats["k8s_audit_shards_events_per_sec"] = shards_eps;
+
+	json_event_filter_factory &factory = engine->json_factory();
+
+	struct check_spec {
+		const char *field;
+		cmpop op;
+		vector<string> values;
+	};
+
+	vector<check_spec> specs = {
+		{"ka.verb", CO_EQ, {"create"}},
+		{"ka.target.resource", CO_IN, {"pods", "deployments", "daemonsets", "services", "configmaps"}},
+		{"ka.uri", CO_STARTSWITH, {"/api/v1/namespaces"}},
+		{"ka.req.configmap.obj", CO_CONTAINS, {"password"}},
+		{"ka.req.pod.containers.image", CO_IN, {"nginx", "busybox"}},
+		{"ka.req.pod.containers.privileged", CO_EQ, {"true"}}
+	};
+
+	for(auto &spec : specs)
+	{
+		unique_ptr<json_event_filter_check> chk((json_event_filter_check *) factory.new_filtercheck(spec.field));
+		if(!chk)
+		{
+			fprintf(stderr, "Unknown field %s, skipping\n", spec.field);
+			continue;
+		}
+
+		chk->m_cmpop = spec.op;
+		for(auto &val : spec.values)
+		{
+			chk->add_filter_value(val.c_str(), val.size());
+		}
+
+		runner.run(string("json_event_filter_check::extract/") + spec.field, evts.size(), [&]() {
+				for(auto &evt : evts)
+				{
+					uint32_t len;
+					chk->extract(&evt, &len);
+				}
+			});
+
+		// Forget the extracted values cached in the events, so
+		// each comparison extracts the value again.
+		runner.run(string("json_event_filter_check::compare/") + spec.field, evts.size(), [&]() {
+				for(auto &evt : evts)
+				{
+					evt.clear_fields();
+					chk->compare(&evt);
+				}
+			});
+	}
+
+	// One field against many values: an "in" list, as the
+	// compiler builds from "=" operands chained by "or", against
+	// the chain of "=" checks it replaces, and a "pmatch" list.
+	// The cached fields are cleared for each event, as for a new
+	// event.
+	vector<string> uris;
+	for(uint32_t i = 0; i < 500; i++)
+	{
+		uris.push_back("/apis/group" + to_string(i));
+	}
+
+	auto new_uri_check = [&](cmpop op, const vector<string> &values) {
+		json_event_filter_check *chk = (json_event_filter_check *) factory.new_filtercheck("ka.uri");
+		chk->m_cmpop = op;
+		for(auto &val : values)
+		{
+			chk->add_filter_value(val.c_str(), val.size());
+		}
+		return chk;
+	};
+
+	unique_ptr<json_event_filter_check> in_chk(new_uri_check(CO_IN, uris));
+	runner.run("json_event_filter_check::compare/ka.uri in (500 values)", evts.size(), [&]() {
+			for(auto &evt : evts)
+			{
+				evt.clear_fields();
+				in_chk->compare(&evt);
+			}
+		});
+
+	vector<unique_ptr<json_event_filter_check>> eq_chks;
+	for(auto &uri : uris)
+	{
+		eq_chks.emplace_back(new_uri_check(CO_EQ, {uri}));
+	}
+	runner.run("json_event_filter_check::compare/ka.uri = (500 values, or)", evts.size(), [&]() {
+			for(auto &evt : evts)
+			{
+				evt.clear_fields();
+				for(auto &chk : eq_chks)
+				{
+					if(chk->compare(&evt))
+					{
+						break;
+					}
+				}
+			}
+		});
+
+	unique_ptr<json_event_filter_check> pmatch_chk(new_uri_check(CO_PMATCH, uris));
+	runner.run("json_event_filter_check::compare/ka.uri pmatch (500 values)", evts.size(), [&]() {
+			for(auto &evt : evts)
+			{
+				evt.clear_fields();
+				pmatch_chk->compare(&evt);
+			}
+		});
+
+	string format = "%jevt.time: k8s audit user=%ka.user.name verb=%ka.verb uri=%ka.uri resource=%ka.target.resource name=%ka.target.name resp=%ka.response.code";
+	json_event_formatter formatter(factory, format);
+
+	runner.run("json_event_formatter::tostring", evts.size(), [&]() {
+			for(auto &evt : evts)
+			{
+				evt.clear_fields();
+				formatter.tostring(&evt);
+			}
+		});
+
+	// The same, with the values of the fields already extracted,
+	// as they are when the rule's condition used them.
+	runner.run("json_event_formatter::tostring/cached", evts.size(), [&]() {
+			for(auto &evt : evts)
+			{
+				formatter.tostring(&evt);
+			}
+		});
+
+	runner.run("json_event_formatter::tojson", evts.size(), [&]() {
+			for(auto &evt : evts)
+			{
+				evt.clear_fields();
+				formatter.tojson(&evt);
+			}
+		});
+}
+
+// Replays each scap trace file num_samples times, timing each call
+// to process_sinsp_event and grouping the times by event type, which
+// is the event tag used by falco_sinsp_ruleset.
+static void bench_syscall(bench_runner &runner, sinsp *inspector, falco_engine *engine)
+{
+	if(!runner.selected("falco_engine::process_sinsp_event"))
+	{
+		return;
+	}
+
+	map<string, vector<double>> samples_by_evttype;
+	vector<double> all_samples;
+	falco_engine::rule_result res;
+
+	for(auto &file : dir_files(FALCO_BENCH_TRACE_DIR, ".scap"))
+	{
+		for(uint32_t i = 0; i < runner.num_samples(); i++)
+		{
+			inspector->open(file);
+
+			while(true)
+			{
+				sinsp_evt *ev;
+				int32_t rc = inspector->next(&ev);
+
+				if(rc == SCAP_TIMEOUT)
+				{
+					continue;
+				}
+				else if(rc != SCAP_SUCCESS)
+				{
+					break;
+				}
+
+				if(!ev->falco_consider())
+				{
+					continue;
+				}
+
+				auto start = chrono::steady_clock::now();
+				engine->process_sinsp_event(ev, res);
+				double ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+				samples_by_evttype[ev->get_name()].push_back(ns);
+				all_samples.push_back(ns);
+			}
+
+			inspector->close();
+		}
+	}
+
+	runner.add_result("falco_engine::process_sinsp_event", 1, all_samples);
+
+	for(auto &it : samples_by_evttype)
+	{
+		runner.add_result("falco_engine::process_sinsp_event/" + it.first, 1, it.second);
+	}
+}
+
+static void bench_token_bucket(bench_runner &runner)
+{
+	token_bucket tb;
+	uint64_t now = 0;
+	uint64_t batch = 100000;
+
+	tb.init(1000, 1000, now);
+
+	runner.run("token_bucket::claim", batch, [&]() {
+			for(uint64_t i = 0; i < batch; i++)
+			{
+				now += 1000;
+				tb.claim(1, now);
+			}
+		});
+}
+
+// Serializes a storm of json alerts, as falco_outputs::handle_msg
+// does, by building a json object and dumping it, and with a
+// json_writer. The alerts are 1ms apart. The alerts per second of
+// each go in the stats.
+static void bench_json_alerts(bench_runner &runner, nlohmann::json &stats)
+{
+	string msg = "Falco internal: syscall event drop. 9 system calls dropped in last second.";
+	string rule = "Falco internal: syscall event drop";
+	map<string, string> output_fields = {
+		{"ebpf_enabled", "0"},
+		{"n_drops", "9"},
+		{"n_drops_buffer", "9"},
+		{"n_drops_pf", "0"},
+		{"n_evts", "102400"},
+		{"proc.cmdline", "bash -c \"echo \\\"hello\\\" > /tmp/out\""}
+	};
+	uint64_t batch = 10000;
+	uint64_t now = 1540475929730588123ULL;
+
+	runner.run("json_alerts/nlohmann", batch, [&]() {
+			for(uint64_t i = 0; i < batch; i++)
+			{
+				now += 1000000;
+
+				nlohmann::json jmsg;
+
+				time_t evttime = now/1000000000;
+				char time_sec[20];
+				char time_ns[12];
+				string iso8601evttime;
+
+				strftime(time_sec, sizeof(time_sec), "%FT%T", gmtime(&evttime));
+				snprintf(time_ns, sizeof(time_ns), ".%09" PRIu64 "Z", now % 1000000000);
+				iso8601evttime = time_sec;
+				iso8601evttime += time_ns;
+
+				jmsg["output"] = msg;
+				jmsg["priority"] = "Critical";
+				jmsg["rule"] = rule;
+				jmsg["time"] = iso8601evttime;
+				jmsg["output_fields"] = output_fields;
+
+				jmsg.dump();
+			}
+		});
+
+	json_writer writer;
+	runner.run("json_alerts/json_writer", batch, [&]() {
+			for(uint64_t i = 0; i < batch; i++)
+			{
+				now += 1000000;
+
+				writer.clear();
+				writer.begin_object();
+				writer.key("output");
+				writer.value(msg);
+				writer.key("output_fields");
+				writer.begin_object();
+				for(auto &pair : output_fields)
+				{
+					writer.key(pair.first);
+					writer.value(pair.second);
+				}
+				writer.end_object();
+				writer.key("priority");
+				writer.value("Critical");
+				writer.key("rule");
+				writer.value(rule);
+				writer.key("time");
+				writer.iso_8601_value(now);
+				writer.end_object();
+			}
+		});
+
+	nlohmann::json alerts_per_sec = nlohmann::json::object();
+	for(auto &res : runner.results())
+	{
+		string name = res["name"];
+		if(name.compare(0, 12, "json_alerts/") == 0)
+		{
+			double median = res["ns_per_op"]["median"];
+			alerts_per_sec[name.substr(12)] = (median > 0 ? 1e9 / median : 0);
+		}
+	}
+	stats["json_alerts_per_sec"] = alerts_per_sec;
+}
+
+static void usage()
+{
+	printf(
+	   "Usage: falco_bench [options]\n\n"
+	   "Options:\n"
+	   " -h                Print this page\n"
+	   " -b <substring>    Only run benchmarks with names containing <substring>.\n"
+	   " -n <num_samples>  Number of measured samples per benchmark (default 20).\n"
+	   " -o <file>         Write the results as json to <file> instead of stdout.\n"
+	   " -w <num_warmup>   Number of unmeasured warmup runs per benchmark (default 3).\n"
+	   "\n"
+	   );
+}
+
+int main(int argc, char **argv)
+{
+	int op;
+	string filter;
+	string output_filename;
+	uint32_t num_samples = 20;
+	uint32_t num_warmup = 3;
+
+	while((op = getopt(argc, argv, "hb:n:o:w:")) != -1)
+	{
+		switch(op)
+		{
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		case 'b':
+			filter = optarg;
+			break;
+		case 'n':
+			num_samples = atoi(optarg);
+			break;
+		case 'o':
+			output_filename = optarg;
+			break;
+		case 'w':
+			num_warmup = atoi(optarg);
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(num_samples == 0)
+	{
+		fprintf(stderr, "The number of samples must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	bench_runner runner(num_warmup, num_samples, filter);
+	nlohmann::json stats = nlohmann::json::object();
+
+	try
+	{
+		sinsp *inspector = new sinsp();
+
+		falco_engine *engine = new falco_engine();
+		engine->set_inspector(inspector);
+		engine->load_rules_file(string(FALCO_BENCH_RULES_DIR) + "/falco_rules.yaml", false, true);
+		engine->load_rules_file(string(FALCO_BENCH_RULES_DIR) + "/k8s_audit_rules.yaml", false, true);
+
+		bench_load_rules(runner, inspector);
+		bench_k8s_audit(runner, inspector, engine, stats);
+		bench_syscall(runner, inspector, engine);
+		bench_token_bucket(runner);
+		bench_json_alerts(runner, stats);
+
+		delete engine;
+		delete inspector;
+	}
+	catch(exception &e)
+	{
+		fprintf(stderr, "Error running benchmarks: %s\n", e.what());
+		return EXIT_FAILURE;
+	}
+
+	char tstr[64];
+	time_t now = time(NULL);
+	strftime(tstr, sizeof(tstr), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	nlohmann::json out = {
+		{"date", tstr},
+		{"engine_version", FALCO_ENGINE_VERSION},
+		{"warmup", num_warmup},
+		{"samples", num_samples},
+		{"benchmarks", runner.results()},
+		{"stats", stats}
+	};
+
+	if(output_filename == "")
+	{
+		cout << out.dump(2) << endl;
+	}
+	else
+	{
+		ofstream ofs(output_filename);
+		if(!ofs.is_open())
+		{
+			fprintf(stderr, "Could not open %s for writing\n", output_filename.c_str());
+			return EXIT_FAILURE;
+		}
+		ofs << out.dump(2) << endl;
+	}
+
+	return EXIT_SUCCESS;
+}
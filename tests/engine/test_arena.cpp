@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "arena.h"
+#include <catch.hpp>
+
+#include <list>
+
+TEST_CASE("arena allocations are aligned and reused after reset", "[arena]")
+{
+	arena a(1024, 1);
+
+	for(size_t align : {1, 2, 4, 8, 16})
+	{
+		void *p = a.allocate(3, align);
+		REQUIRE(((uintptr_t) p) % align == 0);
+	}
+
+	// Larger than a block
+	REQUIRE(a.allocate(4096, 8) != NULL);
+	REQUIRE(a.num_blocks() == 2);
+
+	a.reset();
+	REQUIRE(a.num_bytes() == 0);
+	REQUIRE(a.num_blocks() == 1);
+
+	// The kept block is used again
+	for(uint32_t i = 0; i < 4; i++)
+	{
+		a.allocate(100, 8);
+	}
+	REQUIRE(a.num_blocks() == 1);
+}
+
+TEST_CASE("containers can place their nodes in an arena", "[arena]")
+{
+	arena a;
+
+	{
+		std::list<uint64_t, arena_allocator<uint64_t>> l((arena_allocator<uint64_t>(&a)));
+		for(uint64_t i = 0; i < 1000; i++)
+		{
+			l.push_back(i);
+		}
+
+		REQUIRE(l.size() == 1000);
+		REQUIRE(l.back() == 999);
+		REQUIRE(a.num_bytes() >= 1000 * sizeof(uint64_t));
+	}
+
+	a.reset();
+	REQUIRE(a.num_bytes() == 0);
+
+	// Without an arena, the allocator uses the heap
+	std::list<uint64_t, arena_allocator<uint64_t>> heap;
+	heap.push_back(1);
+	REQUIRE(heap.front() == 1);
+	REQUIRE(a.num_bytes() == 0);
+}
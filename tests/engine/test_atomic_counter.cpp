@@ -0,0 +1,89 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "atomic_counter.h"
+#include <catch.hpp>
+
+#include <thread>
+#include <vector>
+
+TEST_CASE("atomic counter starts at zero", "[atomic_counter]")
+{
+	atomic_counter cnt;
+
+	REQUIRE(cnt.get() == 0);
+
+	cnt.inc();
+	cnt.inc(4);
+	REQUIRE(cnt.get() == 5);
+
+	cnt.set(42);
+	REQUIRE(cnt.get() == 42);
+}
+
+TEST_CASE("atomic counter read while written by a single thread", "[atomic_counter]")
+{
+	atomic_counter cnt;
+	const uint64_t num = 1000000;
+
+	std::thread writer([&cnt, num]() {
+		for(uint64_t i = 0; i < num; i++)
+		{
+			cnt.inc();
+		}
+	});
+
+	// Values seen by another thread never go backwards
+	uint64_t last = 0;
+	bool monotonic = true;
+	while(last < num)
+	{
+		uint64_t cur = cnt.get();
+		monotonic = monotonic && (cur >= last);
+		last = cur;
+	}
+
+	writer.join();
+
+	REQUIRE(monotonic);
+	REQUIRE(cnt.get() == num);
+}
+
+TEST_CASE("atomic counter added to by several threads", "[atomic_counter]")
+{
+	atomic_counter cnt;
+	const uint64_t num = 100000;
+	std::vector<std::thread> writers;
+
+	for(int t = 0; t < 4; t++)
+	{
+		writers.emplace_back([&cnt, num]() {
+			for(uint64_t i = 0; i < num; i++)
+			{
+				cnt.add();
+			}
+		});
+	}
+
+	for(auto &w : writers)
+	{
+		w.join();
+	}
+
+	REQUIRE(cnt.get() == 4 * num);
+}
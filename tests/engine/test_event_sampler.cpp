@@ -0,0 +1,95 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "event_sampler.h"
+#include <catch.hpp>
+
+static uint32_t num_kept(event_sampler &sampler, uint32_t tag, uint32_t num_events)
+{
+	uint32_t kept = 0;
+
+	for(uint32_t i = 0; i < num_events; i++)
+	{
+		if(!sampler.sample_out(tag))
+		{
+			kept++;
+		}
+	}
+
+	return kept;
+}
+
+TEST_CASE("event sampler keeps all events by default", "[event_sampler]")
+{
+	event_sampler sampler(4);
+
+	REQUIRE(!sampler.enabled());
+	REQUIRE(num_kept(sampler, 0, 1000) == 1000);
+	REQUIRE(sampler.num_sampled_out(0) == 0);
+}
+
+TEST_CASE("event sampler keeps the configured fraction of each tag", "[event_sampler]")
+{
+	event_sampler sampler(4);
+
+	sampler.set_default_keep_fraction(0.5);
+	sampler.set_keep_fraction(1, 0.1);
+	sampler.set_keep_fraction(2, 1);
+	sampler.set_keep_fraction(3, 0);
+
+	REQUIRE(sampler.enabled());
+	REQUIRE(num_kept(sampler, 0, 1000) == 500);
+	REQUIRE(num_kept(sampler, 1, 1000) == 100);
+	REQUIRE(num_kept(sampler, 2, 1000) == 1000);
+	REQUIRE(num_kept(sampler, 3, 1000) == 0);
+
+	REQUIRE(sampler.num_sampled_out(0) == 500);
+	REQUIRE(sampler.num_sampled_out(1) == 900);
+	REQUIRE(sampler.num_sampled_out(3) == 1000);
+
+	SECTION("kept events are evenly spaced")
+	{
+		uint32_t kept = 0;
+		for(uint32_t i = 0; i < 10; i++)
+		{
+			kept += num_kept(sampler, 1, 10);
+			REQUIRE(kept == i + 1);
+		}
+	}
+
+	SECTION("a negative fraction goes back to the default")
+	{
+		sampler.set_keep_fraction(1, -1);
+		REQUIRE(num_kept(sampler, 1, 1000) == 500);
+	}
+}
+
+TEST_CASE("event sampler never drops protected tags", "[event_sampler]")
+{
+	event_sampler sampler(4);
+
+	sampler.set_default_keep_fraction(0.25);
+	sampler.set_protected({false, true});
+
+	REQUIRE(sampler.enabled());
+	REQUIRE(num_kept(sampler, 0, 1000) == 250);
+	REQUIRE(num_kept(sampler, 1, 1000) == 1000);
+
+	// Out of range tags are never dropped either
+	REQUIRE(!sampler.sample_out(4));
+}
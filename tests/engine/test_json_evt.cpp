@@ -0,0 +1,141 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <memory>
+
+#include "json_evt.h"
+#include <catch.hpp>
+
+static json_event_filter_check *new_check(json_event_filter_factory &factory, const char *field, cmpop op, std::vector<std::string> values)
+{
+	json_event_filter_check *chk = (json_event_filter_check *) factory.new_filtercheck(field);
+	REQUIRE(chk != NULL);
+
+	chk->m_cmpop = op;
+	for(auto &val : values)
+	{
+		chk->add_filter_value(val.c_str(), val.size());
+	}
+
+	return chk;
+}
+
+static void set_uri(json_event &evt, const std::string &uri)
+{
+	nlohmann::json j = {{"verb", "get"}, {"requestURI", uri}};
+	evt.set_jevt(j, 0);
+}
+
+TEST_CASE("json filtercheck in", "[json_evt]")
+{
+	json_event_filter_factory factory;
+	json_event evt;
+	std::unique_ptr<json_event_filter_check> chk(new_check(factory, "ka.uri", CO_IN, {"/api", "/apis", "/healthz"}));
+
+	set_uri(evt, "/healthz");
+	REQUIRE(chk->compare(&evt));
+
+	set_uri(evt, "/healthz/etcd");
+	REQUIRE_FALSE(chk->compare(&evt));
+
+	set_uri(evt, "/ap");
+	REQUIRE_FALSE(chk->compare(&evt));
+}
+
+TEST_CASE("json filtercheck pmatch", "[json_evt]")
+{
+	json_event_filter_factory factory;
+	json_event evt;
+	std::unique_ptr<json_event_filter_check> chk(new_check(factory, "ka.uri", CO_PMATCH, {"/api/v1/namespaces", "/healthz"}));
+
+	set_uri(evt, "/healthz");
+	REQUIRE(chk->compare(&evt));
+
+	set_uri(evt, "/api/v1/namespaces/default/pods");
+	REQUIRE(chk->compare(&evt));
+
+	set_uri(evt, "/api/v1/nodes");
+	REQUIRE_FALSE(chk->compare(&evt));
+
+	// Matches are by path component, not by string prefix
+	set_uri(evt, "/healthzz");
+	REQUIRE_FALSE(chk->compare(&evt));
+}
+
+TEST_CASE("json filtercheck on raw events", "[json_evt]")
+{
+	std::string data = R"({"kind": "Event", "verb": "create",
+		"user": {"username": "sys\"admin\""},
+		"annotations": {"authorization.k8s.io/decision": "allow"},
+		"objectRef": {"resource": "pods", "namespace": "default"},
+		"requestObject": {"spec": {"containers": [{"image": "nginx"}, {"image": "busybox"}]}},
+		"stageTimestamp": "2018-10-25T13:58:49.730588Z"})";
+
+	json_event_filter_factory factory;
+	std::vector<std::string> fields = {"ka.verb", "ka.user.name", "ka.target.resource", "ka.auth.decision",
+					   "ka.req.container.image[1]", "ka.target.subresource",
+					   "jevt.value[/requestObject/spec/containers/0/image]", "jevt.obj"};
+
+	std::shared_ptr<json_index> doc = std::make_shared<json_index>();
+	std::string errstr;
+	REQUIRE(doc->index(data.data(), data.size(), errstr));
+
+	nlohmann::json j = nlohmann::json::parse(data);
+	json_event dom_evt, raw_evt;
+	dom_evt.set_jevt(j, 0);
+	raw_evt.set_raw(doc, doc->root(), false, 0);
+
+	for(auto &field : fields)
+	{
+		std::unique_ptr<json_event_filter_check> chk(new_check(factory, field.c_str(), CO_EXISTS, {}));
+		REQUIRE(chk->extract(&raw_evt) == chk->extract(&dom_evt));
+	}
+
+	std::unique_ptr<json_event_filter_check> chk(new_check(factory, "ka.user.name", CO_EXISTS, {}));
+	REQUIRE(chk->extract(&raw_evt) == "sys\"admin\"");
+
+	std::string bad = R"({"kind": "Event", "items": [1, 2})";
+	REQUIRE_FALSE(doc->index(bad.data(), bad.size(), errstr));
+}
+
+TEST_CASE("json formatter reuses values extracted by filterchecks", "[json_evt]")
+{
+	json_event_filter_factory factory;
+	json_event evt;
+	std::unique_ptr<json_event_filter_check> chk(new_check(factory, "ka.uri", CO_EQ, {"/healthz"}));
+
+	set_uri(evt, "/healthz");
+	REQUIRE(chk->compare(&evt));
+
+	// Checks for the same field share the cached value
+	std::unique_ptr<json_event_filter_check> other(new_check(factory, "ka.uri", CO_EQ, {"/api"}));
+	uint32_t id = json_event_filter_check::field_id("ka.uri");
+	REQUIRE(evt.cached_field(id) != NULL);
+	REQUIRE(&other->extract_cached(&evt) == evt.cached_field(id));
+	REQUIRE_FALSE(evt.cached_field(json_event_filter_check::field_id("ka.verb")));
+
+	std::string format = "uri=%ka.uri verb=%ka.verb";
+	json_event_formatter formatter(factory, format);
+	REQUIRE(formatter.tostring(&evt) == "uri=/healthz verb=get");
+	REQUIRE(evt.cached_field(json_event_filter_check::field_id("ka.verb")) != NULL);
+
+	// Setting the event forgets the cached values
+	set_uri(evt, "/api");
+	REQUIRE(evt.cached_field(id) == NULL);
+	REQUIRE(formatter.tostring(&evt) == "uri=/api verb=get");
+}
@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "json_writer.h"
+#include <catch.hpp>
+
+#include <nlohmann/json.hpp>
+
+TEST_CASE("json writer escapes strings and nests objects", "[json_writer]")
+{
+	json_writer w;
+
+	std::string odd = "quote\" backslash\\ newline\n tab\t ctrl\x01 nul";
+	odd += '\0';
+
+	w.begin_object();
+	w.key("output");
+	w.value(odd);
+	w.key("num");
+	w.value((uint64_t) 18446744073709551615ULL);
+	w.key("zero");
+	w.value((uint64_t) 0);
+	w.key("flag");
+	w.value(true);
+	w.key("fields");
+	w.begin_object();
+	w.key("proc.name");
+	w.value("bash");
+	w.key("empty");
+	w.begin_object();
+	w.end_object();
+	w.end_object();
+	w.key("raw");
+	w.raw_value("[1,2]", 5);
+	w.end_object();
+
+	nlohmann::json j = nlohmann::json::parse(w.str());
+	REQUIRE(j["output"] == odd);
+	REQUIRE(j["num"] == 18446744073709551615ULL);
+	REQUIRE(j["zero"] == 0);
+	REQUIRE(j["flag"] == true);
+	REQUIRE(j["fields"]["proc.name"] == "bash");
+	REQUIRE(j["fields"]["empty"].empty());
+	REQUIRE(j["raw"] == nlohmann::json({1, 2}));
+
+	// The buffer is reused for the next document
+	w.clear();
+	w.begin_object();
+	w.end_object();
+	REQUIRE(w.str() == "{}");
+}
+
+TEST_CASE("json writer formats timestamps as ISO 8601", "[json_writer]")
+{
+	json_writer w;
+
+	w.begin_object();
+	w.key("a");
+	w.iso_8601_value(1540475929730588123ULL);
+	w.key("b");
+	w.iso_8601_value(1540475929000000001ULL);
+	w.key("c");
+	w.iso_8601_value(1540475930000000000ULL);
+	w.end_object();
+
+	REQUIRE(w.str() == "{\"a\":\"2018-10-25T13:58:49.730588123Z\","
+		"\"b\":\"2018-10-25T13:58:49.000000001Z\","
+		"\"c\":\"2018-10-25T13:58:50.000000000Z\"}");
+}
@@ -0,0 +1,96 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "k8s_audit_prefilter.h"
+#include <catch.hpp>
+
+static bool keep(k8s_audit_prefilter &prefilter, const std::string &data)
+{
+	json_index doc;
+	std::string errstr;
+
+	REQUIRE(doc.index(data.data(), data.size(), errstr));
+
+	return prefilter.keep(doc, doc.root());
+}
+
+TEST_CASE("k8s audit prefilter keeps listed values", "[k8s_audit_prefilter]")
+{
+	k8s_audit_prefilter prefilter;
+	REQUIRE_FALSE(prefilter.enabled());
+	REQUIRE(keep(prefilter, R"({"stage": "RequestReceived"})"));
+
+	prefilter.set_values(k8s_audit_prefilter::R_STAGE, {"ResponseComplete"});
+	prefilter.set_values(k8s_audit_prefilter::R_RESOURCE, {"pods", "secrets"});
+	REQUIRE(prefilter.enabled());
+
+	REQUIRE(keep(prefilter, R"({"stage": "ResponseComplete", "objectRef": {"resource": "pods"}})"));
+	REQUIRE_FALSE(keep(prefilter, R"({"stage": "RequestReceived", "objectRef": {"resource": "pods"}})"));
+	REQUIRE_FALSE(keep(prefilter, R"({"stage": "ResponseComplete", "objectRef": {"resource": "nodes"}})"));
+	REQUIRE_FALSE(keep(prefilter, R"({"stage": "ResponseComplete"})"));
+
+	REQUIRE(prefilter.num_dropped(k8s_audit_prefilter::R_STAGE) == 1);
+	REQUIRE(prefilter.num_dropped(k8s_audit_prefilter::R_RESOURCE) == 2);
+}
+
+static bool keep_unique(k8s_audit_prefilter &prefilter, const std::string &data)
+{
+	json_index doc;
+	std::string errstr;
+
+	REQUIRE(doc.index(data.data(), data.size(), errstr));
+
+	return prefilter.keep_unique(doc, doc.root());
+}
+
+TEST_CASE("k8s audit prefilter drops duplicate audit ids", "[k8s_audit_prefilter]")
+{
+	k8s_audit_prefilter prefilter;
+	prefilter.set_dedupe(true, 3);
+	REQUIRE(prefilter.enabled());
+
+	REQUIRE(keep_unique(prefilter, R"({"auditID": "a", "stage": "RequestReceived"})"));
+	REQUIRE(keep_unique(prefilter, R"({"auditID": "a", "stage": "ResponseComplete"})"));
+	REQUIRE_FALSE(keep_unique(prefilter, R"({"auditID": "a", "stage": "ResponseComplete"})"));
+	REQUIRE(keep_unique(prefilter, R"({"auditID": "b"})"));
+	REQUIRE(keep_unique(prefilter, R"({"auditID": "c"})"));
+	REQUIRE(keep_unique(prefilter, R"({"stage": "ResponseComplete"})"));
+	REQUIRE(keep_unique(prefilter, R"({"stage": "ResponseComplete"})"));
+
+	// Only the last 3 pairs are remembered
+	REQUIRE(keep_unique(prefilter, R"({"auditID": "a", "stage": "RequestReceived"})"));
+	REQUIRE_FALSE(keep_unique(prefilter, R"({"auditID": "c"})"));
+
+	REQUIRE(prefilter.num_dropped(k8s_audit_prefilter::R_DUPLICATE) == 2);
+}
+
+TEST_CASE("k8s audit prefilter keeps one stage per audit id", "[k8s_audit_prefilter]")
+{
+	k8s_audit_prefilter prefilter;
+	prefilter.set_dedupe(true, 100, "ResponseComplete");
+
+	REQUIRE_FALSE(keep_unique(prefilter, R"({"auditID": "a", "stage": "RequestReceived"})"));
+	REQUIRE_FALSE(keep_unique(prefilter, R"({"auditID": "a", "stage": "ResponseStarted"})"));
+	REQUIRE(keep_unique(prefilter, R"({"auditID": "a", "stage": "ResponseComplete"})"));
+	REQUIRE_FALSE(keep_unique(prefilter, R"({"auditID": "a", "stage": "ResponseComplete"})"));
+	REQUIRE_FALSE(keep_unique(prefilter, R"({"auditID": "b"})"));
+	REQUIRE(keep_unique(prefilter, R"({"auditID": "b", "stage": "ResponseComplete"})"));
+	REQUIRE(keep_unique(prefilter, R"({"stage": "RequestReceived"})"));
+
+	REQUIRE(prefilter.num_dropped(k8s_audit_prefilter::R_DUPLICATE) == 4);
+}
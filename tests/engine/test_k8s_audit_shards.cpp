@@ -0,0 +1,146 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "k8s_audit_shards.h"
+#include <catch.hpp>
+
+static const std::string s_rules = R"(
+- rule: k8s create
+  desc: a create
+  condition: ka.verb=create
+  output: create of name=%ka.target.name
+  priority: WARNING
+  source: k8s_audit
+
+- rule: k8s delete
+  desc: a delete
+  condition: ka.verb=delete
+  output: delete of name=%ka.target.name
+  priority: WARNING
+  source: k8s_audit
+)";
+
+// Add num events cycling through the verbs create, delete and get
+static void add_events(falco_engine &engine, uint32_t num, json_event_list &evts)
+{
+	std::vector<std::string> verbs = {"create", "delete", "get"};
+	for(uint32_t i = 0; i < num; i++)
+	{
+		nlohmann::json j = {
+			{"kind", "Event"},
+			{"verb", verbs[i % verbs.size()]},
+			{"objectRef", {{"namespace", "default"}, {"name", "pod-" + std::to_string(i % 17)}}},
+			{"stageTimestamp", "2019-01-01T00:00:00.000000Z"}
+		};
+		REQUIRE(engine.parse_k8s_audit_json(j, evts));
+	}
+}
+
+TEST_CASE("k8s audit shards match like a single engine, in order", "[k8s_audit_shards]")
+{
+	sinsp inspector;
+	falco_engine engine;
+
+	engine.set_inspector(&inspector);
+	engine.load_rules(s_rules, false, true);
+
+	// The clones must see rules disabled after loading
+	engine.enable_rule("k8s delete", false);
+
+	json_event_list evts;
+	add_events(engine, 300, evts);
+
+	std::vector<json_event *> evt_ptrs;
+	std::vector<json_event *> expected;
+	falco_engine::rule_result res;
+
+	for(auto &evt : evts)
+	{
+		evt_ptrs.push_back(&evt);
+		if(engine.process_k8s_audit_event(&evt, res))
+		{
+			REQUIRE(res.info->rule == "k8s create");
+			expected.push_back(&evt);
+		}
+	}
+	REQUIRE(expected.size() == 100);
+
+	k8s_audit_shards shards(&engine, 4);
+	std::vector<json_event *> matched;
+
+	shards.process_events(evt_ptrs.data(), evt_ptrs.size(), [&](falco_engine::rule_result &res) {
+			REQUIRE(res.info->rule == "k8s create");
+			matched.push_back((json_event *) res.evt);
+		});
+
+	REQUIRE(matched == expected);
+
+	// Events about the same object go to the same worker
+	REQUIRE(shards.shard(evt_ptrs[0]) == shards.shard(evt_ptrs[17]));
+}
+
+TEST_CASE("k8s audit shards counts are reported by the engine", "[k8s_audit_shards]")
+{
+	sinsp inspector;
+	falco_engine engine;
+
+	engine.set_inspector(&inspector);
+	engine.set_rule_timing(true);
+	engine.load_rules(s_rules, false, true);
+
+	json_event_list evts;
+	add_events(engine, 30, evts);
+
+	std::vector<json_event *> evt_ptrs;
+	for(auto &evt : evts)
+	{
+		evt_ptrs.push_back(&evt);
+	}
+
+	std::map<std::string, std::pair<uint64_t, uint64_t>> counts;
+
+	{
+		k8s_audit_shards shards(&engine, 4);
+		uint32_t num_matched = 0;
+
+		shards.process_events(evt_ptrs.data(), evt_ptrs.size(), [&](falco_engine::rule_result &res) {
+				num_matched++;
+			});
+		REQUIRE(num_matched == 20);
+
+		engine.get_rule_counts(counts);
+		REQUIRE(counts["k8s create"].second == 10);
+		REQUIRE(counts["k8s delete"].second == 10);
+
+		std::map<std::string, uint64_t> num_events, num_sampled_out;
+		engine.get_source_counts(num_events, num_sampled_out);
+		REQUIRE(num_events["k8s_audit"] == 30);
+
+		// The workers time the rules too
+		nlohmann::json coverage;
+		engine.get_rule_coverage(coverage);
+		REQUIRE(coverage["rules"]["k8s create"]["matched"].get<uint64_t>() == 10);
+		REQUIRE(coverage["rules"]["k8s create"]["eval_time_ns"].get<uint64_t>() > 0);
+	}
+
+	// Once the workers are gone, only the engine's own counts
+	// are left
+	counts.clear();
+	engine.get_rule_counts(counts);
+	REQUIRE(counts["k8s create"].second == 0);
+}
@@ -0,0 +1,102 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "falco_engine.h"
+#include <catch.hpp>
+
+// Count the allocations made by the whole test binary, so a test can
+// check that some code does not allocate.
+static std::atomic<uint64_t> s_num_allocs(0);
+
+void *operator new(std::size_t size)
+{
+	s_num_allocs++;
+
+	void *ptr = malloc(size == 0 ? 1 : size);
+	if(ptr == NULL)
+	{
+		throw std::bad_alloc();
+	}
+
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+static const std::string s_rules = R"(
+- rule: k8s create
+  desc: a create
+  condition: ka.verb=create
+  output: create by user=%ka.user.name
+  priority: WARNING
+  source: k8s_audit
+)";
+
+TEST_CASE("matching an event does not allocate", "[rule_result]")
+{
+	sinsp inspector;
+	falco_engine engine;
+
+	engine.set_inspector(&inspector);
+	engine.load_rules(s_rules, false, true);
+
+	json_event_list evts;
+	nlohmann::json j = {
+		{"kind", "Event"},
+		{"stage", "ResponseComplete"},
+		{"verb", "create"},
+		{"user", {{"username", "admin"}}},
+		{"stageTimestamp", "2019-01-01T00:00:00.000000Z"}
+	};
+	REQUIRE(engine.parse_k8s_audit_json(j, evts));
+	REQUIRE(evts.size() == 1);
+
+	json_event *evt = &evts.front();
+	falco_engine::rule_result res;
+
+	// The first match can grow buffers in the filterchecks
+	REQUIRE(engine.process_k8s_audit_event(evt, res));
+	REQUIRE(res.evt == evt);
+	REQUIRE(res.priority_num == falco_common::PRIORITY_WARNING);
+	REQUIRE(res.info->rule == "k8s create");
+	REQUIRE(res.info->source == "k8s_audit");
+	REQUIRE(engine.get_rule_info(res.rule_id) == res.info);
+
+	uint64_t num_allocs = s_num_allocs;
+	bool all_matched = true;
+
+	// Clear the values cached by the event, so that each match
+	// extracts them again
+	for(uint32_t i = 0; i < 1000; i++)
+	{
+		evt->clear_fields();
+		all_matched = engine.process_k8s_audit_event(evt, res) && all_matched;
+	}
+
+	uint64_t num_match_allocs = s_num_allocs - num_allocs;
+
+	REQUIRE(all_matched);
+	REQUIRE(num_match_allocs == 0);
+}
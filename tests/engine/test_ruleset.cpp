@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "falco_engine.h"
+#include <catch.hpp>
+
+static const std::string s_rules = R"(
+- rule: k8s create
+  desc: a create
+  condition: ka.verb=create
+  output: create by user=%ka.user.name
+  priority: WARNING
+  source: k8s_audit
+
+- rule: a create
+  desc: another create
+  condition: ka.verb=create
+  output: create by user=%ka.user.name
+  priority: WARNING
+  source: k8s_audit
+)";
+
+// Load shedding disables and re-enables rules while events are
+// processed, which must not change which rule matches first.
+TEST_CASE("re-enabling a rule keeps the rule order", "[ruleset]")
+{
+	sinsp inspector;
+	falco_engine engine;
+
+	engine.set_inspector(&inspector);
+	engine.load_rules(s_rules, false, true);
+
+	json_event_list evts;
+	nlohmann::json j = {
+		{"kind", "Event"},
+		{"stage", "ResponseComplete"},
+		{"verb", "create"},
+		{"user", {{"username", "admin"}}},
+		{"stageTimestamp", "2019-01-01T00:00:00.000000Z"}
+	};
+	REQUIRE(engine.parse_k8s_audit_json(j, evts));
+
+	falco_engine::rule_result res;
+	REQUIRE(engine.process_k8s_audit_event(&evts.front(), res));
+	REQUIRE(res.info->rule == "k8s create");
+
+	engine.enable_rule("k8s create", false);
+	REQUIRE(engine.process_k8s_audit_event(&evts.front(), res));
+	REQUIRE(res.info->rule == "a create");
+
+	engine.enable_rule("k8s create", true);
+	REQUIRE(engine.process_k8s_audit_event(&evts.front(), res));
+	REQUIRE(res.info->rule == "k8s create");
+}
@@ -0,0 +1,145 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "syslog_sink.h"
+#include <catch.hpp>
+
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// A stand-in for the syslog daemon, bound to a unix socket
+class syslog_stub
+{
+public:
+	syslog_stub()
+	{
+		char tmpl[] = "/tmp/falco_syslog_XXXXXX";
+		REQUIRE(mkdtemp(tmpl) != NULL);
+		m_dir = tmpl;
+		m_path = m_dir + "/log";
+
+		m_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+		REQUIRE(m_fd != -1);
+
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, m_path.c_str(), sizeof(addr.sun_path) - 1);
+		REQUIRE(bind(m_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+
+		// Don't block forever if a message is missing
+		struct timeval tv = {5, 0};
+		setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	}
+
+	~syslog_stub()
+	{
+		close(m_fd);
+		unlink(m_path.c_str());
+		rmdir(m_dir.c_str());
+	}
+
+	// Receive num messages, on a thread of its own as the socket
+	// only queues a few messages.
+	void start_receiving(size_t num)
+	{
+		m_thread = std::thread([this, num]() {
+				char buf[8192];
+				for(size_t i = 0; i < num; i++)
+				{
+					ssize_t len = ::recv(m_fd, buf, sizeof(buf), 0);
+					if(len < 0)
+					{
+						break;
+					}
+					m_msgs.push_back(std::string(buf, len));
+				}
+			});
+	}
+
+	std::vector<std::string> &wait_received()
+	{
+		m_thread.join();
+		return m_msgs;
+	}
+
+	const std::string &path()
+	{
+		return m_path;
+	}
+
+private:
+	std::string m_dir;
+	std::string m_path;
+	int m_fd;
+	std::thread m_thread;
+	std::vector<std::string> m_msgs;
+};
+
+TEST_CASE("syslog sink sends RFC 5424 messages in order", "[syslog_sink]")
+{
+	syslog_stub stub;
+	syslog_sink sink(stub.path(), "falco", LOG_USER);
+	std::string errstr;
+
+	REQUIRE(sink.open(errstr));
+
+	uint32_t num_msgs = 200;
+	stub.start_receiving(num_msgs);
+
+	for(uint32_t i = 0; i < num_msgs; i++)
+	{
+		std::string msg = "alert " + std::to_string(i) + "\n";
+		sink.send(LOG_WARNING, msg.data(), msg.size());
+	}
+	sink.flush();
+
+	REQUIRE(sink.num_sent() == num_msgs);
+	REQUIRE(sink.num_dropped() == 0);
+
+	std::vector<std::string> &msgs = stub.wait_received();
+	REQUIRE(msgs.size() == num_msgs);
+
+	std::string suffix = " falco " + std::to_string(getpid()) + " - - ";
+	for(uint32_t i = 0; i < num_msgs; i++)
+	{
+		std::string &msg = msgs[i];
+
+		// <12>1 2018-10-25T13:58:49.730588Z host falco 1234 - - alert 0
+		REQUIRE(msg.compare(0, 6, "<12>1 ") == 0);
+		REQUIRE(msg[10] == '-');
+		REQUIRE(msg[32] == 'Z');
+
+		std::string text = "alert " + std::to_string(i);
+		REQUIRE(msg.size() > suffix.size() + text.size());
+		REQUIRE(msg.compare(msg.size() - text.size() - suffix.size(), std::string::npos, suffix + text) == 0);
+	}
+}
+
+TEST_CASE("syslog sink fails to open a missing socket", "[syslog_sink]")
+{
+	syslog_sink sink("/nonexistent/falco/log");
+	std::string errstr;
+
+	REQUIRE_FALSE(sink.open(errstr));
+	REQUIRE(errstr.find("/nonexistent/falco/log") != std::string::npos);
+}
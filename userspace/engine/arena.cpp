@@ -0,0 +1,104 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <algorithm>
+
+#include "arena.h"
+
+using namespace std;
+
+arena::arena(size_t block_size, size_t max_kept_blocks)
+	: m_block_size(block_size),
+	  m_max_kept_blocks(max_kept_blocks),
+	  m_cur(0),
+	  m_offset(0),
+	  m_num_bytes(0)
+{
+}
+
+arena::~arena()
+{
+	for(auto &b : m_blocks)
+	{
+		::operator delete(b.data);
+	}
+}
+
+void *arena::allocate(size_t size, size_t align)
+{
+	while(true)
+	{
+		if(m_cur < m_blocks.size())
+		{
+			block &b = m_blocks[m_cur];
+			uintptr_t free = (uintptr_t) (b.data + m_offset);
+			size_t start = ((free + align - 1) & ~(uintptr_t) (align - 1)) - (uintptr_t) b.data;
+
+			if(start + size <= b.size)
+			{
+				m_offset = start + size;
+				m_num_bytes += size;
+				return b.data + start;
+			}
+
+			// Move on to the next block, if it is large enough
+			if(m_cur + 1 < m_blocks.size() &&
+			   size + align <= m_blocks[m_cur + 1].size)
+			{
+				m_cur++;
+				m_offset = 0;
+				continue;
+			}
+		}
+
+		// Add a block, large enough for this allocation, after
+		// the current one.
+		block b;
+		b.size = max(m_block_size, size + align);
+		b.data = static_cast<char *>(::operator new(b.size));
+
+		size_t pos = (m_blocks.empty() ? 0 : m_cur + 1);
+		m_blocks.insert(m_blocks.begin() + pos, b);
+		m_cur = pos;
+		m_offset = 0;
+	}
+}
+
+void arena::reset()
+{
+	while(m_blocks.size() > m_max_kept_blocks)
+	{
+		::operator delete(m_blocks.back().data);
+		m_blocks.pop_back();
+	}
+
+	m_cur = 0;
+	m_offset = 0;
+	m_num_bytes = 0;
+}
+
+size_t arena::num_blocks()
+{
+	return m_blocks.size();
+}
+
+size_t arena::num_bytes()
+{
+	return m_num_bytes;
+}
@@ -0,0 +1,138 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// A memory arena for objects that all go away at the same time,
+// e.g. the events of a request. Allocations are carved out of large
+// blocks and are never freed individually. reset() releases all of
+// them at once, keeping some of the blocks for the next use.
+//
+// Not thread-safe.
+class arena
+{
+public:
+	arena(size_t block_size = 64 * 1024, size_t max_kept_blocks = 8);
+	virtual ~arena();
+
+	void *allocate(size_t size, size_t align);
+
+	// Release all allocations. Objects allocated in the arena
+	// must have been destroyed.
+	void reset();
+
+	// The number of blocks currently held, and the number of
+	// bytes allocated since the last reset.
+	size_t num_blocks();
+	size_t num_bytes();
+
+private:
+	struct block
+	{
+		char *data;
+		size_t size;
+	};
+
+	arena(const arena &) = delete;
+	arena &operator=(const arena &) = delete;
+
+	std::vector<block> m_blocks;
+	size_t m_block_size;
+	size_t m_max_kept_blocks;
+
+	// The block being allocated from, and the offset of the
+	// free space in it.
+	size_t m_cur;
+	size_t m_offset;
+
+	size_t m_num_bytes;
+};
+
+// A standard allocator allocating from an arena, so standard
+// containers can place their nodes in it. Deallocation does nothing,
+// the memory goes back to the arena on arena::reset(). Without an
+// arena, it allocates from the heap like std::allocator.
+template<typename T>
+class arena_allocator
+{
+public:
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	arena_allocator() noexcept
+		: m_arena(NULL)
+	{
+	}
+
+	explicit arena_allocator(arena *a) noexcept
+		: m_arena(a)
+	{
+	}
+
+	template<typename U>
+	arena_allocator(const arena_allocator<U> &other) noexcept
+		: m_arena(other.get_arena())
+	{
+	}
+
+	T *allocate(size_t n)
+	{
+		if(m_arena == NULL)
+		{
+			return static_cast<T *>(::operator new(n * sizeof(T)));
+		}
+
+		return static_cast<T *>(m_arena->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T *p, size_t n) noexcept
+	{
+		if(m_arena == NULL)
+		{
+			::operator delete(p);
+		}
+	}
+
+	arena *get_arena() const noexcept
+	{
+		return m_arena;
+	}
+
+private:
+	arena *m_arena;
+};
+
+template<typename T, typename U>
+inline bool operator==(const arena_allocator<T> &a, const arena_allocator<U> &b) noexcept
+{
+	return (a.get_arena() == b.get_arena());
+}
+
+template<typename T, typename U>
+inline bool operator!=(const arena_allocator<T> &a, const arena_allocator<U> &b) noexcept
+{
+	return (a.get_arena() != b.get_arena());
+}
@@ -0,0 +1,63 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// A counter that can be read from any thread (e.g. to serve metrics)
+// while it is being updated, without taking any locks.
+//
+// inc()/set() must only be called from a single thread. They are a
+// plain load and store rather than an atomic read-modify-write, so
+// they cost the same as incrementing a uint64_t on the event
+// processing path. Counters updated by several threads should use
+// add() instead.
+class atomic_counter
+{
+public:
+	atomic_counter()
+		: m_value(0)
+	{
+	}
+
+	inline void inc(uint64_t n = 1)
+	{
+		m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	inline void set(uint64_t value)
+	{
+		m_value.store(value, std::memory_order_relaxed);
+	}
+
+	inline void add(uint64_t n = 1)
+	{
+		m_value.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	inline uint64_t get() const
+	{
+		return m_value.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> m_value;
+};
@@ -0,0 +1,115 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <cmath>
+
+#include "event_sampler.h"
+
+using namespace std;
+
+event_sampler::tag_state::tag_state()
+	: step(s_one), acc(0), fraction(-1), is_protected(false)
+{
+}
+
+event_sampler::event_sampler(uint32_t num_tags)
+	: m_num_tags(num_tags),
+	  m_tags(new tag_state[num_tags]),
+	  m_default_fraction(1),
+	  m_enabled(false)
+{
+}
+
+event_sampler::~event_sampler()
+{
+}
+
+void event_sampler::set_default_keep_fraction(double fraction)
+{
+	m_default_fraction = fraction;
+	update();
+}
+
+void event_sampler::set_keep_fraction(uint32_t tag, double fraction)
+{
+	if(tag >= m_num_tags)
+	{
+		return;
+	}
+
+	m_tags[tag].fraction = fraction;
+	update();
+}
+
+void event_sampler::set_protected(const vector<bool> &tags)
+{
+	for(uint32_t tag = 0; tag < m_num_tags; tag++)
+	{
+		m_tags[tag].is_protected = (tag < tags.size() && tags[tag]);
+	}
+	update();
+}
+
+uint64_t event_sampler::num_sampled_out(uint32_t tag)
+{
+	if(tag >= m_num_tags)
+	{
+		return 0;
+	}
+
+	return m_tags[tag].num_sampled_out.get();
+}
+
+uint32_t event_sampler::num_tags()
+{
+	return m_num_tags;
+}
+
+void event_sampler::update()
+{
+	m_enabled = false;
+
+	for(uint32_t tag = 0; tag < m_num_tags; tag++)
+	{
+		tag_state &ts = m_tags[tag];
+		double fraction = (ts.fraction < 0 ? m_default_fraction : ts.fraction);
+
+		if(ts.is_protected || fraction >= 1)
+		{
+			ts.step = s_one;
+		}
+		else if(fraction <= 0)
+		{
+			ts.step = 0;
+		}
+		else
+		{
+			// Rounded up, so the fraction kept is never
+			// below the configured one
+			ts.step = (uint64_t) ceil(fraction * s_one);
+		}
+
+		// Protected tags still count, so the protection is
+		// checked again when the rules change
+		if(fraction < 1)
+		{
+			m_enabled = true;
+		}
+	}
+}
@@ -0,0 +1,116 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "atomic_counter.h"
+
+// Decides which events to drop before they are checked against the
+// rules, when falco is configured to only look at a fraction of
+// them.
+//
+// Events are grouped by tag (e.g. the event type), and each tag keeps
+// a fraction of its events. Rather than flipping a coin for each
+// event, each tag has a fixed point accumulator that gains the
+// fraction with every event, and an event is kept each time the
+// accumulator wraps. This keeps exactly the configured fraction of
+// each tag's events, evenly spaced, with no shared state between
+// tags and no calls into the libc PRNG.
+class event_sampler
+{
+public:
+	event_sampler(uint32_t num_tags);
+	virtual ~event_sampler();
+
+	// The fraction of events to keep for tags that were not
+	// given their own. 1 (the default) keeps all events.
+	void set_default_keep_fraction(double fraction);
+
+	// The fraction of events to keep for a single tag. A negative
+	// fraction goes back to the default.
+	void set_keep_fraction(uint32_t tag, double fraction);
+
+	// Events with a protected tag are always kept, whatever the
+	// fraction. Indexed by tag.
+	void set_protected(const std::vector<bool> &tags);
+
+	// Whether any tag has a fraction below 1, protected or not.
+	inline bool enabled()
+	{
+		return m_enabled;
+	}
+
+	// Returns true if an event with this tag should be dropped.
+	inline bool sample_out(uint32_t tag)
+	{
+		if(!m_enabled || tag >= m_num_tags)
+		{
+			return false;
+		}
+
+		tag_state &ts = m_tags[tag];
+
+		ts.acc += ts.step;
+		if(ts.acc >= s_one)
+		{
+			ts.acc -= s_one;
+			return false;
+		}
+
+		ts.num_sampled_out.inc();
+		return true;
+	}
+
+	// Number of events dropped for the tag. Can be called from
+	// any thread.
+	uint64_t num_sampled_out(uint32_t tag);
+
+	uint32_t num_tags();
+
+private:
+	// Recompute each tag's step from the fractions
+	void update();
+
+	// 1.0 in the fixed point representation of the accumulators
+	static const uint64_t s_one = (1ULL << 32);
+
+	struct tag_state {
+		tag_state();
+
+		// Fraction kept, as a fixed point number. s_one
+		// keeps all events.
+		uint64_t step;
+		uint64_t acc;
+
+		// A negative fraction means the default one
+		double fraction;
+		bool is_protected;
+
+		atomic_counter num_sampled_out;
+	};
+
+	uint32_t m_num_tags;
+	std::unique_ptr<tag_state[]> m_tags;
+	double m_default_fraction;
+	bool m_enabled;
+};
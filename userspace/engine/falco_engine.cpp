@@ -17,10 +17,12 @@ limitations under the License.
 
 */
 
+#include <cinttypes>
 #include <cstdlib>
 #include <unistd.h>
 #include <string>
 #include <fstream>
+#include <chrono>
 
 #include "falco_engine.h"
 #include "falco_engine_version.h"
@@ -36,18 +38,25 @@ extern "C" {
 #include "utils.h"
 
 
-string lua_on_event = "on_event";
-string lua_print_stats = "print_stats";
 
 using namespace std;
 
 nlohmann::json::json_pointer falco_engine::k8s_audit_time = "/stageTimestamp"_json_pointer;
+std::vector<std::string> falco_engine::k8s_audit_time_path = {"stageTimestamp"};
 
 falco_engine::falco_engine(bool seed_rng, const std::string& alternate_lua_dir)
 	: m_rules(NULL), m_next_ruleset_id(0),
 	  m_min_priority(falco_common::PRIORITY_DEBUG),
 	  m_sampling_ratio(1), m_sampling_multiplier(0),
-	  m_replace_container_info(false)
+	  m_sinsp_sampler(PPM_EVENT_MAX), m_k8s_audit_sampler(2),
+	  m_sinsp_sampling_protection_valid(false),
+	  m_k8s_audit_sampling_protection_valid(false),
+	  m_k8s_audit_lazy_parse(false),
+	  m_lua_dir(alternate_lua_dir),
+	  m_parent(NULL),
+	  m_replace_container_info(false),
+	  m_reorder_conditions(true),
+	  m_rule_timing(false)
 {
 	luaopen_lpeg(m_ls);
 	luaopen_yaml(m_ls);
@@ -71,12 +80,36 @@ falco_engine::falco_engine(bool seed_rng, const std::string& alternate_lua_dir)
 
 falco_engine::~falco_engine()
 {
+	if(m_parent)
+	{
+		lock_guard<mutex> lock(m_parent->m_clones_mtx);
+		m_parent->m_clones.erase(this);
+	}
+
 	if (m_rules)
 	{
 		delete m_rules;
 	}
 }
 
+falco_engine *falco_engine::clone()
+{
+	falco_engine *engine = new falco_engine(false, m_lua_dir);
+	engine->set_inspector(m_inspector);
+
+	for(auto &call : m_clone_calls)
+	{
+		call(*engine);
+	}
+
+	engine->m_parent = this;
+
+	lock_guard<mutex> lock(m_clones_mtx);
+	m_clones.insert(engine);
+
+	return engine;
+}
+
 uint32_t falco_engine::engine_version()
 {
 	return (uint32_t) FALCO_ENGINE_VERSION;
@@ -178,7 +211,14 @@ void falco_engine::load_rules(const string &rules_content, bool verbose, bool al
 	bool json_include_output_property = false;
 	falco_formats::init(m_inspector, this, m_ls, json_output, json_include_output_property);
 
-	m_rules->load_rules(rules_content, verbose, all_events, m_extra, m_replace_container_info, m_min_priority, required_engine_version);
+	m_rules->load_rules(rules_content, verbose, all_events, m_extra, m_replace_container_info, m_min_priority, m_reorder_conditions, required_engine_version);
+
+	m_clone_calls.push_back([rules_content, verbose, all_events](falco_engine &engine) {
+			engine.load_rules(rules_content, verbose, all_events);
+		});
+
+	// Matches only need to look up the rule id from now on
+	load_rule_infos();
 }
 
 void falco_engine::load_rules_file(const string &rules_filename, bool verbose, bool all_events)
@@ -203,7 +243,12 @@ void falco_engine::load_rules_file(const string &rules_filename, bool verbose, b
 	string rules_content((istreambuf_iterator<char>(is)),
 			     istreambuf_iterator<char>());
 
+	auto start = chrono::steady_clock::now();
+
 	load_rules(rules_content, verbose, all_events, required_engine_version);
+
+	m_rules_load_times.push_back(make_pair(rules_filename,
+					       chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count()));
 }
 
 void falco_engine::enable_rule(const string &substring, bool enabled, const string &ruleset)
@@ -212,6 +257,13 @@ void falco_engine::enable_rule(const string &substring, bool enabled, const stri
 
 	m_sinsp_rules->enable(substring, enabled, ruleset_id);
 	m_k8s_audit_rules->enable(substring, enabled, ruleset_id);
+
+	m_sinsp_sampling_protection_valid = false;
+	m_k8s_audit_sampling_protection_valid = false;
+
+	m_clone_calls.push_back([substring, enabled, ruleset](falco_engine &engine) {
+			engine.enable_rule(substring, enabled, ruleset);
+		});
 }
 
 void falco_engine::enable_rule(const string &substring, bool enabled)
@@ -225,6 +277,13 @@ void falco_engine::enable_rule_by_tag(const set<string> &tags, bool enabled, con
 
 	m_sinsp_rules->enable_tags(tags, enabled, ruleset_id);
 	m_k8s_audit_rules->enable_tags(tags, enabled, ruleset_id);
+
+	m_sinsp_sampling_protection_valid = false;
+	m_k8s_audit_sampling_protection_valid = false;
+
+	m_clone_calls.push_back([tags, enabled, ruleset](falco_engine &engine) {
+			engine.enable_rule_by_tag(tags, enabled, ruleset);
+		});
 }
 
 void falco_engine::enable_rule_by_tag(const set<string> &tags, bool enabled)
@@ -235,6 +294,42 @@ void falco_engine::enable_rule_by_tag(const set<string> &tags, bool enabled)
 void falco_engine::set_min_priority(falco_common::priority_type priority)
 {
 	m_min_priority = priority;
+
+	m_clone_calls.push_back([priority](falco_engine &engine) {
+			engine.set_min_priority(priority);
+		});
+}
+
+void falco_engine::shed_rules(falco_common::priority_type priority, set<string> &shed)
+{
+	set<string> candidates = m_shed_rules;
+	m_sinsp_rules->enabled_rules(candidates, m_default_ruleset_id);
+
+	for(auto &name : candidates)
+	{
+		auto it = m_rule_priorities.find(name);
+		if(it == m_rule_priorities.end())
+		{
+			continue;
+		}
+
+		bool should_shed = (it->second > priority);
+		bool is_shed = (m_shed_rules.find(name) != m_shed_rules.end());
+
+		if(should_shed && !is_shed)
+		{
+			m_sinsp_rules->enable_exact(name, false, m_default_ruleset_id);
+			m_shed_rules.insert(name);
+		}
+		else if(!should_shed && is_shed)
+		{
+			m_sinsp_rules->enable_exact(name, true, m_default_ruleset_id);
+			m_shed_rules.erase(name);
+		}
+	}
+
+	shed = m_shed_rules;
+	m_sinsp_sampling_protection_valid = false;
 }
 
 uint16_t falco_engine::find_ruleset_id(const std::string &ruleset)
@@ -273,97 +368,167 @@ void falco_engine::syscalls_for_ruleset(std::vector<bool> &syscalls, const std::
 	return m_sinsp_rules->syscalls_for_ruleset(syscalls, ruleset_id);
 }
 
-unique_ptr<falco_engine::rule_result> falco_engine::process_sinsp_event(sinsp_evt *ev, uint16_t ruleset_id)
+void falco_engine::evttypes_for_ruleset(std::vector<bool> &evttypes)
 {
-	if(should_drop_evt())
+	return m_sinsp_rules->evttypes_for_ruleset(evttypes, m_default_ruleset_id);
+}
+
+void falco_engine::syscalls_for_ruleset(std::vector<bool> &syscalls)
+{
+	return m_sinsp_rules->syscalls_for_ruleset(syscalls, m_default_ruleset_id);
+}
+
+bool falco_engine::process_sinsp_event(sinsp_evt *ev, rule_result &res, uint16_t ruleset_id)
+{
+	if(m_sinsp_sampler.enabled())
 	{
-		return unique_ptr<struct rule_result>();
+		if(!m_sinsp_sampling_protection_valid)
+		{
+			update_sinsp_sampling_protection();
+		}
+
+		if(m_sinsp_sampler.sample_out(ev->get_type()))
+		{
+			return false;
+		}
 	}
 
 	if(!m_sinsp_rules->run(ev, ruleset_id))
 	{
-		return unique_ptr<struct rule_result>();
+		return false;
 	}
 
-	unique_ptr<struct rule_result> res(new rule_result());
+	fill_result(ev, res);
+
+	return true;
+}
 
-	lua_getglobal(m_ls, lua_on_event.c_str());
+bool falco_engine::process_sinsp_event(sinsp_evt *ev, rule_result &res)
+{
+	return process_sinsp_event(ev, res, m_default_ruleset_id);
+}
 
-	if(lua_isfunction(m_ls, -1))
+uint32_t falco_engine::process_k8s_audit_events(json_event **evts, size_t num_evts,
+					       vector<rule_match> &matches, uint16_t ruleset_id)
+{
+	bool sampling = m_k8s_audit_sampler.enabled();
+	if(sampling && !m_k8s_audit_sampling_protection_valid)
 	{
-		lua_pushnumber(m_ls, ev->get_check_id());
+		update_k8s_audit_sampling_protection();
+	}
+
+	m_batch_evts.clear();
+	m_batch_etags.clear();
+	m_batch_idx.clear();
 
-		if(lua_pcall(m_ls, 1, 3, 0) != 0)
+	for(size_t i = 0; i < num_evts; i++)
+	{
+		if(sampling && m_k8s_audit_sampler.sample_out(1))
 		{
-			const char* lerr = lua_tostring(m_ls, -1);
-			string err = "Error invoking function output: " + string(lerr);
-			throw falco_exception(err);
+			continue;
 		}
-		res->evt = ev;
-		const char *p =  lua_tostring(m_ls, -3);
-		res->rule = p;
-		res->source = "syscall";
-		res->priority_num = (falco_common::priority_type) lua_tonumber(m_ls, -2);
-		res->format = lua_tostring(m_ls, -1);
-		lua_pop(m_ls, 3);
-	}
-	else
-	{
-		throw falco_exception("No function " + lua_on_event + " found in lua compiler module");
+
+		// All k8s audit events have the single tag "1".
+		m_batch_evts.push_back((gen_event *) evts[i]);
+		m_batch_etags.push_back(1);
+		m_batch_idx.push_back(i);
 	}
 
-	return res;
+	return process_batch(m_k8s_audit_rules.get(), ruleset_id, matches);
 }
 
-unique_ptr<falco_engine::rule_result> falco_engine::process_sinsp_event(sinsp_evt *ev)
+uint32_t falco_engine::process_k8s_audit_events(json_event **evts, size_t num_evts,
+					       vector<rule_match> &matches)
 {
-	return process_sinsp_event(ev, m_default_ruleset_id);
+	return process_k8s_audit_events(evts, num_evts, matches, m_default_ruleset_id);
 }
 
-unique_ptr<falco_engine::rule_result> falco_engine::process_k8s_audit_event(json_event *ev, uint16_t ruleset_id)
+uint32_t falco_engine::process_batch(falco_ruleset *rules, uint16_t ruleset_id,
+				     vector<rule_match> &matches)
 {
-	if(should_drop_evt())
+	matches.clear();
+
+	rules->run(m_batch_evts.data(), m_batch_etags.data(), m_batch_evts.size(),
+		   ruleset_id, m_batch_matched);
+
+	rule_result res;
+	for(auto pos : m_batch_matched)
 	{
-		return unique_ptr<struct rule_result>();
+		fill_result(m_batch_evts[pos], res);
+		matches.push_back(rule_match{m_batch_idx[pos], res.rule_id, res.priority_num});
 	}
 
-	// All k8s audit events have the single tag "1".
-	if(!m_k8s_audit_rules->run((gen_event *) ev, 1, ruleset_id))
+	return matches.size();
+}
+
+const falco_rule_info *falco_engine::get_rule_info(uint32_t rule_id)
+{
+	if(rule_id == 0 || rule_id >= m_rule_infos.size())
 	{
-		return unique_ptr<struct rule_result>();
+		return NULL;
 	}
 
-	unique_ptr<struct rule_result> res(new rule_result());
+	return &m_rule_infos[rule_id];
+}
 
-	lua_getglobal(m_ls, lua_on_event.c_str());
+void falco_engine::load_rule_infos()
+{
+	m_rules->get_rule_infos(m_rule_infos);
+	m_rule_match_counts.reset(new atomic_counter[m_rule_infos.size()]);
+
+	m_rule_priorities.clear();
+	m_rules->get_rule_priorities(m_rule_priorities);
+}
 
-	if(lua_isfunction(m_ls, -1))
+bool falco_engine::process_k8s_audit_event(json_event *ev, rule_result &res, uint16_t ruleset_id)
+{
+	if(m_k8s_audit_sampler.enabled())
 	{
-		lua_pushnumber(m_ls, ev->get_check_id());
+		if(!m_k8s_audit_sampling_protection_valid)
+		{
+			update_k8s_audit_sampling_protection();
+		}
 
-		if(lua_pcall(m_ls, 1, 3, 0) != 0)
+		if(m_k8s_audit_sampler.sample_out(1))
 		{
-			const char* lerr = lua_tostring(m_ls, -1);
-			string err = "Error invoking function output: " + string(lerr);
-			throw falco_exception(err);
+			return false;
 		}
-		res->evt = ev;
-		const char *p =  lua_tostring(m_ls, -3);
-		res->rule = p;
-		res->source = "k8s_audit";
-		res->priority_num = (falco_common::priority_type) lua_tonumber(m_ls, -2);
-		res->format = lua_tostring(m_ls, -1);
-		lua_pop(m_ls, 3);
 	}
-	else
+
+	// All k8s audit events have the single tag "1".
+	if(!m_k8s_audit_rules->run((gen_event *) ev, 1, ruleset_id))
+	{
+		return false;
+	}
+
+	fill_result(ev, res);
+
+	return true;
+}
+
+bool falco_engine::process_k8s_audit_event(json_event *ev, rule_result &res)
+{
+	return process_k8s_audit_event(ev, res, m_default_ruleset_id);
+}
+
+void falco_engine::fill_result(gen_event *ev, rule_result &res)
+{
+	uint32_t rule_id = ev->get_check_id();
+
+	if(rule_id == 0 || rule_id >= m_rule_infos.size())
 	{
-		throw falco_exception("No function " + lua_on_event + " found in lua compiler module");
+		throw falco_exception("Event matched unknown rule id " + to_string(rule_id));
 	}
 
-	return res;
+	m_rule_match_counts[rule_id].add();
+
+	res.evt = ev;
+	res.rule_id = rule_id;
+	res.priority_num = m_rule_infos[rule_id].priority_num;
+	res.info = &m_rule_infos[rule_id];
 }
 
-bool falco_engine::parse_k8s_audit_json(nlohmann::json &j, std::list<json_event> &evts)
+bool falco_engine::parse_k8s_audit_json(nlohmann::json &j, json_event_list &evts)
 {
 	// Note that nlohmann::basic_json::value can throw  nlohmann::basic_json::type_error (302, 306)
 	try
@@ -373,7 +538,7 @@ bool falco_engine::parse_k8s_audit_json(nlohmann::json &j, std::list<json_event>
 		{
 			for(auto &je : j["items"])
 			{
-				evts.emplace_back();
+				evts.emplace_back(evts.get_allocator().get_arena());
 				je["kind"] = "Event";
 
 				uint64_t ns = 0;
@@ -385,21 +550,21 @@ bool falco_engine::parse_k8s_audit_json(nlohmann::json &j, std::list<json_event>
 				std::string tmp;
 				sinsp_utils::ts_to_string(ns, &tmp, false, true);
 
-				evts.back().set_jevt(je, ns);
+				evts.back().set_jevt(std::move(je), ns);
 			}
 
 			return true;
 		}
 		else if(j.value("kind", "<NA>") == "Event")
 		{
-			evts.emplace_back();
+			evts.emplace_back(evts.get_allocator().get_arena());
 			uint64_t ns = 0;
 			if(!sinsp_utils::parse_iso_8601_utc_string(j.value(k8s_audit_time, "<NA>"), ns))
 			{
 				return false;
 			}
 
-			evts.back().set_jevt(j, ns);
+			evts.back().set_jevt(std::move(j), ns);
 			return true;
 		}
 		else
@@ -415,9 +580,110 @@ bool falco_engine::parse_k8s_audit_json(nlohmann::json &j, std::list<json_event>
 	}
 }
 
-unique_ptr<falco_engine::rule_result> falco_engine::process_k8s_audit_event(json_event *ev)
+bool falco_engine::parse_k8s_audit_raw(std::shared_ptr<json_index> doc, json_event_list &evts,
+				       bool lazy)
 {
-	return process_k8s_audit_event(ev, m_default_ruleset_id);
+	const json_index::value &root = doc->root();
+	json_index::value val;
+	std::string str;
+
+	// Like parse_k8s_audit_json, but without building the json
+	// object. Only the kind, the items and the timestamps are
+	// looked up in the index.
+	auto parse_time = [&](const json_index::value &evt, uint64_t &ns) {
+		ns = 0;
+		return (doc->find(evt, k8s_audit_time_path, val) &&
+			doc->get_string(val, str) &&
+			sinsp_utils::parse_iso_8601_utc_string(str, ns));
+	};
+
+	auto add_event = [&](const json_index::value &evt, bool list_item, uint64_t ns) {
+		// Duplicates are found before the event is parsed,
+		// like the other events the prefilter drops.
+		if(!m_k8s_audit_prefilter.keep(*doc, evt) ||
+		   !m_k8s_audit_prefilter.keep_unique(*doc, evt))
+		{
+			return;
+		}
+
+		evts.emplace_back(evts.get_allocator().get_arena());
+
+		if(lazy)
+		{
+			evts.back().set_raw(doc, evt, list_item, ns);
+		}
+		else
+		{
+			nlohmann::json j = doc->materialize(evt);
+			if(list_item)
+			{
+				j["kind"] = "Event";
+			}
+			evts.back().set_jevt(std::move(j), ns);
+		}
+	};
+
+	if(!doc->member(root, "kind", val) || !doc->get_string(val, str))
+	{
+		return false;
+	}
+
+	if(str == "EventList")
+	{
+		json_index::value items;
+		bool ok = true;
+
+		if(!doc->member(root, "items", items))
+		{
+			return true;
+		}
+
+		if(!doc->is_array(items))
+		{
+			return false;
+		}
+
+		doc->for_each_element(items, [&](const json_index::value &item) {
+			uint64_t ns;
+			if(!ok || !doc->is_object(item) || !parse_time(item, ns))
+			{
+				ok = false;
+				return;
+			}
+
+			add_event(item, true, ns);
+		});
+
+		return ok;
+	}
+	else if(str == "Event")
+	{
+		uint64_t ns;
+		if(!parse_time(root, ns))
+		{
+			return false;
+		}
+
+		add_event(root, false, ns);
+		return true;
+	}
+
+	return false;
+}
+
+void falco_engine::set_k8s_audit_lazy_parse(bool enabled)
+{
+	m_k8s_audit_lazy_parse = enabled;
+}
+
+bool falco_engine::k8s_audit_lazy_parse()
+{
+	return m_k8s_audit_lazy_parse;
+}
+
+k8s_audit_prefilter &falco_engine::get_k8s_audit_prefilter()
+{
+	return m_k8s_audit_prefilter;
 }
 
 void falco_engine::describe_rule(string *rule)
@@ -428,22 +694,291 @@ void falco_engine::describe_rule(string *rule)
 // Print statistics on the the rules that triggered
 void falco_engine::print_stats()
 {
-	lua_getglobal(m_ls, lua_print_stats.c_str());
+	uint64_t total = 0;
+	map<string, uint64_t> by_priority;
+	map<string, uint64_t> by_name;
+
+	auto add_counts = [&](falco_engine *engine) {
+		for(uint32_t rule_id = 1; rule_id < engine->m_rule_infos.size(); rule_id++)
+		{
+			uint64_t num = engine->m_rule_match_counts[rule_id].get();
+			if(num == 0)
+			{
+				continue;
+			}
+
+			falco_rule_info &info = engine->m_rule_infos[rule_id];
+
+			total += num;
+			by_priority[falco_common::priority_names[info.priority_num]] += num;
+			by_name[info.rule] += num;
+		}
+	};
+
+	add_counts(this);
+
+	{
+		lock_guard<mutex> lock(m_clones_mtx);
+		for(auto clone : m_clones)
+		{
+			add_counts(clone);
+		}
+	}
+
+	printf("Events detected: %" PRIu64 "\n", total);
+	printf("Rule counts by severity:\n");
+	for(auto &it : by_priority)
+	{
+		printf("   %s: %" PRIu64 "\n", it.first.c_str(), it.second);
+	}
+
+	printf("Triggered rules by rule name:\n");
+	for(auto &it : by_name)
+	{
+		printf("   %s: %" PRIu64 "\n", it.first.c_str(), it.second);
+	}
+}
+
+void falco_engine::get_dispatch_stats(uint64_t &num_events, uint64_t &num_filters_run)
+{
+	uint64_t k8s_audit_events, k8s_audit_filters_run;
+
+	m_sinsp_rules->get_dispatch_stats(num_events, num_filters_run);
+	m_k8s_audit_rules->get_dispatch_stats(k8s_audit_events, k8s_audit_filters_run);
+
+	num_events += k8s_audit_events;
+	num_filters_run += k8s_audit_filters_run;
+
+	lock_guard<mutex> lock(m_clones_mtx);
+	for(auto clone : m_clones)
+	{
+		uint64_t clone_events, clone_filters_run;
+
+		clone->get_dispatch_stats(clone_events, clone_filters_run);
+		num_events += clone_events;
+		num_filters_run += clone_filters_run;
+	}
+}
+
+void falco_engine::get_source_counts(map<string, uint64_t> &num_events,
+				     map<string, uint64_t> &num_sampled_out)
+{
+	num_events["syscall"] = m_sinsp_rules->num_events();
+	num_events["k8s_audit"] = m_k8s_audit_rules->num_events();
 
-	if(lua_isfunction(m_ls, -1))
+	uint64_t sinsp_sampled_out = 0;
+	for(uint32_t evttype = 0; evttype < m_sinsp_sampler.num_tags(); evttype++)
 	{
-		if(lua_pcall(m_ls, 0, 0, 0) != 0)
+		sinsp_sampled_out += m_sinsp_sampler.num_sampled_out(evttype);
+	}
+
+	num_sampled_out["syscall"] = sinsp_sampled_out;
+	num_sampled_out["k8s_audit"] = m_k8s_audit_sampler.num_sampled_out(1);
+
+	lock_guard<mutex> lock(m_clones_mtx);
+	for(auto clone : m_clones)
+	{
+		map<string, uint64_t> clone_events, clone_sampled_out;
+
+		clone->get_source_counts(clone_events, clone_sampled_out);
+		for(auto &it : clone_events)
 		{
-			const char* lerr = lua_tostring(m_ls, -1);
-			string err = "Error invoking function print_stats: " + string(lerr);
-			throw falco_exception(err);
+			num_events[it.first] += it.second;
+		}
+		for(auto &it : clone_sampled_out)
+		{
+			num_sampled_out[it.first] += it.second;
 		}
 	}
-	else
+}
+
+void falco_engine::get_sampled_out_counts(map<string, uint64_t> &counts)
+{
+	const struct ppm_event_info *etable = m_inspector->get_event_info_tables()->m_event_info;
+
+	for(uint32_t evttype = 0; evttype < m_sinsp_sampler.num_tags(); evttype++)
 	{
-		throw falco_exception("No function " + lua_print_stats + " found in lua rule loader module");
+		uint64_t num = m_sinsp_sampler.num_sampled_out(evttype);
+		if(num > 0)
+		{
+			counts[etable[evttype].name] += num;
+		}
 	}
 
+	uint64_t num = m_k8s_audit_sampler.num_sampled_out(1);
+	if(num > 0)
+	{
+		counts["k8s_audit"] += num;
+	}
+
+	lock_guard<mutex> lock(m_clones_mtx);
+	for(auto clone : m_clones)
+	{
+		clone->get_sampled_out_counts(counts);
+	}
+}
+
+void falco_engine::get_k8s_audit_prefiltered_counts(map<string, uint64_t> &counts)
+{
+	for(uint32_t r = 0; r < k8s_audit_prefilter::R_MAX; r++)
+	{
+		k8s_audit_prefilter::reason reason = (k8s_audit_prefilter::reason) r;
+		counts[k8s_audit_prefilter::reason_names[r]] = m_k8s_audit_prefilter.num_dropped(reason);
+	}
+}
+
+void falco_engine::get_rule_counts(map<string, pair<uint64_t, uint64_t>> &counts)
+{
+	m_sinsp_rules->get_rule_counts(counts);
+	m_k8s_audit_rules->get_rule_counts(counts);
+
+	lock_guard<mutex> lock(m_clones_mtx);
+	for(auto clone : m_clones)
+	{
+		map<string, pair<uint64_t, uint64_t>> clone_counts;
+
+		clone->get_rule_counts(clone_counts);
+		for(auto &it : clone_counts)
+		{
+			counts[it.first].first += it.second.first;
+			counts[it.first].second += it.second.second;
+		}
+	}
+}
+
+void falco_engine::get_rules_load_times(vector<pair<string, uint64_t>> &load_times)
+{
+	load_times = m_rules_load_times;
+}
+
+void falco_engine::get_rule_coverage(nlohmann::json &coverage)
+{
+	map<string, falco_ruleset::rule_coverage> sinsp_rules;
+	map<string, falco_ruleset::rule_coverage> k8s_audit_rules;
+	map<string, set<string>> rule_macros;
+
+	m_sinsp_rules->rule_coverage_for_ruleset(sinsp_rules, m_default_ruleset_id);
+	m_k8s_audit_rules->rule_coverage_for_ruleset(k8s_audit_rules, m_default_ruleset_id);
+	m_rules->get_rule_macros(rule_macros);
+
+	vector<uint64_t> evttype_events, evttype_matched, syscall_events, syscall_matched;
+	m_sinsp_rules->evttype_coverage_for_ruleset(evttype_events, evttype_matched,
+						   syscall_events, syscall_matched,
+						   m_default_ruleset_id);
+
+	// Add the counts of the clones checking events on other
+	// threads, which have the same rules
+	auto add_coverage = [](map<string, falco_ruleset::rule_coverage> &to,
+			       map<string, falco_ruleset::rule_coverage> &from) {
+		for(auto &it : from)
+		{
+			falco_ruleset::rule_coverage &cov = to[it.first];
+			cov.num_reached += it.second.num_reached;
+			cov.num_evaluated += it.second.num_evaluated;
+			cov.num_matched += it.second.num_matched;
+			cov.eval_time_ns += it.second.eval_time_ns;
+		}
+	};
+
+	auto add_counts = [](vector<uint64_t> &to, vector<uint64_t> &from) {
+		for(size_t i = 0; i < to.size() && i < from.size(); i++)
+		{
+			to[i] += from[i];
+		}
+	};
+
+	{
+		lock_guard<mutex> lock(m_clones_mtx);
+		for(auto clone : m_clones)
+		{
+			map<string, falco_ruleset::rule_coverage> clone_sinsp_rules, clone_k8s_audit_rules;
+			vector<uint64_t> clone_evttype_events, clone_evttype_matched, clone_syscall_events, clone_syscall_matched;
+
+			clone->m_sinsp_rules->rule_coverage_for_ruleset(clone_sinsp_rules, clone->m_default_ruleset_id);
+			clone->m_k8s_audit_rules->rule_coverage_for_ruleset(clone_k8s_audit_rules, clone->m_default_ruleset_id);
+			clone->m_sinsp_rules->evttype_coverage_for_ruleset(clone_evttype_events, clone_evttype_matched,
+									   clone_syscall_events, clone_syscall_matched,
+									   clone->m_default_ruleset_id);
+
+			add_coverage(sinsp_rules, clone_sinsp_rules);
+			add_coverage(k8s_audit_rules, clone_k8s_audit_rules);
+			add_counts(evttype_events, clone_evttype_events);
+			add_counts(evttype_matched, clone_evttype_matched);
+			add_counts(syscall_events, clone_syscall_events);
+			add_counts(syscall_matched, clone_syscall_matched);
+		}
+	}
+
+	coverage = nlohmann::json::object();
+	coverage["rules"] = nlohmann::json::object();
+	coverage["macros"] = nlohmann::json::object();
+	coverage["evttypes"] = nlohmann::json::object();
+	coverage["syscalls"] = nlohmann::json::object();
+
+	auto add_rules = [&](map<string, falco_ruleset::rule_coverage> &rules, const string &source)
+	{
+		for(auto &it : rules)
+		{
+			coverage["rules"][it.first] = {
+				{"source", source},
+				{"reached", it.second.num_reached},
+				{"evaluated", it.second.num_evaluated},
+				{"matched", it.second.num_matched},
+				{"eval_time_ns", it.second.eval_time_ns}
+			};
+
+			for(auto &macro : rule_macros[it.first])
+			{
+				nlohmann::json &m = coverage["macros"][macro];
+				if(m.is_null())
+				{
+					m = {{"rules", 0}, {"reached", 0}, {"evaluated", 0}, {"matched", 0}, {"eval_time_ns", 0}};
+				}
+				m["rules"] = m["rules"].get<uint64_t>() + 1;
+				m["reached"] = m["reached"].get<uint64_t>() + it.second.num_reached;
+				m["evaluated"] = m["evaluated"].get<uint64_t>() + it.second.num_evaluated;
+				m["matched"] = m["matched"].get<uint64_t>() + it.second.num_matched;
+				m["eval_time_ns"] = m["eval_time_ns"].get<uint64_t>() + it.second.eval_time_ns;
+			}
+		}
+	};
+
+	add_rules(sinsp_rules, "syscall");
+	add_rules(k8s_audit_rules, "k8s_audit");
+
+	vector<bool> evttypes, syscalls;
+
+	evttypes_for_ruleset(evttypes);
+	syscalls_for_ruleset(syscalls);
+
+	sinsp_evttables *einfo = m_inspector->get_event_info_tables();
+
+	// Enter and exit events share a name, so their counts are
+	// summed.
+	for(uint32_t etype = 0; etype < PPM_EVENT_MAX; etype++)
+	{
+		if(evttypes[etype])
+		{
+			nlohmann::json &e = coverage["evttypes"][einfo->m_event_info[etype].name];
+			if(e.is_null())
+			{
+				e = {{"events", 0}, {"matched", 0}};
+			}
+			e["events"] = e["events"].get<uint64_t>() + evttype_events[etype];
+			e["matched"] = e["matched"].get<uint64_t>() + evttype_matched[etype];
+		}
+	}
+
+	for(uint32_t syscallid = 0; syscallid < PPM_SC_MAX; syscallid++)
+	{
+		if(syscalls[syscallid])
+		{
+			coverage["syscalls"][einfo->m_syscall_info[syscallid].name] = {
+				{"events", syscall_events[syscallid]},
+				{"matched", syscall_matched[syscallid]}
+			};
+		}
+	}
 }
 
 void falco_engine::add_sinsp_filter(string &rule,
@@ -453,6 +988,33 @@ void falco_engine::add_sinsp_filter(string &rule,
 				    sinsp_filter* filter)
 {
 	m_sinsp_rules->add(rule, evttypes, syscalls, tags, filter);
+
+	m_sinsp_sampling_protection_valid = false;
+	m_k8s_audit_sampling_protection_valid = false;
+}
+
+void falco_engine::add_sinsp_filter(string &rule,
+				    set<uint32_t> &evttypes,
+				    set<uint32_t> &syscalls,
+				    set<string> &tags,
+				    sinsp_filter* filter,
+				    string &guard_field,
+				    set<string> &guard_values)
+{
+	gen_event_filter_check *guard_check = sinsp_factory().new_filtercheck(guard_field.c_str());
+
+	if(!guard_check)
+	{
+		throw falco_exception("Could not create filtercheck for guard field " + guard_field + " of rule " + rule);
+	}
+
+	guard_check->parse_field_name(guard_field.c_str(), true, true);
+
+	m_sinsp_rules->add(rule, evttypes, syscalls, tags, filter,
+			   guard_field, guard_check, guard_values);
+
+	m_sinsp_sampling_protection_valid = false;
+	m_k8s_audit_sampling_protection_valid = false;
 }
 
 void falco_engine::add_k8s_audit_filter(string &rule,
@@ -463,44 +1025,175 @@ void falco_engine::add_k8s_audit_filter(string &rule,
 	std::set<uint32_t> event_tags = {1};
 
 	m_k8s_audit_rules->add(rule, tags, event_tags, filter);
+
+	m_sinsp_sampling_protection_valid = false;
+	m_k8s_audit_sampling_protection_valid = false;
+}
+
+void falco_engine::add_k8s_audit_filter(string &rule,
+					set<string> &tags,
+					json_event_filter* filter,
+					string &guard_field,
+					set<string> &guard_values)
+{
+	gen_event_filter_check *guard_check = json_factory().new_filtercheck(guard_field.c_str());
+
+	if(!guard_check)
+	{
+		throw falco_exception("Could not create filtercheck for guard field " + guard_field + " of rule " + rule);
+	}
+
+	guard_check->parse_field_name(guard_field.c_str(), true, true);
+
+	// All k8s audit events have a single tag "1".
+	std::set<uint32_t> event_tags = {1};
+
+	m_k8s_audit_rules->add(rule, tags, event_tags, filter,
+			       guard_field, guard_check, guard_values);
+
+	m_sinsp_sampling_protection_valid = false;
+	m_k8s_audit_sampling_protection_valid = false;
 }
 
 void falco_engine::clear_filters()
 {
 	m_sinsp_rules.reset(new falco_sinsp_ruleset());
 	m_k8s_audit_rules.reset(new falco_ruleset());
+
+	m_rule_priorities.clear();
+	m_shed_rules.clear();
+	m_rule_infos.clear();
+	m_sinsp_sampling_protection_valid = false;
+	m_k8s_audit_sampling_protection_valid = false;
+
+	m_sinsp_rules->set_rule_timing(m_rule_timing);
+	m_k8s_audit_rules->set_rule_timing(m_rule_timing);
 }
 
 void falco_engine::set_sampling_ratio(uint32_t sampling_ratio)
 {
 	m_sampling_ratio = sampling_ratio;
+	update_sampling_fraction();
 }
 
 void falco_engine::set_sampling_multiplier(double sampling_multiplier)
 {
 	m_sampling_multiplier = sampling_multiplier;
+	update_sampling_fraction();
 }
 
-void falco_engine::set_extra(string &extra, bool replace_container_info)
+void falco_engine::update_sampling_fraction()
 {
-	m_extra = extra;
-	m_replace_container_info = replace_container_info;
+	double fraction = 1;
+
+	if(m_sampling_multiplier != 0 && m_sampling_ratio != 1)
+	{
+		fraction = 1.0/(m_sampling_multiplier * m_sampling_ratio);
+	}
+
+	m_sinsp_sampler.set_default_keep_fraction(fraction);
+	m_k8s_audit_sampler.set_default_keep_fraction(fraction);
+}
+
+void falco_engine::set_evttype_sampling(uint16_t evttype, double keep_fraction)
+{
+	m_sinsp_sampler.set_keep_fraction(evttype, keep_fraction);
 }
 
-inline bool falco_engine::should_drop_evt()
+void falco_engine::set_k8s_audit_sampling(double keep_fraction)
 {
-	if(m_sampling_multiplier == 0)
+	m_k8s_audit_sampler.set_keep_fraction(1, keep_fraction);
+
+	m_clone_calls.push_back([keep_fraction](falco_engine &engine) {
+			engine.set_k8s_audit_sampling(keep_fraction);
+		});
+}
+
+void falco_engine::critical_rules(set<string> &rules)
+{
+	for(auto &it : m_rule_priorities)
 	{
-		return false;
+		if(it.second <= falco_common::PRIORITY_CRITICAL)
+		{
+			rules.insert(it.first);
+		}
 	}
+}
+
+void falco_engine::update_sinsp_sampling_protection()
+{
+	set<string> rules;
+	critical_rules(rules);
 
-	if(m_sampling_ratio == 1)
+	vector<bool> event_tags;
+	m_sinsp_rules->event_tags_for_rules(rules, event_tags, m_default_ruleset_id);
+
+	// Event tags past PPM_EVENT_MAX are syscalls, which are
+	// only seen through generic events.
+	vector<bool> evttypes(PPM_EVENT_MAX, false);
+	for(uint32_t etag = 0; etag < event_tags.size(); etag++)
 	{
-		return false;
+		if(!event_tags[etag])
+		{
+			continue;
+		}
+
+		if(etag < PPM_EVENT_MAX)
+		{
+			evttypes[etag] = true;
+		}
+		else
+		{
+			evttypes[PPME_GENERIC_E] = true;
+			evttypes[PPME_GENERIC_X] = true;
+		}
 	}
+	m_sinsp_sampler.set_protected(evttypes);
+
+	m_sinsp_sampling_protection_valid = true;
+}
+
+void falco_engine::update_k8s_audit_sampling_protection()
+{
+	set<string> rules;
+	critical_rules(rules);
+
+	vector<bool> event_tags;
+	m_k8s_audit_rules->event_tags_for_rules(rules, event_tags, m_default_ruleset_id);
+	m_k8s_audit_sampler.set_protected(event_tags);
+
+	m_k8s_audit_sampling_protection_valid = true;
+}
+
+void falco_engine::set_extra(string &extra, bool replace_container_info)
+{
+	m_extra = extra;
+	m_replace_container_info = replace_container_info;
+
+	m_clone_calls.push_back([extra, replace_container_info](falco_engine &engine) {
+			string e = extra;
+			engine.set_extra(e, replace_container_info);
+		});
+}
+
+void falco_engine::set_reorder_conditions(bool reorder_conditions)
+{
+	m_reorder_conditions = reorder_conditions;
+
+	m_clone_calls.push_back([reorder_conditions](falco_engine &engine) {
+			engine.set_reorder_conditions(reorder_conditions);
+		});
+}
+
+void falco_engine::set_rule_timing(bool enabled)
+{
+	m_rule_timing = enabled;
+	m_sinsp_rules->set_rule_timing(enabled);
+	m_k8s_audit_rules->set_rule_timing(enabled);
 
-	double coin = (random() * (1.0/RAND_MAX));
-	return (coin >= (1.0/(m_sampling_multiplier * m_sampling_ratio)));
+	m_clone_calls.push_back([enabled](falco_engine &engine) {
+			engine.set_rule_timing(enabled);
+		});
 }
 
 sinsp_filter_factory &falco_engine::sinsp_factory()
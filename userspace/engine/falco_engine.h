@@ -28,6 +28,8 @@ limitations under the License.
 #include <string>
 #include <memory>
 #include <set>
+#include <functional>
+#include <mutex>
 
 #include <nlohmann/json.hpp>
 
@@ -37,6 +39,8 @@ limitations under the License.
 #include "json_evt.h"
 #include "rules.h"
 #include "ruleset.h"
+#include "event_sampler.h"
+#include "k8s_audit_prefilter.h"
 
 #include "config_falco_engine.h"
 #include "falco_common.h"
@@ -62,6 +66,25 @@ public:
 	// Print to stdout (using printf) a description of each field supported by this engine.
 	void list_fields(bool names_only=false);
 
+	//
+	// Create a new engine with the same rules as this one, by
+	// replaying on it the calls made so far to load rules,
+	// enable/disable rules and set the options they depend on
+	// (set_extra, set_reorder_conditions, set_min_priority,
+	// set_k8s_audit_sampling, set_rule_timing). The new engine
+	// can check events against the rules on another thread. It
+	// shares this engine's inspector, which is only used while
+	// loading rules. The caller owns the new engine, which must
+	// be destroyed before this one. While it exists, its
+	// counters are included in the ones this engine reports
+	// (print_stats, get_rule_coverage, get_rule_counts, ...).
+	//
+	// Like load_rules, this resets the formats shared with falco
+	// outputs, so it must be called before initializing the
+	// outputs.
+	//
+	falco_engine *clone();
+
 	//
 	// Load rules either directly or from a filename.
 	//
@@ -99,6 +122,16 @@ public:
 	// Only load rules having this priority or more severe.
 	void set_min_priority(falco_common::priority_type priority);
 
+	//
+	// Load shedding. Temporarily disable the syscall rules
+	// enabled in the default ruleset whose priority is less
+	// severe than priority. Rules shed by an earlier call that
+	// are at least as severe as priority are enabled again, so
+	// passing PRIORITY_DEBUG restores all of them. Fills in the
+	// names of the rules that are shed after the call.
+	//
+	void shed_rules(falco_common::priority_type priority, std::set<std::string> &shed);
+
 	//
 	// Return the ruleset id corresponding to this ruleset name,
 	// creating a new one if necessary. If you provide any ruleset
@@ -123,6 +156,48 @@ public:
 	//
 	void print_stats();
 
+	//
+	// Return the number of events checked against the rules
+	// (syscall and k8s audit) and the number of rule filters
+	// actually run against those events.
+	//
+	void get_dispatch_stats(uint64_t &num_events, uint64_t &num_filters_run);
+
+	//
+	// Fill in a json object describing, for the default ruleset,
+	// how many events reached, were evaluated by, and matched
+	// each enabled rule, each macro (summed over the rules that
+	// refer to it) and each event type/syscall that some rule
+	// relates to. Meant to be called after replaying a trace
+	// file, to find rules that never fire.
+	//
+	void get_rule_coverage(nlohmann::json &coverage);
+
+	//
+	// Counters meant to be exported as metrics. Unlike the
+	// functions above, these can be called from another thread
+	// while events are being processed.
+	//
+	// Fill in, indexed by source ("syscall", "k8s_audit"), the
+	// number of events checked against the rules and the number
+	// of events dropped by sampling before being checked.
+	//
+	void get_source_counts(std::map<std::string, uint64_t> &num_events,
+			       std::map<std::string, uint64_t> &num_sampled_out);
+
+	//
+	// Fill in, indexed by rule name, the number of events each
+	// rule was evaluated against and matched.
+	//
+	void get_rule_counts(std::map<std::string, std::pair<uint64_t, uint64_t>> &counts);
+
+	//
+	// Fill in the rules files loaded with load_rules_file(), in
+	// load order, with the time in nanoseconds it took to load
+	// each.
+	//
+	void get_rules_load_times(std::vector<std::pair<std::string, uint64_t>> &load_times);
+
 	// Clear all existing filters.
 	void clear_filters();
 
@@ -138,6 +213,30 @@ public:
 	//
 	void set_sampling_multiplier(double sampling_multiplier);
 
+	//
+	// Override the fraction of events kept by sampling for a
+	// single sinsp event type, or for all k8s audit events. 1
+	// keeps all events, and a negative fraction goes back to the
+	// one given by the sampling ratio/multiplier. Events that
+	// could match an enabled rule with priority critical or more
+	// severe are never sampled out.
+	//
+	void set_evttype_sampling(uint16_t evttype, double keep_fraction);
+	void set_k8s_audit_sampling(double keep_fraction);
+
+	//
+	// Fill in, indexed by event type name (or "k8s_audit"), the
+	// number of events sampled out. Only types with events
+	// sampled out are filled in. Can be called from any thread.
+	//
+	void get_sampled_out_counts(std::map<std::string, uint64_t> &counts);
+
+	//
+	// Fill in, indexed by reason, the number of k8s audit events
+	// dropped by the prefilter. Can be called from any thread.
+	//
+	void get_k8s_audit_prefiltered_counts(std::map<std::string, uint64_t> &counts);
+
 	//
 	// You can optionally add "extra" formatting fields to the end
 	// of all output expressions. You can also choose to replace
@@ -148,14 +247,35 @@ public:
 	//
 	void set_extra(string &extra, bool replace_container_info);
 
+	//
+	// When enabled (the default), the operands of and/or
+	// expressions in rule conditions are reordered at load time
+	// so cheap, selective checks run first. This does not change
+	// which events a rule matches. Takes effect for rules loaded
+	// after the call.
+	//
+	void set_reorder_conditions(bool reorder_conditions);
+
+	//
+	// Measure, per rule, the time spent running its filter. The
+	// totals are reported by get_rule_coverage(). This reads the
+	// clock twice per filter run, so it is disabled by default.
+	//
+	void set_rule_timing(bool enabled);
+
 	// **Methods Related to k8s audit log events, which are
 	// **represented as json objects.
+	// Details on a matching event. The rule name, source and
+	// output format are read once when rules are loaded and
+	// shared by all the matches of the rule, so a rule_result
+	// can be filled in without allocating.
 	struct rule_result {
 		gen_event *evt;
-		std::string rule;
-		std::string source;
+		uint32_t rule_id;
 		falco_common::priority_type priority_num;
-		std::string format;
+
+		// Valid until rules are loaded again
+		const falco_rule_info *info;
 	};
 
 	//
@@ -166,25 +286,66 @@ public:
 	// Returns true if the json object was recognized as a k8s
 	// audit event(s), false otherwise.
 	//
-	bool parse_k8s_audit_json(nlohmann::json &j, std::list<json_event> &evts);
+	// The events are moved out of j rather than copied, so j
+	// must not be used afterwards. When evts has an arena, the
+	// events are allocated from it.
+	//
+	bool parse_k8s_audit_json(nlohmann::json &j, json_event_list &evts);
+
+	//
+	// The same, but from a structural index of the raw json
+	// object instead of a parsed json object. The events keep a
+	// reference to the index, and values are only parsed when a
+	// rule or an output format looks them up (see
+	// json_event::set_raw). If lazy is false, each event is
+	// parsed into a json object instead, which can throw
+	// nlohmann::json::parse_error.
+	//
+	// Events dropped by the k8s audit prefilter (see
+	// get_k8s_audit_prefilter) are left out of evts. When the
+	// prefilter drops duplicates, this must be called with the
+	// documents in the order they were received (see
+	// k8s_audit_prefilter::keep_unique). Otherwise it only reads
+	// the prefilter's configuration, so it can be called from
+	// several threads at once.
+	//
+	bool parse_k8s_audit_raw(std::shared_ptr<json_index> doc, json_event_list &evts,
+				 bool lazy = true);
+
+	//
+	// Whether callers parsing k8s audit events should use
+	// parse_k8s_audit_raw instead of parse_k8s_audit_json. Off by
+	// default, as the raw parsing only checks the structure of
+	// the json object and leaves errors within values unnoticed
+	// until the values are looked up.
+	//
+	void set_k8s_audit_lazy_parse(bool enabled);
+	bool k8s_audit_lazy_parse();
+
+	//
+	// The filter applied to k8s audit events by
+	// parse_k8s_audit_raw, to configure it. Callers should use
+	// parse_k8s_audit_raw when it is enabled.
+	//
+	k8s_audit_prefilter &get_k8s_audit_prefilter();
 
 	//
 	// Given an event, check it against the set of rules in the
-	// engine and if a matching rule is found, return details on
-	// the rule that matched. If no rule matched, returns NULL.
+	// engine and if a matching rule is found, fill in res with
+	// details on the rule that matched and return true. If no
+	// rule matched, returns false.
 	//
 	// When ruleset_id is provided, use the enabled/disabled status
 	// associated with the provided ruleset. This is only useful
 	// when you have previously called enable_rule/enable_rule_by_tag
 	// with a ruleset string.
 	//
-	// the returned rule_result is allocated and must be delete()d.
-	std::unique_ptr<rule_result> process_k8s_audit_event(json_event *ev, uint16_t ruleset_id);
+	bool process_k8s_audit_event(json_event *ev, rule_result &res, uint16_t ruleset_id);
 
 	//
 	// Wrapper assuming the default ruleset
 	//
-	std::unique_ptr<rule_result> process_k8s_audit_event(json_event *ev);
+	bool process_k8s_audit_event(json_event *ev, rule_result &res);
 
 	//
 	// Add a k8s_audit filter to the engine
@@ -193,6 +354,16 @@ public:
 				  std::set<std::string> &tags,
 				  json_event_filter* filter);
 
+	//
+	// Identical to above, but the filter can only match events
+	// where guard_field (e.g. ka.verb) has one of guard_values.
+	//
+	void add_k8s_audit_filter(std::string &rule,
+				  std::set<std::string> &tags,
+				  json_event_filter* filter,
+				  std::string &guard_field,
+				  std::set<std::string> &guard_values);
+
 	// **Methods Related to Sinsp Events e.g system calls
 	//
 	// Given a ruleset, fill in a bitset containing the event
@@ -200,29 +371,77 @@ public:
 	//
 	void evttypes_for_ruleset(std::vector<bool> &evttypes, const std::string &ruleset);
 
+	//
+	// Wrapper assuming the default ruleset
+	//
+	void evttypes_for_ruleset(std::vector<bool> &evttypes);
+
 	//
 	// Given a ruleset, fill in a bitset containing the syscalls
 	// for which this ruleset can run.
 	//
 	void syscalls_for_ruleset(std::vector<bool> &syscalls, const std::string &ruleset);
 
+	//
+	// Wrapper assuming the default ruleset
+	//
+	void syscalls_for_ruleset(std::vector<bool> &syscalls);
+
 	//
 	// Given an event, check it against the set of rules in the
-	// engine and if a matching rule is found, return details on
-	// the rule that matched. If no rule matched, returns NULL.
+	// engine and if a matching rule is found, fill in res with
+	// details on the rule that matched and return true. If no
+	// rule matched, returns false.
 	//
 	// When ruleset_id is provided, use the enabled/disabled status
 	// associated with the provided ruleset. This is only useful
 	// when you have previously called enable_rule/enable_rule_by_tag
 	// with a ruleset string.
 	//
-	// the returned rule_result is allocated and must be delete()d.
-	std::unique_ptr<rule_result> process_sinsp_event(sinsp_evt *ev, uint16_t ruleset_id);
+	bool process_sinsp_event(sinsp_evt *ev, rule_result &res, uint16_t ruleset_id);
 
 	//
 	// Wrapper assuming the default ruleset
 	//
-	std::unique_ptr<rule_result> process_sinsp_event(sinsp_evt *ev);
+	bool process_sinsp_event(sinsp_evt *ev, rule_result &res);
+
+	// **Batch version of process_k8s_audit_event, for embedders
+	// **processing many events at a time. There is no batch
+	// **version for sinsp events: the events returned by
+	// **sinsp::next() share one object, and sinsp filters read
+	// **the inspector's thread/fd state when they are run.
+
+	// A match found by process_k8s_audit_events(): the index of
+	// the event in the batch and the id of the rule it
+	// matched. The rule name, source and output format are given
+	// by get_rule_info().
+	struct rule_match {
+		uint32_t evt_idx;
+		uint32_t rule_id;
+		falco_common::priority_type priority_num;
+	};
+
+	//
+	// Check each of the num_evts events against the set of rules
+	// and fill in matches, which is cleared first, with one entry
+	// per matching event, in order. Returns the number of
+	// matches. Reusing matches across calls avoids allocations.
+	//
+	// The ruleset and sampling state are only looked up once per
+	// batch. Each event must be a distinct object that stays
+	// valid during the call.
+	//
+	uint32_t process_k8s_audit_events(json_event **evts, size_t num_evts,
+					  std::vector<rule_match> &matches, uint16_t ruleset_id);
+	uint32_t process_k8s_audit_events(json_event **evts, size_t num_evts,
+					  std::vector<rule_match> &matches);
+
+	//
+	// The name, source, priority and output format of the rule
+	// with the given id, or NULL if there is no such rule. Valid
+	// until the rules are loaded again.
+	//
+	const falco_rule_info *get_rule_info(uint32_t rule_id);
 
 	//
 	// Add a filter, which is related to the specified set of
@@ -234,19 +453,42 @@ public:
 			      std::set<std::string> &tags,
 			      sinsp_filter* filter);
 
+	//
+	// Identical to above, but the filter can only match events
+	// where guard_field has one of guard_values. This allows the
+	// engine to skip the filter entirely for other events.
+	//
+	void add_sinsp_filter(std::string &rule,
+			      std::set<uint32_t> &evttypes,
+			      std::set<uint32_t> &syscalls,
+			      std::set<std::string> &tags,
+			      sinsp_filter* filter,
+			      std::string &guard_field,
+			      std::set<std::string> &guard_values);
+
 	sinsp_filter_factory &sinsp_factory();
 	json_event_filter_factory &json_factory();
 
 private:
 
 	static nlohmann::json::json_pointer k8s_audit_time;
+	static std::vector<std::string> k8s_audit_time_path;
 
 	//
-	// Determine whether the given event should be matched at all
-	// against the set of rules, given the current sampling
-	// ratio/multiplier.
+	// Recompute which event types a sampler must never drop,
+	// from the event types of the critical rules. Done lazily
+	// when sampling is enabled and rules have changed since the
+	// last time. Each source is only updated from the thread
+	// processing its events, as the sinsp ruleset can change
+	// while events are processed (see shed_rules()).
 	//
-	inline bool should_drop_evt();
+	void update_sinsp_sampling_protection();
+	void update_k8s_audit_sampling_protection();
+	void critical_rules(std::set<std::string> &rules);
+
+	// Set the fraction of events the samplers keep by default
+	// from the sampling ratio and multiplier.
+	void update_sampling_fraction();
 	shared_ptr<sinsp_filter_factory> m_sinsp_factory;
 	shared_ptr<json_event_filter_factory> m_json_factory;
 
@@ -260,8 +502,9 @@ private:
 
 	//
 	// Here's how the sampling ratio and multiplier influence
-	// whether or not an event is dropped in
-	// should_drop_evt(). The intent is that m_sampling_ratio is
+	// whether or not an event is dropped by the samplers below,
+	// which keep 1/(ratio*multiplier) of the events of each event
+	// type not given its own fraction. The intent is that m_sampling_ratio is
 	// generally changing external to the engine e.g. in the main
 	// inspector class based on how busy the inspector is. A
 	// sampling ratio implies no dropping. Values > 1 imply
@@ -281,11 +524,66 @@ private:
 	uint32_t m_sampling_ratio;
 	double m_sampling_multiplier;
 
+	// Sinsp events are sampled per event type. All k8s audit
+	// events have the single tag "1".
+	event_sampler m_sinsp_sampler;
+	event_sampler m_k8s_audit_sampler;
+	bool m_sinsp_sampling_protection_valid;
+	bool m_k8s_audit_sampling_protection_valid;
+
+	bool m_k8s_audit_lazy_parse;
+	k8s_audit_prefilter m_k8s_audit_prefilter;
+
+	std::vector<std::pair<std::string, uint64_t>> m_rules_load_times;
+
+	// Used by clone()
+	std::string m_lua_dir;
+	std::vector<std::function<void(falco_engine &)>> m_clone_calls;
+
+	// The engine this one is a clone of, and the live clones of
+	// this engine, whose counters are added to this engine's in
+	// print_stats(), get_rule_coverage() and the metrics
+	// counters.
+	falco_engine *m_parent;
+	std::mutex m_clones_mtx;
+	std::set<falco_engine *> m_clones;
+
+	// Used by shed_rules() and critical_rules(). The priorities
+	// are read from the rules loader after each load, and only
+	// read while events are processed.
+	std::map<std::string, falco_common::priority_type> m_rule_priorities;
+	std::set<std::string> m_shed_rules;
+
+	// Indexed by rule id. Read from the rules loader after each
+	// load, along with a match counter per rule for
+	// print_stats().
+	std::vector<falco_rule_info> m_rule_infos;
+	std::unique_ptr<atomic_counter[]> m_rule_match_counts;
+	void load_rule_infos();
+
+	// Fill in res for an event that matched a rule
+	void fill_result(gen_event *ev, rule_result &res);
+
+	// Matches the events kept by sampling and fills in
+	// matches. Used by process_k8s_audit_events().
+	uint32_t process_batch(falco_ruleset *rules, uint16_t ruleset_id,
+			       std::vector<rule_match> &matches);
+
+	// Reused across batches: the events kept by sampling with
+	// their event tags and index in the batch, and the
+	// positions of the matching events among them.
+	std::vector<gen_event *> m_batch_evts;
+	std::vector<uint32_t> m_batch_etags;
+	std::vector<uint32_t> m_batch_idx;
+	std::vector<uint32_t> m_batch_matched;
+
 	std::string m_lua_main_filename = "rule_loader.lua";
 	std::string m_default_ruleset = "falco-default-ruleset";
 	uint32_t m_default_ruleset_id;
 
 	std::string m_extra;
 	bool m_replace_container_info;
+	bool m_reorder_conditions;
+	bool m_rule_timing;
 };
 
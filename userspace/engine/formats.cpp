@@ -17,8 +17,6 @@ limitations under the License.
 
 */
 
-#include <json/json.h>
-
 #include "formats.h"
 #include "logger.h"
 #include "falco_engine.h"
@@ -28,7 +26,9 @@ sinsp* falco_formats::s_inspector = NULL;
 falco_engine *falco_formats::s_engine = NULL;
 bool falco_formats::s_json_output = false;
 bool falco_formats::s_json_include_output_property = true;
+json_writer falco_formats::s_json_writer;
 sinsp_evt_formatter_cache *falco_formats::s_formatters = NULL;
+std::map<std::string, std::shared_ptr<json_event_formatter>> falco_formats::s_json_formatters;
 
 const static struct luaL_reg ll_falco [] =
 {
@@ -54,6 +54,9 @@ void falco_formats::init(sinsp* inspector,
 		s_formatters = new sinsp_evt_formatter_cache(s_inspector);
 	}
 
+	// The formatters' filterchecks come from the engine's factory
+	s_json_formatters.clear();
+
 	luaL_openlib(ls, "formats", ll_falco, 0);
 }
 
@@ -121,6 +124,7 @@ int falco_formats::free_formatters(lua_State *ls)
 		delete(s_formatters);
 		s_formatters = NULL;
 	}
+	s_json_formatters.clear();
 	return 0;
 }
 
@@ -145,10 +149,17 @@ int falco_formats::format_event (lua_State *ls)
 
 	string sformat = format;
 
+	// With json output, the plain line is only needed for the
+	// "output" property.
+	bool need_line = (!s_json_output || s_json_include_output_property);
+
 	if(strcmp(source, "syscall") == 0)
 	{
 		try {
-			s_formatters->tostring((sinsp_evt *) evt, sformat, &line);
+			if(need_line)
+			{
+				s_formatters->tostring((sinsp_evt *) evt, sformat, &line);
+			}
 
 			if(s_json_output)
 			{
@@ -195,13 +206,23 @@ int falco_formats::format_event (lua_State *ls)
 	{
 		try {
 
-			json_event_formatter formatter(s_engine->json_factory(), sformat);
+			// The fields already extracted by the rule's
+			// condition are cached in the event, so the
+			// formatter only extracts the others.
+			shared_ptr<json_event_formatter> &formatter = s_json_formatters[sformat];
+			if(!formatter)
+			{
+				formatter.reset(new json_event_formatter(s_engine->json_factory(), sformat));
+			}
 
-			line = formatter.tostring((json_event *) evt);
+			if(need_line)
+			{
+				line = formatter->tostring((json_event *) evt);
+			}
 
 			if(s_json_output)
 			{
-				json_line = formatter.tojson((json_event *) evt);
+				json_line = formatter->tojson((json_event *) evt);
 			}
 		}
 		catch (exception &e)
@@ -218,47 +239,31 @@ int falco_formats::format_event (lua_State *ls)
 	// a more detailed object containing the event time, rule,
 	// severity, full output, and fields.
 	if (s_json_output) {
-		Json::Value event;
-		Json::FastWriter writer;
-		string full_line;
-
-		// Convert the time-as-nanoseconds to a more json-friendly ISO8601.
-		time_t evttime = evt->get_ts()/1000000000;
-		char time_sec[20]; // sizeof "YYYY-MM-DDTHH:MM:SS"
-		char time_ns[12]; // sizeof ".sssssssssZ"
-		string iso8601evttime;
-
-		strftime(time_sec, sizeof(time_sec), "%FT%T", gmtime(&evttime));
-		snprintf(time_ns, sizeof(time_ns), ".%09luZ", evt->get_ts() % 1000000000);
-		iso8601evttime = time_sec;
-		iso8601evttime += time_ns;
-		event["time"] = iso8601evttime;
-		event["rule"] = rule;
-		event["priority"] = level;
+		s_json_writer.clear();
+		s_json_writer.begin_object();
 
 		if(s_json_include_output_property)
 		{
 			// This is the filled-in output line.
-			event["output"] = line;
-		}
-
-		full_line = writer.write(event);
-
-		// Json::FastWriter may add a trailing newline. If it
-		// does, remove it.
-		if (full_line[full_line.length()-1] == '\n')
-		{
-			full_line.resize(full_line.length()-1);
+			s_json_writer.key("output");
+			s_json_writer.value(line);
 		}
 
-		// Cheat-graft the output from the formatter into this
-		// string. Avoids an unnecessary json parse just to
-		// merge the formatted fields at the object level.
-		full_line.pop_back();
-		full_line.append(", \"output_fields\": ");
-		full_line.append(json_line);
-		full_line.append("}");
-		line = full_line;
+		s_json_writer.key("priority");
+		s_json_writer.value(level);
+		s_json_writer.key("rule");
+		s_json_writer.value(rule);
+		s_json_writer.key("time");
+		s_json_writer.iso_8601_value(evt->get_ts());
+
+		// Graft the output from the formatter into the
+		// object as is. Avoids an unnecessary json parse just
+		// to merge the formatted fields at the object level.
+		s_json_writer.key("output_fields");
+		s_json_writer.raw_value(json_line.data(), json_line.size());
+
+		s_json_writer.end_object();
+		line = s_json_writer.str();
 	}
 
 	lua_pushstring(ls, line.c_str());
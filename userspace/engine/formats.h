@@ -28,6 +28,7 @@ extern "C" {
 }
 
 #include "json_evt.h"
+#include "json_writer.h"
 #include "falco_engine.h"
 
 class sinsp_evt_formatter;
@@ -56,6 +57,12 @@ class falco_formats
 	static sinsp* s_inspector;
 	static falco_engine *s_engine;
 	static sinsp_evt_formatter_cache *s_formatters;
+
+	// The formatters for k8s audit rule outputs, by format
+	static std::map<std::string, std::shared_ptr<json_event_formatter>> s_json_formatters;
 	static bool s_json_output;
 	static bool s_json_include_output_property;
+
+	// Used by format_event to write json output
+	static json_writer s_json_writer;
 };
@@ -19,6 +19,10 @@ limitations under the License.
 
 #include <ctype.h>
 
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
 #include "uri.h"
 #include "utils.h"
 
@@ -28,7 +32,13 @@ limitations under the License.
 using json = nlohmann::json;
 using namespace std;
 
-json_event::json_event()
+json_event::json_event(arena *a):
+	m_have_jevt(false),
+	m_list_item(false),
+	m_values(arena_allocator<cached_value>(a)),
+	m_fields(arena_allocator<cached_field_value>(a)),
+	m_free_fields(arena_allocator<cached_field_value>(a)),
+	m_event_ts(0)
 {
 }
 
@@ -39,14 +49,194 @@ json_event::~json_event()
 void json_event::set_jevt(json &evt, uint64_t ts)
 {
 	m_jevt = evt;
+	m_have_jevt = true;
+	m_doc.reset();
+	m_list_item = false;
+	m_values.clear();
+	clear_fields();
+	m_event_ts = ts;
+}
+
+void json_event::set_jevt(json &&evt, uint64_t ts)
+{
+	m_jevt = std::move(evt);
+	m_have_jevt = true;
+	m_doc.reset();
+	m_list_item = false;
+	m_values.clear();
+	clear_fields();
+	m_event_ts = ts;
+}
+
+void json_event::set_raw(std::shared_ptr<json_index> doc, const json_index::value &v,
+			 bool list_item, uint64_t ts)
+{
+	m_jevt = json();
+	m_have_jevt = false;
+	m_doc = doc;
+	m_root = v;
+	m_list_item = list_item;
+	m_values.clear();
+	clear_fields();
 	m_event_ts = ts;
 }
 
 const json &json_event::jevt()
 {
+	if(!m_have_jevt && m_doc)
+	{
+		try
+		{
+			m_jevt = m_doc->materialize(m_root);
+		}
+		catch(json::parse_error &e)
+		{
+			m_jevt = json::object();
+		}
+
+		if(m_list_item)
+		{
+			m_jevt["kind"] = "Event";
+		}
+
+		m_have_jevt = true;
+		m_values.clear();
+	}
+
 	return m_jevt;
 }
 
+const json *json_event::value_at(const std::vector<std::string> &path, uint32_t path_id)
+{
+	if(m_have_jevt || !m_doc)
+	{
+		const json *j = &m_jevt;
+
+		for(auto &ref : path)
+		{
+			if(j->is_object())
+			{
+				auto it = j->find(ref);
+				if(it == j->end())
+				{
+					return NULL;
+				}
+				j = &(*it);
+			}
+			else if(j->is_array())
+			{
+				size_t idx;
+				if(!json_index::array_index(ref, idx) || idx >= j->size())
+				{
+					return NULL;
+				}
+				j = &((*j)[idx]);
+			}
+			else
+			{
+				return NULL;
+			}
+		}
+
+		return j;
+	}
+
+	for(auto &cv : m_values)
+	{
+		if(cv.path_id == path_id)
+		{
+			return (cv.found ? &cv.value : NULL);
+		}
+	}
+
+	m_values.emplace_front();
+	cached_value &cv = m_values.front();
+	cv.path_id = path_id;
+	cv.found = false;
+
+	if(m_list_item && path.size() == 1 && path[0] == "kind")
+	{
+		cv.value = "Event";
+		cv.found = true;
+	}
+	else
+	{
+		json_index::value v;
+		if(m_doc->find(m_root, path, v))
+		{
+			try
+			{
+				cv.value = m_doc->materialize(v);
+				cv.found = true;
+			}
+			catch(json::parse_error &e)
+			{
+			}
+		}
+	}
+
+	return (cv.found ? &cv.value : NULL);
+}
+
+uint32_t json_event::path_id(const std::vector<std::string> &path)
+{
+	// Paths are only parsed when loading rules, so a lock is
+	// fine here.
+	static std::mutex s_mtx;
+	static std::map<std::vector<std::string>, uint32_t> s_path_ids;
+
+	std::lock_guard<std::mutex> lock(s_mtx);
+
+	auto it = s_path_ids.find(path);
+	if(it != s_path_ids.end())
+	{
+		return it->second;
+	}
+
+	uint32_t id = s_path_ids.size();
+	s_path_ids[path] = id;
+
+	return id;
+}
+
+const std::string *json_event::cached_field(uint32_t field_id)
+{
+	for(auto &cf : m_fields)
+	{
+		if(cf.field_id == field_id)
+		{
+			return &cf.value;
+		}
+	}
+
+	return NULL;
+}
+
+const std::string &json_event::cache_field(uint32_t field_id, const char *val, uint32_t len)
+{
+	if(m_free_fields.empty())
+	{
+		m_fields.emplace_front();
+	}
+	else
+	{
+		m_fields.splice_after(m_fields.before_begin(), m_free_fields, m_free_fields.before_begin());
+	}
+
+	cached_field_value &cf = m_fields.front();
+	cf.field_id = field_id;
+	cf.value.assign(val, len);
+
+	return cf.value;
+}
+
+void json_event::clear_fields()
+{
+	// Keep the nodes, and the capacity of their strings, for the
+	// next values cached
+	m_free_fields.splice_after(m_free_fields.before_begin(), m_fields);
+}
+
 uint64_t json_event::get_ts()
 {
 	return m_event_ts;
@@ -126,7 +316,9 @@ json_event_filter_check::alias::~alias()
 }
 
 json_event_filter_check::json_event_filter_check():
-	m_format(def_format)
+	m_jptr_path_id(json_event::path_id(m_jptr_path)),
+	m_format(def_format),
+	m_field_id(no_field_id)
 {
 }
 
@@ -158,6 +350,8 @@ int32_t json_event_filter_check::parse_field_name(const char *str, bool alloc_st
 		   info.m_name.size() > match_len)
 		{
 			m_jptr = al.m_jptr;
+			json_index::split_pointer(m_jptr, m_jptr_path);
+			m_jptr_path_id = json_event::path_id(m_jptr_path);
 			m_field = info.m_name;
 			m_format = al.m_format;
 			match_len = info.m_name.size();
@@ -203,13 +397,21 @@ int32_t json_event_filter_check::parse_field_name(const char *str, bool alloc_st
 void json_event_filter_check::add_filter_value(const char *str, uint32_t len, uint32_t i)
 {
 	m_values.push_back(string(str));
+
+	// The operator is set before the values are added
+	if(m_cmpop == CO_IN)
+	{
+		m_values_set.insert(m_values.back());
+	}
+	else if(m_cmpop == CO_PMATCH)
+	{
+		m_prefix_search.add_search_path(m_values.back());
+	}
 }
 
 bool json_event_filter_check::compare(gen_event *evt)
 {
-	json_event *jevt = (json_event *)evt;
-
-	std::string value = extract(jevt);
+	const std::string &value = extract_cached((json_event *) evt);
 
 	switch(m_cmpop)
 	{
@@ -226,14 +428,10 @@ bool json_event_filter_check::compare(gen_event *evt)
 		return (value.compare(0, m_values[0].size(), m_values[0]) == 0);
 		break;
 	case CO_IN:
-		for(auto &val : m_values)
-		{
-			if(value == val)
-			{
-				return true;
-			}
-		}
-		return false;
+		return (m_values_set.find(value) != m_values_set.end());
+		break;
+	case CO_PMATCH:
+		return m_prefix_search.match(value);
 		break;
 	case CO_EXISTS:
 		// Any non-empty, non-"<NA>" value is ok
@@ -275,18 +473,25 @@ uint8_t *json_event_filter_check::extract(gen_event *evt, uint32_t *len, bool sa
 {
 	json_event *jevt = (json_event *)evt;
 
-	try
-	{
-		const json &j = jevt->jevt().at(m_jptr);
+	const json *j = jevt->value_at(m_jptr_path, m_jptr_path_id);
 
-		// Only format when the value was actually found in
-		// the object.
-		m_tstr = m_format(j, m_field, m_idx);
-	}
-	catch(json::out_of_range &e)
+	// Only format when the value was actually found in the
+	// object.
+	if(j == NULL)
 	{
 		m_tstr = "<NA>";
 	}
+	else
+	{
+		try
+		{
+			m_tstr = m_format(*j, m_field, m_idx);
+		}
+		catch(json::out_of_range &e)
+		{
+			m_tstr = "<NA>";
+		}
+	}
 
 	*len = m_tstr.size();
 
@@ -309,6 +514,59 @@ std::string json_event_filter_check::extract(json_event *evt)
 	return ret;
 }
 
+const std::string &json_event_filter_check::extract_cached(json_event *evt)
+{
+	if(m_field_id != no_field_id)
+	{
+		const std::string *cached = evt->cached_field(m_field_id);
+		if(cached != NULL)
+		{
+			return *cached;
+		}
+	}
+
+	uint32_t len = 0;
+	uint8_t *res = extract(evt, &len, true);
+	const char *val = (res == NULL ? "" : (const char *) res);
+
+	if(m_field_id != no_field_id)
+	{
+		return evt->cache_field(m_field_id, val, len);
+	}
+
+	// Reuse the same string for all comparisons, which avoids an
+	// allocation for each comparison of a long value.
+	m_cmp_value.assign(val, len);
+
+	return m_cmp_value;
+}
+
+void json_event_filter_check::set_field_id(uint32_t field_id)
+{
+	m_field_id = field_id;
+}
+
+uint32_t json_event_filter_check::field_id(const std::string &name)
+{
+	// Fields are only parsed when loading rules and creating
+	// formatters, so a lock is fine here.
+	static std::mutex s_mtx;
+	static std::unordered_map<std::string, uint32_t> s_field_ids;
+
+	std::lock_guard<std::mutex> lock(s_mtx);
+
+	auto it = s_field_ids.find(name);
+	if(it != s_field_ids.end())
+	{
+		return it->second;
+	}
+
+	uint32_t id = s_field_ids.size();
+	s_field_ids[name] = id;
+
+	return id;
+}
+
 std::string jevt_filter_check::s_jevt_time_field = "jevt.time";
 std::string jevt_filter_check::s_jevt_time_iso_8601_field = "jevt.time.iso8601";
 std::string jevt_filter_check::s_jevt_rawtime_field = "jevt.rawtime";
@@ -371,6 +629,8 @@ int32_t jevt_filter_check::parse_field_name(const char *str, bool alloc_state, b
 		try
 		{
 			m_jptr = json::json_pointer(string(str + (s_jevt_value_field.size() + 1), (end - str - (s_jevt_value_field.size() + 1))));
+			json_index::split_pointer(m_jptr, m_jptr_path);
+			m_jptr_path_id = json_event::path_id(m_jptr_path);
 		}
 		catch(json::parse_error &e)
 		{
@@ -752,6 +1012,13 @@ gen_event_filter_check *json_event_filter_factory::new_filtercheck(const char *f
 
 		if(parsed > 0)
 		{
+			string name = newchk->field();
+			if(!newchk->idx().empty())
+			{
+				name += "[" + newchk->idx() + "]";
+			}
+			newchk->set_field_id(json_event_filter_check::field_id(name));
+
 			return newchk;
 		}
 
@@ -870,11 +1137,11 @@ void json_event_formatter::parse_format()
 
 void json_event_formatter::resolve_tokens(json_event *ev, std::list<std::pair<std::string, std::string>> &resolved)
 {
-	for(auto tok : m_tokens)
+	for(auto &tok : m_tokens)
 	{
 		if(tok.check)
 		{
-			resolved.push_back(std::make_pair(tok.check->field(), tok.check->extract(ev)));
+			resolved.push_back(std::make_pair(tok.check->field(), tok.check->extract_cached(ev)));
 		}
 		else
 		{
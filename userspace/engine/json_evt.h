@@ -19,27 +19,66 @@ limitations under the License.
 
 #pragma once
 
+#include <forward_list>
 #include <memory>
 #include <list>
 #include <map>
 #include <string>
 #include <vector>
 #include <set>
+#include <unordered_set>
 #include <utility>
 
 #include <nlohmann/json.hpp>
 
+#include "arena.h"
 #include "gen_filter.h"
+#include "json_index.h"
+#include "prefix_search.h"
 
 class json_event : public gen_event
 {
 public:
-	json_event();
+	// When given an arena, the values looked up in raw events
+	// are cached in nodes allocated from the arena.
+	json_event(arena *a = NULL);
 	virtual ~json_event();
 
 	void set_jevt(nlohmann::json &evt, uint64_t ts);
+	void set_jevt(nlohmann::json &&evt, uint64_t ts);
+
+	// Back the event with value v of a raw json document instead
+	// of a json object. Only the values looked up with value_at
+	// are parsed. list_item is true for the items of an
+	// EventList, whose kind is then "Event".
+	void set_raw(std::shared_ptr<json_index> doc, const json_index::value &v,
+		     bool list_item, uint64_t ts);
+
+	// For raw events, this parses the whole object the first
+	// time it is called.
 	const nlohmann::json &jevt();
 
+	// Return the value at the given path (the reference tokens
+	// of a json pointer, see json_index::split_pointer), or NULL
+	// if there is no such value. path_id must be
+	// path_id(path). For raw events, the values found are cached
+	// in the event by path id.
+	const nlohmann::json *value_at(const std::vector<std::string> &path, uint32_t path_id);
+
+	// Return the id of the given path, assigning a new one the
+	// first time it is seen. Equal paths share the same id.
+	static uint32_t path_id(const std::vector<std::string> &path);
+
+	// The values extracted from the event by filterchecks, by
+	// field id (see json_event_filter_check::extract_cached), so
+	// that the fields of a rule's output that were already
+	// extracted by its condition, or by other rules, are not
+	// extracted again. Returns NULL if the field is not cached.
+	// clear_fields keeps the memory of the values for reuse.
+	const std::string *cached_field(uint32_t field_id);
+	const std::string &cache_field(uint32_t field_id, const char *val, uint32_t len);
+	void clear_fields();
+
 	uint64_t get_ts();
 
 	inline uint16_t get_source()
@@ -54,11 +93,37 @@ public:
 	}
 
 protected:
+	struct cached_value
+	{
+		uint32_t path_id;
+		bool found;
+		nlohmann::json value;
+	};
+
+	struct cached_field_value
+	{
+		uint32_t field_id;
+		std::string value;
+	};
+
 	nlohmann::json m_jevt;
+	bool m_have_jevt;
+
+	std::shared_ptr<json_index> m_doc;
+	json_index::value m_root;
+	bool m_list_item;
+	std::forward_list<cached_value, arena_allocator<cached_value>> m_values;
+	std::forward_list<cached_field_value, arena_allocator<cached_field_value>> m_fields;
+	std::forward_list<cached_field_value, arena_allocator<cached_field_value>> m_free_fields;
 
 	uint64_t m_event_ts;
 };
 
+// The events of a request. Giving the list an arena_allocator places
+// the list nodes, and the values cached by the events, in the arena
+// (see falco_engine::parse_k8s_audit_json).
+typedef std::list<json_event, arena_allocator<json_event>> json_event_list;
+
 class json_event_filter_check : public gen_event_filter_check
 {
 public:
@@ -109,6 +174,22 @@ public:
 	// Simpler version that returns a string
 	std::string extract(json_event *evt);
 
+	// Like extract, but returns the value cached in the event if
+	// this field was already extracted from it, and caches the
+	// value otherwise. Used by compare() and by
+	// json_event_formatter.
+	const std::string &extract_cached(json_event *evt);
+
+	// Set by json_event_filter_factory::new_filtercheck. Checks
+	// for the same field and index share the same id.
+	void set_field_id(uint32_t field_id);
+
+	static const uint32_t no_field_id = UINT32_MAX;
+
+	// Return the id of the given field name, including its
+	// index, assigning a new one the first time it is seen.
+	static uint32_t field_id(const std::string &name);
+
 	const std::string &field();
 	const std::string &idx();
 
@@ -175,6 +256,11 @@ protected:
 	// The actual json pointer value to use to extract from events.
 	nlohmann::json::json_pointer m_jptr;
 
+	// The same pointer split into its reference tokens, and the
+	// id of those, as used by json_event::value_at.
+	std::vector<std::string> m_jptr_path;
+	uint32_t m_jptr_path_id;
+
 	// Temporary storage to hold extracted value
 	std::string m_tstr;
 
@@ -184,6 +270,22 @@ protected:
 private:
 
 	std::vector<std::string> m_values;
+
+	// The extracted value being compared, for checks without a
+	// field id
+	std::string m_cmp_value;
+
+	uint32_t m_field_id;
+
+	// The same values, for the comparisons that test an
+	// extracted value against all of them: a hash set for "in"
+	// and a path prefix tree for "pmatch". Both make the cost
+	// of a comparison independent of the number of values. Only
+	// the one for the check's operator is filled. The filter
+	// parser gives "contains" and "startswith" a single value,
+	// so those are still one comparison per value.
+	std::unordered_set<std::string> m_values_set;
+	path_prefix_search m_prefix_search;
 };
 
 class jevt_filter_check : public json_event_filter_check
@@ -0,0 +1,464 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <cstring>
+
+#include "json_index.h"
+
+using json = nlohmann::json;
+using namespace std;
+
+namespace
+{
+
+// Characters that end up as tokens in the index, outside of strings.
+struct structural_table
+{
+	bool is_structural[256];
+
+	structural_table()
+	{
+		memset(is_structural, 0, sizeof(is_structural));
+		for(const char *c = "{}[]:,\""; *c; c++)
+		{
+			is_structural[(unsigned char) *c] = true;
+		}
+	}
+};
+
+const structural_table s_structural;
+
+inline bool is_ws(char c)
+{
+	return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+}
+
+json_index::json_index()
+{
+	m_root = {npos, 0, 0};
+}
+
+json_index::~json_index()
+{
+}
+
+bool json_index::index(const char *data, size_t len, std::string &errstr)
+{
+	if(len >= npos)
+	{
+		errstr = "Document too large";
+		return false;
+	}
+
+	m_data.assign(data, len);
+	m_tokens.clear();
+
+	const char *p = m_data.data();
+	vector<uint32_t> open;
+
+	for(uint32_t i = 0; i < len; i++)
+	{
+		if(!s_structural.is_structural[(unsigned char) p[i]])
+		{
+			continue;
+		}
+
+		uint32_t t = m_tokens.size();
+
+		switch(p[i])
+		{
+		case '"':
+		{
+			// Find the closing quote, i.e. the first one
+			// preceded by an even number of backslashes.
+			uint32_t j = i + 1;
+			while(true)
+			{
+				const char *q = (const char *) memchr(p + j, '"', len - j);
+				if(q == NULL)
+				{
+					errstr = "Unterminated string at offset " + to_string(i);
+					return false;
+				}
+
+				j = q - p;
+				uint32_t k = j;
+				while(k > i + 1 && p[k - 1] == '\\')
+				{
+					k--;
+				}
+
+				if((j - k) % 2 == 0)
+				{
+					break;
+				}
+
+				j++;
+			}
+
+			m_tokens.push_back({i, j + 1, t + 1});
+			i = j;
+			break;
+		}
+		case '{':
+		case '[':
+			open.push_back(t);
+			m_tokens.push_back({i, i + 1, t + 1});
+			break;
+		case '}':
+		case ']':
+			if(open.empty() ||
+			   tok_char(open.back()) != (p[i] == '}' ? '{' : '['))
+			{
+				errstr = string("Unexpected '") + p[i] + "' at offset " + to_string(i);
+				return false;
+			}
+			m_tokens[open.back()].end = i + 1;
+			m_tokens[open.back()].next = t + 1;
+			open.pop_back();
+			m_tokens.push_back({i, i + 1, t + 1});
+			break;
+		default:
+			m_tokens.push_back({i, i + 1, t + 1});
+			break;
+		}
+	}
+
+	if(!open.empty())
+	{
+		errstr = "Unterminated object or array at offset " + to_string(m_tokens[open.back()].offset);
+		return false;
+	}
+
+	uint32_t begin = 0;
+	uint32_t end = len;
+	while(begin < end && is_ws(p[begin]))
+	{
+		begin++;
+	}
+	while(end > begin && is_ws(p[end - 1]))
+	{
+		end--;
+	}
+
+	if(begin == end)
+	{
+		errstr = "Empty document";
+		return false;
+	}
+
+	if(m_tokens.empty())
+	{
+		m_root = {npos, begin, end};
+	}
+	else if(m_tokens[0].offset == begin &&
+		m_tokens[0].end == end &&
+		tok_char(0) != ':' && tok_char(0) != ',')
+	{
+		m_root = {0, begin, end};
+	}
+	else
+	{
+		errstr = "Unexpected data at offset " + to_string(begin);
+		return false;
+	}
+
+	return true;
+}
+
+const json_index::value &json_index::root()
+{
+	return m_root;
+}
+
+bool json_index::is_object(const value &v)
+{
+	return (v.tok != npos && tok_char(v.tok) == '{');
+}
+
+bool json_index::is_array(const value &v)
+{
+	return (v.tok != npos && tok_char(v.tok) == '[');
+}
+
+bool json_index::is_string(const value &v)
+{
+	return (v.tok != npos && tok_char(v.tok) == '"');
+}
+
+bool json_index::value_after(uint32_t sep, value &v)
+{
+	uint32_t t = sep + 1;
+
+	if(t >= m_tokens.size())
+	{
+		return false;
+	}
+
+	uint32_t begin = m_tokens[sep].offset + 1;
+	uint32_t end = m_tokens[t].offset;
+
+	while(begin < end && is_ws(m_data[begin]))
+	{
+		begin++;
+	}
+	while(end > begin && is_ws(m_data[end - 1]))
+	{
+		end--;
+	}
+
+	if(begin < end)
+	{
+		v = {npos, begin, end};
+		return true;
+	}
+
+	char c = tok_char(t);
+	if(c == '{' || c == '[' || c == '"')
+	{
+		v = {t, m_tokens[t].offset, m_tokens[t].end};
+		return true;
+	}
+
+	return false;
+}
+
+uint32_t json_index::token_after(uint32_t sep, const value &v)
+{
+	return (v.tok == npos ? sep + 1 : m_tokens[v.tok].next);
+}
+
+uint32_t json_index::next_element(uint32_t sep, const value &v)
+{
+	uint32_t t = token_after(sep, v);
+
+	if(t < m_tokens.size() && tok_char(t) == ',')
+	{
+		return t;
+	}
+
+	return npos;
+}
+
+bool json_index::key_equals(uint32_t t, const std::string &key)
+{
+	const char *raw = m_data.data() + m_tokens[t].offset + 1;
+	size_t len = m_tokens[t].end - m_tokens[t].offset - 2;
+
+	if(memchr(raw, '\\', len) == NULL)
+	{
+		return (len == key.size() && memcmp(raw, key.data(), len) == 0);
+	}
+
+	string unescaped;
+	value v = {t, m_tokens[t].offset, m_tokens[t].end};
+
+	return (get_string(v, unescaped) && unescaped == key);
+}
+
+bool json_index::member(const value &obj, const std::string &key, value &out)
+{
+	if(!is_object(obj))
+	{
+		return false;
+	}
+
+	uint32_t t = obj.tok + 1;
+
+	while(t + 1 < m_tokens.size() &&
+	      tok_char(t) == '"' &&
+	      tok_char(t + 1) == ':')
+	{
+		value v;
+		if(!value_after(t + 1, v))
+		{
+			return false;
+		}
+
+		if(key_equals(t, key))
+		{
+			out = v;
+			return true;
+		}
+
+		uint32_t sep = next_element(t + 1, v);
+		if(sep == npos)
+		{
+			return false;
+		}
+		t = sep + 1;
+	}
+
+	return false;
+}
+
+bool json_index::element(const value &arr, size_t idx, value &out)
+{
+	if(!is_array(arr))
+	{
+		return false;
+	}
+
+	size_t i = 0;
+	value v;
+	for(uint32_t sep = arr.tok; sep != npos; sep = next_element(sep, v))
+	{
+		if(!value_after(sep, v))
+		{
+			return false;
+		}
+
+		if(i++ == idx)
+		{
+			out = v;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool json_index::find(const value &v, const std::vector<std::string> &path, value &out)
+{
+	value cur = v;
+
+	for(auto &ref : path)
+	{
+		if(is_object(cur))
+		{
+			if(!member(cur, ref, cur))
+			{
+				return false;
+			}
+		}
+		else if(is_array(cur))
+		{
+			size_t idx;
+			if(!array_index(ref, idx))
+			{
+				return false;
+			}
+
+			if(!element(cur, idx, cur))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	out = cur;
+	return true;
+}
+
+bool json_index::get_string(const value &v, std::string &out)
+{
+	if(!is_string(v))
+	{
+		return false;
+	}
+
+	const char *raw = m_data.data() + v.begin + 1;
+	size_t len = v.end - v.begin - 2;
+
+	if(memchr(raw, '\\', len) == NULL)
+	{
+		out.assign(raw, len);
+		return true;
+	}
+
+	try
+	{
+		out = materialize(v).get<string>();
+	}
+	catch(json::parse_error &e)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+json json_index::materialize(const value &v)
+{
+	return json::parse(m_data.data() + v.begin, m_data.data() + v.end);
+}
+
+bool json_index::array_index(const std::string &ref, size_t &idx)
+{
+	// Array indexes are decimal numbers without leading zeros.
+	if(ref.empty() || ref.size() > 9 ||
+	   ref.find_first_not_of("0123456789") != string::npos ||
+	   (ref.size() > 1 && ref[0] == '0'))
+	{
+		return false;
+	}
+
+	idx = stoul(ref);
+	return true;
+}
+
+void json_index::split_pointer(const json::json_pointer &ptr,
+			       std::vector<std::string> &path)
+{
+	string str = ptr.to_string();
+
+	path.clear();
+
+	// The pointer is either empty or starts with a '/'
+	size_t pos = 0;
+	while(pos < str.size())
+	{
+		size_t next = str.find('/', pos + 1);
+		if(next == string::npos)
+		{
+			next = str.size();
+		}
+
+		// Unescape ~1 and ~0, per RFC 6901
+		string ref;
+		for(size_t i = pos + 1; i < next; i++)
+		{
+			if(str[i] == '~' && i + 1 < next)
+			{
+				if(str[i + 1] == '1')
+				{
+					ref += '/';
+					i++;
+					continue;
+				}
+				else if(str[i + 1] == '0')
+				{
+					ref += '~';
+					i++;
+					continue;
+				}
+			}
+			ref += str[i];
+		}
+
+		path.push_back(ref);
+		pos = next;
+	}
+}
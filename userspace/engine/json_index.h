@@ -0,0 +1,142 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+// A structural index over a raw json document. Building the index
+// is a single pass over the bytes that records the position of every
+// structural character ({}[]:, and strings) and matches brackets. It
+// does not build any json values. Values can then be found by key or
+// array index by walking the index, and only the values found are
+// parsed (see materialize).
+//
+// The index only checks the structure of the document (balanced
+// brackets, terminated strings). Errors within a value, e.g. a bad
+// number, are only detected when that value is parsed.
+class json_index
+{
+public:
+	// A value in the document. For objects, arrays and strings
+	// tok is the index of its first token, for other values it
+	// is npos. [begin, end) is the span of the value in the
+	// document.
+	struct value
+	{
+		uint32_t tok;
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	static const uint32_t npos = UINT32_MAX;
+
+	json_index();
+	virtual ~json_index();
+
+	// Copy the document and build its index. Returns false and
+	// fills in errstr if the document is not well formed.
+	bool index(const char *data, size_t len, std::string &errstr);
+
+	// The top level value of the document.
+	const value &root();
+
+	bool is_object(const value &v);
+	bool is_array(const value &v);
+	bool is_string(const value &v);
+
+	// Find the value of the member key of object obj.
+	bool member(const value &obj, const std::string &key, value &out);
+
+	// Find the element idx of array arr.
+	bool element(const value &arr, size_t idx, value &out);
+
+	// Follow a path of json pointer reference tokens from v.
+	bool find(const value &v, const std::vector<std::string> &path, value &out);
+
+	// Call func on every element of array arr.
+	template<typename F>
+	void for_each_element(const value &arr, F func)
+	{
+		value v;
+		for(uint32_t sep = arr.tok; sep != npos; sep = next_element(sep, v))
+		{
+			if(!value_after(sep, v))
+			{
+				break;
+			}
+			func(v);
+		}
+	}
+
+	// Get the contents of a string value, unescaping it if needed.
+	bool get_string(const value &v, std::string &out);
+
+	// Parse a value into a json object. Can throw
+	// nlohmann::json::parse_error.
+	nlohmann::json materialize(const value &v);
+
+	// Parse a json pointer reference token as an array index.
+	static bool array_index(const std::string &ref, size_t &idx);
+
+	// Split a json pointer into its unescaped reference tokens.
+	static void split_pointer(const nlohmann::json::json_pointer &ptr,
+				  std::vector<std::string> &path);
+
+private:
+
+	struct token
+	{
+		// Offset of the token in the document
+		uint32_t offset;
+
+		// For strings, objects and arrays, the offset just
+		// past the end of the value. Otherwise offset + 1.
+		uint32_t end;
+
+		// The index of the token that follows the value
+		// starting at this token.
+		uint32_t next;
+	};
+
+	inline char tok_char(uint32_t t)
+	{
+		return m_data[m_tokens[t].offset];
+	}
+
+	// Find the value following the separator token sep (one of
+	// ':', ',', '[').
+	bool value_after(uint32_t sep, value &v);
+
+	// Given the separator before v, return the separator after
+	// v if another element follows it, npos otherwise.
+	uint32_t next_element(uint32_t sep, const value &v);
+
+	uint32_t token_after(uint32_t sep, const value &v);
+
+	bool key_equals(uint32_t t, const std::string &key);
+
+	std::string m_data;
+	std::vector<token> m_tokens;
+	value m_root;
+};
@@ -0,0 +1,227 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <cstring>
+#include <time.h>
+
+#include "json_writer.h"
+
+using namespace std;
+
+json_writer::json_writer()
+	: m_after_key(false),
+	  m_cached_secs(UINT64_MAX),
+	  m_cached_prefix_len(0)
+{
+}
+
+json_writer::~json_writer()
+{
+}
+
+void json_writer::clear()
+{
+	m_buf.clear();
+	m_have_value.clear();
+	m_after_key = false;
+}
+
+void json_writer::separate()
+{
+	if(m_after_key)
+	{
+		m_after_key = false;
+		return;
+	}
+
+	if(!m_have_value.empty())
+	{
+		if(m_have_value.back())
+		{
+			m_buf += ',';
+		}
+		m_have_value.back() = true;
+	}
+}
+
+void json_writer::begin_object()
+{
+	separate();
+	m_buf += '{';
+	m_have_value.push_back(false);
+}
+
+void json_writer::end_object()
+{
+	m_buf += '}';
+	m_have_value.pop_back();
+}
+
+void json_writer::key(const char *k, size_t len)
+{
+	separate();
+	append_escaped(k, len);
+	m_buf += ':';
+	m_after_key = true;
+}
+
+void json_writer::key(const char *k)
+{
+	key(k, strlen(k));
+}
+
+void json_writer::key(const std::string &k)
+{
+	key(k.data(), k.size());
+}
+
+void json_writer::value(const char *v, size_t len)
+{
+	separate();
+	append_escaped(v, len);
+}
+
+void json_writer::value(const char *v)
+{
+	value(v, strlen(v));
+}
+
+void json_writer::value(const std::string &v)
+{
+	value(v.data(), v.size());
+}
+
+void json_writer::value(uint64_t v)
+{
+	separate();
+
+	char digits[20];
+	size_t n = 0;
+	do
+	{
+		digits[n++] = '0' + (v % 10);
+		v /= 10;
+	} while(v > 0);
+
+	while(n > 0)
+	{
+		m_buf += digits[--n];
+	}
+}
+
+void json_writer::value(bool v)
+{
+	separate();
+	m_buf += (v ? "true" : "false");
+}
+
+void json_writer::raw_value(const char *v, size_t len)
+{
+	separate();
+	m_buf.append(v, len);
+}
+
+void json_writer::iso_8601_value(uint64_t ts)
+{
+	separate();
+
+	uint64_t secs = ts / 1000000000;
+	if(secs != m_cached_secs)
+	{
+		time_t t = secs;
+		struct tm tm;
+		gmtime_r(&t, &tm);
+
+		// Includes the opening quote
+		m_cached_prefix_len = strftime(m_cached_prefix, sizeof(m_cached_prefix), "\"%FT%T.", &tm);
+		m_cached_secs = secs;
+	}
+
+	m_buf.append(m_cached_prefix, m_cached_prefix_len);
+
+	char ns[9];
+	uint64_t frac = ts % 1000000000;
+	for(int i = 8; i >= 0; i--)
+	{
+		ns[i] = '0' + (frac % 10);
+		frac /= 10;
+	}
+	m_buf.append(ns, sizeof(ns));
+	m_buf += "Z\"";
+}
+
+const std::string &json_writer::str()
+{
+	return m_buf;
+}
+
+void json_writer::append_escaped(const char *s, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	m_buf += '"';
+
+	// Copy the runs of characters that need no escaping at once
+	size_t start = 0;
+	for(size_t i = 0; i < len; i++)
+	{
+		unsigned char c = s[i];
+
+		if(c >= 0x20 && c != '"' && c != '\\')
+		{
+			continue;
+		}
+
+		m_buf.append(s + start, i - start);
+		start = i + 1;
+
+		switch(c)
+		{
+		case '"':
+			m_buf += "\\\"";
+			break;
+		case '\\':
+			m_buf += "\\\\";
+			break;
+		case '\n':
+			m_buf += "\\n";
+			break;
+		case '\r':
+			m_buf += "\\r";
+			break;
+		case '\t':
+			m_buf += "\\t";
+			break;
+		case '\b':
+			m_buf += "\\b";
+			break;
+		case '\f':
+			m_buf += "\\f";
+			break;
+		default:
+			m_buf += "\\u00";
+			m_buf += hex[c >> 4];
+			m_buf += hex[c & 0xf];
+			break;
+		}
+	}
+
+	m_buf.append(s + start, len - start);
+	m_buf += '"';
+}
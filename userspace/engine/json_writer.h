@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Writes a json document directly into a string, without building
+// any json values first. The buffer is kept between documents, so
+// once it has grown to the size of a document, writing another one
+// does not allocate.
+//
+// Strings are escaped as required by json, but are otherwise written
+// as is. In particular, invalid utf-8 is not checked for.
+class json_writer
+{
+public:
+	json_writer();
+	virtual ~json_writer();
+
+	// Start a new document, discarding the current one.
+	void clear();
+
+	void begin_object();
+	void end_object();
+
+	void key(const char *k, size_t len);
+	void key(const char *k);
+	void key(const std::string &k);
+
+	void value(const char *v, size_t len);
+	void value(const char *v);
+	void value(const std::string &v);
+	void value(uint64_t v);
+	void value(bool v);
+
+	// A value that is already serialized json.
+	void raw_value(const char *v, size_t len);
+
+	// A timestamp, in ns since the epoch, as an ISO 8601 string
+	// in UTC with nanoseconds (e.g. 2018-10-25T13:58:49.730588123Z).
+	// The part up to the seconds is cached, as consecutive
+	// timestamps usually fall in the same second.
+	void iso_8601_value(uint64_t ts);
+
+	const std::string &str();
+
+private:
+	// Add a comma if the value is not the first one of the
+	// current object.
+	void separate();
+
+	void append_escaped(const char *s, size_t len);
+
+	std::string m_buf;
+
+	// Per nesting level, whether a value was already written
+	std::vector<bool> m_have_value;
+
+	// The value just follows a key
+	bool m_after_key;
+
+	uint64_t m_cached_secs;
+	char m_cached_prefix[32];
+	size_t m_cached_prefix_len;
+};
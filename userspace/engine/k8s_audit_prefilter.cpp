@@ -0,0 +1,155 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include "k8s_audit_prefilter.h"
+
+using namespace std;
+
+const char *k8s_audit_prefilter::reason_names[R_MAX] = {"stage", "verb", "user", "resource", "duplicate"};
+
+// Indexed by reason. The last one is the auditID used, along with the
+// stage, to find duplicates.
+const vector<string> k8s_audit_prefilter::s_paths[R_MAX] = {
+	{"stage"},
+	{"verb"},
+	{"user", "username"},
+	{"objectRef", "resource"},
+	{"auditID"}
+};
+
+k8s_audit_prefilter::k8s_audit_prefilter()
+	: m_dedupe(false),
+	  m_dedupe_window(0)
+{
+}
+
+k8s_audit_prefilter::~k8s_audit_prefilter()
+{
+}
+
+void k8s_audit_prefilter::set_values(reason r, const unordered_set<string> &values)
+{
+	if(r < R_DUPLICATE)
+	{
+		m_values[r] = values;
+	}
+}
+
+void k8s_audit_prefilter::set_dedupe(bool enabled, size_t window, const string &keep_stage)
+{
+	lock_guard<mutex> lock(m_seen_mtx);
+
+	m_dedupe = (enabled && window > 0);
+	m_dedupe_window = window;
+	m_dedupe_keep_stage = keep_stage;
+	m_seen.clear();
+	m_seen_order.clear();
+}
+
+bool k8s_audit_prefilter::enabled()
+{
+	for(uint32_t r = 0; r < R_DUPLICATE; r++)
+	{
+		if(!m_values[r].empty())
+		{
+			return true;
+		}
+	}
+
+	return m_dedupe;
+}
+
+bool k8s_audit_prefilter::get_field(json_index &doc, const json_index::value &evt,
+				    const vector<string> &path, string &val)
+{
+	json_index::value v;
+
+	return (doc.find(evt, path, v) && doc.get_string(v, val));
+}
+
+bool k8s_audit_prefilter::keep(json_index &doc, const json_index::value &evt)
+{
+	string val;
+
+	for(uint32_t r = 0; r < R_DUPLICATE; r++)
+	{
+		if(m_values[r].empty())
+		{
+			continue;
+		}
+
+		if(!get_field(doc, evt, s_paths[r], val) ||
+		   m_values[r].find(val) == m_values[r].end())
+		{
+			m_num_dropped[r].add();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool k8s_audit_prefilter::dedupe()
+{
+	return m_dedupe;
+}
+
+bool k8s_audit_prefilter::keep_unique(json_index &doc, const json_index::value &evt)
+{
+	string id, stage;
+
+	if(!m_dedupe || !get_field(doc, evt, s_paths[R_DUPLICATE], id))
+	{
+		return true;
+	}
+
+	get_field(doc, evt, s_paths[R_STAGE], stage);
+
+	if(!m_dedupe_keep_stage.empty() && stage != m_dedupe_keep_stage)
+	{
+		m_num_dropped[R_DUPLICATE].add();
+		return false;
+	}
+
+	string key = id;
+	key += '\n';
+	key += stage;
+
+	lock_guard<mutex> lock(m_seen_mtx);
+
+	if(!m_seen.insert(key).second)
+	{
+		m_num_dropped[R_DUPLICATE].add();
+		return false;
+	}
+
+	m_seen_order.push_back(key);
+	if(m_seen_order.size() > m_dedupe_window)
+	{
+		m_seen.erase(m_seen_order.front());
+		m_seen_order.pop_front();
+	}
+
+	return true;
+}
+
+uint64_t k8s_audit_prefilter::num_dropped(reason r)
+{
+	return m_num_dropped[r].get();
+}
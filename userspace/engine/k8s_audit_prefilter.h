@@ -0,0 +1,111 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "atomic_counter.h"
+#include "json_index.h"
+
+// Drops k8s audit events before they are parsed into json objects
+// or checked against the rules, based on a few top level fields
+// looked up in the structural index of the raw event. Events can be
+// restricted to a set of stages, verbs, users and resources, and
+// events repeating the auditID of an event already seen, at the same
+// stage (e.g. resent by the api server) or at any stage, can be
+// dropped.
+class k8s_audit_prefilter
+{
+public:
+	// Why an event was dropped
+	enum reason {
+		R_STAGE = 0,
+		R_VERB,
+		R_USER,
+		R_RESOURCE,
+		R_DUPLICATE,
+		R_MAX
+	};
+
+	static const char *reason_names[R_MAX];
+
+	k8s_audit_prefilter();
+	virtual ~k8s_audit_prefilter();
+
+	// Only keep events whose field for reason r (one of R_STAGE
+	// to R_RESOURCE) is one of values. Events without the field
+	// are dropped. An empty set of values keeps all events.
+	void set_values(reason r, const std::unordered_set<std::string> &values);
+
+	// Only keep the first event for each auditID and stage,
+	// amongst the last window pairs seen. If keep_stage is not
+	// empty, the events of an auditID are also only kept at that
+	// stage (e.g. ResponseComplete), so that each request is
+	// kept once rather than once per stage. Events without an
+	// auditID are always kept.
+	void set_dedupe(bool enabled, size_t window, const std::string &keep_stage = "");
+
+	// Whether any event can be dropped at all.
+	bool enabled();
+
+	// Whether to keep the event evt of document doc, given the
+	// values set with set_values. Can be called from several
+	// threads at once.
+	bool keep(json_index &doc, const json_index::value &evt);
+
+	// Whether duplicates are dropped.
+	bool dedupe();
+
+	// Whether to keep the event evt of document doc, given the
+	// events seen before with set_dedupe. Unlike keep, this
+	// remembers the events kept, so it must be called with the
+	// events in the order they were received, and only for the
+	// events that keep kept.
+	bool keep_unique(json_index &doc, const json_index::value &evt);
+
+	// The number of events dropped for reason r. Can be called
+	// from any thread.
+	uint64_t num_dropped(reason r);
+
+private:
+	bool get_field(json_index &doc, const json_index::value &evt,
+		       const std::vector<std::string> &path, std::string &val);
+
+	static const std::vector<std::string> s_paths[R_MAX];
+
+	std::unordered_set<std::string> m_values[R_DUPLICATE];
+
+	bool m_dedupe;
+	size_t m_dedupe_window;
+	std::string m_dedupe_keep_stage;
+
+	// The auditID and stage pairs seen, and the order in which
+	// they were seen to forget the oldest ones.
+	std::mutex m_seen_mtx;
+	std::unordered_set<std::string> m_seen;
+	std::deque<std::string> m_seen_order;
+
+	atomic_counter m_num_dropped[R_MAX];
+};
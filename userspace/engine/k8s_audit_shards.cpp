@@ -0,0 +1,175 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include "k8s_audit_shards.h"
+
+using json = nlohmann::json;
+using namespace std;
+
+static const vector<string> s_namespace_path = {"objectRef", "namespace"};
+static const vector<string> s_name_path = {"objectRef", "name"};
+static const vector<string> s_audit_id_path = {"auditID"};
+static const uint32_t s_namespace_path_id = json_event::path_id(s_namespace_path);
+static const uint32_t s_name_path_id = json_event::path_id(s_name_path);
+static const uint32_t s_audit_id_path_id = json_event::path_id(s_audit_id_path);
+
+k8s_audit_shards::k8s_audit_shards(falco_engine *engine, uint32_t num_workers)
+	: m_evts(NULL),
+	  m_batch(0),
+	  m_num_running(0),
+	  m_stop(false)
+{
+	if(num_workers == 0)
+	{
+		num_workers = 1;
+	}
+
+	// Clone all engines before starting any thread, so the
+	// clones are not created while other workers run.
+	for(uint32_t i = 0; i < num_workers; i++)
+	{
+		m_workers.emplace_back(new worker());
+		m_workers.back()->engine.reset(engine->clone());
+	}
+
+	for(auto &w : m_workers)
+	{
+		worker *wp = w.get();
+		w->thread = thread([this, wp]() {
+				run(*wp);
+			});
+	}
+}
+
+k8s_audit_shards::~k8s_audit_shards()
+{
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_stop = true;
+	}
+	m_start_cv.notify_all();
+
+	for(auto &w : m_workers)
+	{
+		w->thread.join();
+	}
+}
+
+uint32_t k8s_audit_shards::num_workers()
+{
+	return m_workers.size();
+}
+
+uint32_t k8s_audit_shards::shard(json_event *evt)
+{
+	const json *ns = evt->value_at(s_namespace_path, s_namespace_path_id);
+	const json *name = evt->value_at(s_name_path, s_name_path_id);
+	size_t h;
+
+	if(name != NULL && name->is_string())
+	{
+		h = hash<string>()(name->get_ref<const string &>());
+
+		if(ns != NULL && ns->is_string())
+		{
+			h = h * 31 + hash<string>()(ns->get_ref<const string &>());
+		}
+	}
+	else
+	{
+		// Without an object name, e.g. for list requests,
+		// only keep the stages of the same request together.
+		const json *id = evt->value_at(s_audit_id_path, s_audit_id_path_id);
+		h = ((id != NULL && id->is_string()) ? hash<string>()(id->get_ref<const string &>()) : 0);
+	}
+
+	return (h % m_workers.size());
+}
+
+void k8s_audit_shards::process_events(json_event **evts, size_t num_evts, match_cb_t on_match)
+{
+	if(num_evts == 0)
+	{
+		return;
+	}
+
+	m_evts = evts;
+	m_results.resize(num_evts);
+	m_matched.assign(num_evts, 0);
+
+	for(auto &w : m_workers)
+	{
+		w->evts.clear();
+	}
+
+	for(size_t i = 0; i < num_evts; i++)
+	{
+		m_workers[shard(evts[i])]->evts.push_back(i);
+	}
+
+	{
+		unique_lock<mutex> lock(m_mtx);
+		m_num_running = m_workers.size();
+		m_batch++;
+		m_start_cv.notify_all();
+
+		m_done_cv.wait(lock, [this]() { return m_num_running == 0; });
+	}
+
+	for(size_t i = 0; i < num_evts; i++)
+	{
+		if(m_matched[i])
+		{
+			on_match(m_results[i]);
+		}
+	}
+}
+
+void k8s_audit_shards::run(worker &w)
+{
+	uint64_t batch = 0;
+
+	while(true)
+	{
+		{
+			unique_lock<mutex> lock(m_mtx);
+			m_start_cv.wait(lock, [&]() { return m_stop || m_batch != batch; });
+
+			if(m_stop)
+			{
+				return;
+			}
+
+			batch = m_batch;
+		}
+
+		for(size_t i : w.evts)
+		{
+			m_matched[i] = w.engine->process_k8s_audit_event(m_evts[i], m_results[i]);
+		}
+
+		{
+			lock_guard<mutex> lock(m_mtx);
+			if(--m_num_running == 0)
+			{
+				m_done_cv.notify_one();
+			}
+		}
+	}
+}
@@ -0,0 +1,96 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "falco_engine.h"
+#include "json_evt.h"
+
+//
+// Checks k8s audit events against the rules on several worker
+// threads. The engine is not thread-safe, so each worker has its own
+// clone of the engine (see falco_engine::clone), with its own
+// filters.
+//
+// Events are assigned to workers by the object they are about
+// (objectRef namespace and name, or the auditID for events without
+// an object), so all the events about an object are checked by the
+// same worker, in order. The matches are then reported on the
+// calling thread in the order of the events, so alerts come out in
+// the same order as with a single engine.
+//
+// Counters kept by the engine (rule matches, events checked,
+// sampling) are kept by each worker's engine, and included in the
+// counters reported by the engine given to the constructor.
+//
+class k8s_audit_shards
+{
+public:
+	typedef std::function<void (falco_engine::rule_result &res)> match_cb_t;
+
+	k8s_audit_shards(falco_engine *engine, uint32_t num_workers);
+	virtual ~k8s_audit_shards();
+
+	uint32_t num_workers();
+
+	// Check the events against the rules, calling on_match for
+	// each match, from the calling thread, once all events are
+	// checked. Must only be called from one thread at a time.
+	void process_events(json_event **evts, size_t num_evts, match_cb_t on_match);
+
+	// The worker checking events about the same object as evt
+	uint32_t shard(json_event *evt);
+
+private:
+	struct worker
+	{
+		std::unique_ptr<falco_engine> engine;
+		std::thread thread;
+
+		// Indexes in m_evts of the events assigned to this
+		// worker for the current batch
+		std::vector<size_t> evts;
+	};
+
+	void run(worker &w);
+
+	std::vector<std::unique_ptr<worker>> m_workers;
+
+	// The current batch, and for each event whether it matched
+	// and the result.
+	json_event **m_evts;
+	std::vector<falco_engine::rule_result> m_results;
+	std::vector<uint8_t> m_matched;
+
+	std::mutex m_mtx;
+	std::condition_variable m_start_cv;
+	std::condition_variable m_done_cv;
+	uint64_t m_batch;
+	uint32_t m_num_running;
+	bool m_stop;
+};
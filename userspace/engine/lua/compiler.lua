@@ -155,6 +155,264 @@ function get_filters(ast)
    return filters
 end
 
+--[[
+   Find a guard for a filter: a relational expression of the form
+   "<field> = <value>" or "<field> in (<values>)" on one of the fields
+   in guard_fields, that must hold for the filter to match. Only
+   expressions reachable from the root through "and" operators
+   qualify. When several qualify, the one with the fewest values (the
+   most selective) wins.
+
+   Returns the field name and a list of values, or nil if the filter
+   has no guard.
+--]]
+function compiler.get_guard(ast, guard_fields)
+
+   local guard_field = nil
+   local guard_values = nil
+
+   local function visit(node)
+      if node.type == "BinaryBoolOp" and node.operator == "and" then
+	 visit(node.left)
+	 visit(node.right)
+
+      elseif node.type == "BinaryRelOp" and node.left.type == "FieldName" and
+	 guard_fields[node.left.value] ~= nil then
+
+	 local values = {}
+
+	 if node.operator == "=" or node.operator == "==" then
+	    values[1] = tostring(node.right.value)
+	 elseif node.operator == "in" then
+	    for i, v in ipairs(node.right.elements) do
+	       values[i] = tostring(v.value)
+	    end
+	 end
+
+	 if #values > 0 and (guard_values == nil or #values < #guard_values) then
+	    guard_field = node.left.value
+	    guard_values = values
+	 end
+      end
+   end
+
+   visit(ast)
+
+   return guard_field, guard_values
+end
+
+--[[
+   Relative cost of extracting a field, by field name prefix. Fields
+   not listed here are read directly from the event or thread and cost
+   1. The longest matching prefix wins.
+--]]
+local field_costs = {
+   ["proc.aname"] = 10, ["proc.apid"] = 10,
+   ["proc.pname"] = 2, ["proc.pcmdline"] = 3, ["proc.pexe"] = 2, ["proc.pexepath"] = 2,
+   ["proc.cmdline"] = 3, ["proc.args"] = 3, ["proc.env"] = 4,
+   ["fd."] = 2,
+   ["evt.arg"] = 2, ["evt.args"] = 4, ["evt.buffer"] = 4,
+   ["user."] = 2, ["group."] = 2,
+   ["container.image"] = 3, ["container.name"] = 3, ["container.mount"] = 4,
+   ["container.privileged"] = 3,
+   ["k8s."] = 4, ["mesos."] = 4,
+   ["ka."] = 2, ["ka.req.pod.containers"] = 4, ["ka.req.pod.volumes"] = 4, ["jevt."] = 2
+}
+
+-- Relative cost of the comparison itself, by operator
+local op_costs = {
+   contains = 2, icontains = 3, startswith = 2, endswith = 2, glob = 3, pmatch = 2
+}
+
+--[[
+   Rough probability that a relational expression holds for an event
+   reaching the rule. Positive matches on a value are assumed to be
+   selective; negative matches and existence checks mostly hold.
+--]]
+local function rel_probability(node)
+   local op = node.operator
+   if op == "!=" or op == "exists" then
+      return 0.9
+   elseif op == "<" or op == "<=" or op == ">" or op == ">=" then
+      return 0.5
+   end
+   return 0.1
+end
+
+local function field_cost(name)
+   local cost = 1
+   local best = 0
+
+   for prefix, c in pairs(field_costs) do
+      if #prefix > best and string.sub(name, 1, #prefix) == prefix then
+	 cost = c
+	 best = #prefix
+      end
+   end
+
+   return cost
+end
+
+--[[
+   Return the expected cost of evaluating the node and the
+   probability that it holds, taking into account short-circuit
+   evaluation of its children in their current order.
+--]]
+local function estimate(node)
+   local t = node.type
+
+   if t == "BinaryBoolOp" then
+      local lcost, lprob = estimate(node.left)
+      local rcost, rprob = estimate(node.right)
+
+      if node.operator == "and" then
+	 return lcost + lprob * rcost, lprob * rprob
+      else
+	 return lcost + (1 - lprob) * rcost, 1 - (1 - lprob) * (1 - rprob)
+      end
+
+   elseif t == "UnaryBoolOp" then
+      local cost, prob = estimate(node.argument)
+      return cost, 1 - prob
+
+   elseif t == "BinaryRelOp" then
+      return field_cost(node.left.value) * (op_costs[node.operator] or 1), rel_probability(node)
+
+   elseif t == "UnaryRelOp" then
+      return field_cost(node.argument.value), rel_probability(node)
+   end
+
+   return 1, 0.5
+end
+
+local function collect_operands(node, operator, operands)
+   if node.type == "BinaryBoolOp" and node.operator == operator then
+      collect_operands(node.left, operator, operands)
+      collect_operands(node.right, operator, operands)
+   else
+      operands[#operands+1] = node
+   end
+   return operands
+end
+
+--[[
+   Within every chain of "or" operators, merge the "<field> = <value>"
+   and "<field> in (<values>)" operands that share a field into a
+   single "in" operand, placed where the first of them was. The field
+   is then extracted once and looked up in a set, instead of once per
+   value.
+
+   Only the fields in the fields table are folded, or all fields if
+   it is nil. Folding is only correct for fields whose "=" and "in"
+   match the same values.
+
+   Returns the (possibly new) root node.
+--]]
+function compiler.fold_in_lists(node, fields)
+   local t = node.type
+
+   if t == "UnaryBoolOp" then
+      node.argument = compiler.fold_in_lists(node.argument, fields)
+      return node
+   end
+
+   if t ~= "BinaryBoolOp" then
+      return node
+   end
+
+   local operands = collect_operands(node, node.operator, {})
+   local folded = {}
+   local by_field = {}
+
+   for _, operand in ipairs(operands) do
+      operand = compiler.fold_in_lists(operand, fields)
+
+      local values = nil
+      if node.operator == "or" and operand.type == "BinaryRelOp" and
+	 (fields == nil or fields[operand.left.value] ~= nil) then
+	 if operand.operator == "=" or operand.operator == "==" then
+	    values = {operand.right}
+	 elseif operand.operator == "in" then
+	    values = operand.right.elements
+	 end
+      end
+
+      if values == nil then
+	 folded[#folded+1] = operand
+      else
+	 local field = operand.left.value
+	 local merged = by_field[field]
+
+	 if merged == nil then
+	    merged = {type="BinaryRelOp", operator="in", left=operand.left,
+		      right={type="List", elements={}}, index=operand.index}
+	    by_field[field] = merged
+	    folded[#folded+1] = merged
+	 end
+
+	 for _, v in ipairs(values) do
+	    merged.right.elements[#merged.right.elements+1] = v
+	 end
+      end
+   end
+
+   local res = folded[1]
+   for i = 2, #folded do
+      res = {type="BinaryBoolOp", operator=node.operator, left=res, right=folded[i]}
+   end
+
+   return res
+end
+
+--[[
+   Reorder the operands of every chain of "and"/"or" operators so the
+   ones with the lowest cost per chance of deciding the result come
+   first: for "and", cost / P(false), for "or", cost / P(true). Fields
+   have no side effects, so this does not change what the filter
+   matches, only how quickly it gets there. Operands with equal rank
+   keep their original order.
+
+   Returns the (possibly new) root node.
+--]]
+function compiler.reorder_operands(node)
+   local t = node.type
+
+   if t == "UnaryBoolOp" then
+      node.argument = compiler.reorder_operands(node.argument)
+      return node
+   end
+
+   if t ~= "BinaryBoolOp" then
+      return node
+   end
+
+   local operands = collect_operands(node, node.operator, {})
+   local ranked = {}
+
+   for i, operand in ipairs(operands) do
+      operand = compiler.reorder_operands(operand)
+
+      local cost, prob = estimate(operand)
+      local decide = (node.operator == "and") and (1 - prob) or prob
+
+      ranked[i] = {node=operand, rank=cost / math.max(decide, 0.01), pos=i}
+   end
+
+   table.sort(ranked, function(a, b)
+		 if a.rank ~= b.rank then
+		    return a.rank < b.rank
+		 end
+		 return a.pos < b.pos
+   end)
+
+   local res = ranked[1].node
+   for i = 2, #ranked do
+      res = {type="BinaryBoolOp", operator=node.operator, left=res, right=ranked[i].node}
+   end
+
+   return res
+end
+
 function compiler.expand_lists_in(source, list_defs)
 
    for name, def in pairs(list_defs) do
@@ -227,7 +485,8 @@ function compiler.compile_macro(line, macro_defs, list_defs)
 end
 
 --[[
-   Parses a single filter, then expands macros using passed-in table of definitions. Returns resulting AST.
+   Parses a single filter, then expands macros using passed-in table of definitions. Returns resulting AST,
+   the fields it uses and the names of all macros it refers to, directly or through other macros.
 --]]
 function compiler.compile_filter(name, source, macro_defs, list_defs)
 
@@ -240,9 +499,12 @@ function compiler.compile_filter(name, source, macro_defs, list_defs)
       return false, msg
    end
 
+   local macros = {}
+
    if (ast.type == "Rule") then
       -- Line is a filter, so expand macro references
       repeat
+	 get_macros(ast.filter, macros)
 	 status, expanded  = expand_macros(ast, macro_defs, false)
 	 if status == false then
 	    return false, expanded
@@ -255,7 +517,7 @@ function compiler.compile_filter(name, source, macro_defs, list_defs)
 
    filters = get_filters(ast)
 
-   return true, ast, filters
+   return true, ast, filters, macros
 end
 
 
@@ -115,6 +115,27 @@ local function install_filter(node, filter_api_lib, lua_parser, parent_bool_op)
    end
 end
 
+-- Fields that tell rules apart well. When a rule requires one of
+-- these fields to have one of a set of values, the engine indexes the
+-- rule by those values and skips it for events having any other
+-- value. See compiler.get_guard.
+local guard_fields = {
+   syscall = {["proc.name"]=1, ["fd.directory"]=1, ["container.image.repository"]=1},
+   k8s_audit = {["ka.verb"]=1, ["ka.target.resource"]=1}
+}
+
+-- The fields whose "=" checks can be folded into "in" lists (see
+-- compiler.fold_in_lists). K8s audit fields compare the extracted
+-- string for both operators, so all of them can be. Some syscall
+-- fields give "=" its own meaning (e.g. fd.net matches a CIDR), so
+-- only fields extracting a plain string are listed.
+local in_list_fields = {
+   syscall = {["proc.name"]=1, ["proc.pname"]=1, ["proc.exe"]=1, ["proc.cmdline"]=1,
+	      ["fd.name"]=1, ["fd.directory"]=1, ["fd.filename"]=1, ["user.name"]=1,
+	      ["container.id"]=1, ["container.name"]=1, ["container.image.repository"]=1},
+   k8s_audit = nil
+}
+
 function set_output(output_format, state)
 
    if(output_ast.type == "OutputFormat") then
@@ -464,7 +485,8 @@ function load_rules(sinsp_lua_parser,
 		    all_events,
 		    extra,
 		    replace_container_info,
-		    min_priority)
+		    min_priority,
+		    reorder_conditions)
 
    local load_state = {lines={}, indices={}, cur_item_idx=0, min_priority=min_priority, required_engine_version=0}
 
@@ -577,8 +599,8 @@ function load_rules(sinsp_lua_parser,
 	 warn_evttypes = v['warn_evttypes']
       end
 
-      local status, filter_ast, filters = compiler.compile_filter(v['rule'], v['condition'],
-								  state.macros, state.lists)
+      local status, filter_ast, filters, macros = compiler.compile_filter(v['rule'], v['condition'],
+									  state.macros, state.lists)
 
       if status == false then
 	 return false, build_error_with_context(v['context'], filter_ast)
@@ -647,6 +669,8 @@ function load_rules(sinsp_lua_parser,
 
 	 state.rules_by_idx[state.n_rules] = v
 
+	 v['macros'] = macros
+
 	 -- Store the index of this formatter in each relational expression that
 	 -- this rule contains.
 	 -- This index will eventually be stamped in events passing this rule, and
@@ -654,18 +678,38 @@ function load_rules(sinsp_lua_parser,
 	 -- event.
 	 mark_relational_nodes(filter_ast.filter.value, state.n_rules)
 
+	 -- Done after finding event types, which depends on the
+	 -- position of evt.type checks relative to negations.
+	 filter_ast.filter.value = compiler.fold_in_lists(filter_ast.filter.value, in_list_fields[v['source']])
+
+	 if reorder_conditions then
+	    filter_ast.filter.value = compiler.reorder_operands(filter_ast.filter.value)
+	 end
+
 	 if (v['tags'] == nil) then
 	    v['tags'] = {}
 	 end
+	 local guard_field, guard_values = compiler.get_guard(filter_ast.filter.value, guard_fields[v['source']])
+	 if guard_field == nil then
+	    guard_field = ""
+	    guard_values = {}
+	 elseif verbose then
+	    io.stderr:write("Guard for rule "..name..": "..guard_field.." in ("..table.concat(guard_values, ",")..")\n")
+	 end
+
 	 if v['source'] == "syscall" then
 	    install_filter(filter_ast.filter.value, filter, sinsp_lua_parser)
-	    -- Pass the filter and event types back up
-	    falco_rules.add_filter(rules_mgr, v['rule'], evttypes, syscallnums, v['tags'])
+
+	    -- Pass the filter, event types and guard back up
+	    falco_rules.add_filter(rules_mgr, v['rule'], evttypes, syscallnums, v['tags'], guard_field, guard_values)
 
 	 elseif v['source'] == "k8s_audit" then
 	    install_filter(filter_ast.filter.value, k8s_audit_filter, json_lua_parser)
 
-	    falco_rules.add_k8s_audit_filter(rules_mgr, v['rule'], v['tags'])
+	    -- All k8s audit events share one event tag, so the guard
+	    -- (on the verb or the resource) is what narrows down
+	    -- the rules to run for an event.
+	    falco_rules.add_k8s_audit_filter(rules_mgr, v['rule'], v['tags'], guard_field, guard_values)
 	 end
 
 	 -- Rule ASTs are merged together into one big AST, with "OR" between each
@@ -793,47 +837,43 @@ function describe_rule(name)
    end
 end
 
-local rule_output_counts = {total=0, by_priority={}, by_name={}}
-
-function on_event(rule_id)
+-- Return a table mapping each loaded rule name to the list of macros
+-- its condition refers to (directly or through other macros). Used
+-- to aggregate rule coverage by macro.
+function get_rule_macros()
+   local res = {}
 
-   if state.rules_by_idx[rule_id] == nil then
-      error ("rule_loader.on_event(): event with invalid rule_id: ", rule_id)
+   for idx, rule in ipairs(state.rules_by_idx) do
+      local names = {}
+      for macro, _ in pairs(rule['macros']) do
+	 names[#names+1] = macro
+      end
+      res[rule['rule']] = names
    end
 
-   rule_output_counts.total = rule_output_counts.total + 1
-   local rule = state.rules_by_idx[rule_id]
+   return res
+end
 
-   if rule_output_counts.by_priority[rule.priority] == nil then
-      rule_output_counts.by_priority[rule.priority] = 1
-   else
-      rule_output_counts.by_priority[rule.priority] = rule_output_counts.by_priority[rule.priority] + 1
-   end
+function get_rule_priorities()
+   local res = {}
 
-   if rule_output_counts.by_name[rule.rule] == nil then
-      rule_output_counts.by_name[rule.rule] = 1
-   else
-      rule_output_counts.by_name[rule.rule] = rule_output_counts.by_name[rule.rule] + 1
+   for idx, rule in ipairs(state.rules_by_idx) do
+      res[rule['rule']] = rule['priority_num']
    end
 
-   -- Prefix output with '*' so formatting is permissive
-   output = "*"..rule.output
-
-   return rule.rule, rule.priority_num, output
+   return res
 end
 
-function print_stats()
-   print("Events detected: "..rule_output_counts.total)
-   print("Rule counts by severity:")
-   for priority, count in pairs(rule_output_counts.by_priority) do
-      print ("   "..priority..": "..count)
-   end
+-- Return a table mapping each rule index (the id set on events
+-- matching the rule) to the name, source, priority and output of the
+-- rule. The engine reads it once per load, so matching events do not
+-- need to call into lua.
+function get_rule_infos()
+   local res = {}
 
-   print("Triggered rules by rule name:")
-   for name, count in pairs(rule_output_counts.by_name) do
-      print ("   "..name..": "..count)
+   for idx, rule in ipairs(state.rules_by_idx) do
+      res[idx] = {rule=rule['rule'], source=rule['source'], priority_num=rule['priority_num'], output="*"..rule['output']}
    end
-end
-
-
 
+   return res
+end
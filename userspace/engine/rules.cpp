@@ -74,23 +74,25 @@ void falco_rules::clear_filters()
 
 int falco_rules::add_filter(lua_State *ls)
 {
-	if (! lua_islightuserdata(ls, -5) ||
-	    ! lua_isstring(ls, -4) ||
+	if (! lua_islightuserdata(ls, -7) ||
+	    ! lua_isstring(ls, -6) ||
+	    ! lua_istable(ls, -5) ||
+	    ! lua_istable(ls, -4) ||
 	    ! lua_istable(ls, -3) ||
-	    ! lua_istable(ls, -2) ||
+	    ! lua_isstring(ls, -2) ||
 	    ! lua_istable(ls, -1))
 	{
 		lua_pushstring(ls, "Invalid arguments passed to add_filter()");
 		lua_error(ls);
 	}
 
-	falco_rules *rules = (falco_rules *) lua_topointer(ls, -5);
-	const char *rulec = lua_tostring(ls, -4);
+	falco_rules *rules = (falco_rules *) lua_topointer(ls, -7);
+	const char *rulec = lua_tostring(ls, -6);
 
 	set<uint32_t> evttypes;
 
 	lua_pushnil(ls);  /* first key */
-	while (lua_next(ls, -4) != 0) {
+	while (lua_next(ls, -6) != 0) {
                 // key is at index -2, value is at index
                 // -1. We want the keys.
 		evttypes.insert(luaL_checknumber(ls, -2));
@@ -102,7 +104,7 @@ int falco_rules::add_filter(lua_State *ls)
 	set<uint32_t> syscalls;
 
 	lua_pushnil(ls);  /* first key */
-	while (lua_next(ls, -3) != 0) {
+	while (lua_next(ls, -5) != 0) {
                 // key is at index -2, value is at index
                 // -1. We want the keys.
 		syscalls.insert(luaL_checknumber(ls, -2));
@@ -114,7 +116,7 @@ int falco_rules::add_filter(lua_State *ls)
 	set<string> tags;
 
 	lua_pushnil(ls);  /* first key */
-	while (lua_next(ls, -2) != 0) {
+	while (lua_next(ls, -4) != 0) {
                 // key is at index -2, value is at index
                 // -1. We want the values.
 		tags.insert(lua_tostring(ls, -1));
@@ -123,15 +125,32 @@ int falco_rules::add_filter(lua_State *ls)
 		lua_pop(ls, 1);
 	}
 
+	// An empty guard field means the rule has no guard.
+	std::string guard_field = lua_tostring(ls, -2);
+
+	set<string> guard_values;
+
+	lua_pushnil(ls);  /* first key */
+	while (lua_next(ls, -2) != 0) {
+                // key is at index -2, value is at index
+                // -1. We want the values.
+		guard_values.insert(lua_tostring(ls, -1));
+
+		// Remove value, keep key for next iteration
+		lua_pop(ls, 1);
+	}
+
 	std::string rule = rulec;
-	rules->add_filter(rule, evttypes, syscalls, tags);
+	rules->add_filter(rule, evttypes, syscalls, tags, guard_field, guard_values);
 
 	return 0;
 }
 
 int falco_rules::add_k8s_audit_filter(lua_State *ls)
 {
-	if (! lua_islightuserdata(ls, -3) ||
+	if (! lua_islightuserdata(ls, -5) ||
+	    ! lua_isstring(ls, -4) ||
+	    ! lua_istable(ls, -3) ||
 	    ! lua_isstring(ls, -2) ||
 	    ! lua_istable(ls, -1))
 	{
@@ -139,13 +158,13 @@ int falco_rules::add_k8s_audit_filter(lua_State *ls)
 		lua_error(ls);
 	}
 
-	falco_rules *rules = (falco_rules *) lua_topointer(ls, -3);
-	const char *rulec = lua_tostring(ls, -2);
+	falco_rules *rules = (falco_rules *) lua_topointer(ls, -5);
+	const char *rulec = lua_tostring(ls, -4);
 
 	set<string> tags;
 
 	lua_pushnil(ls);  /* first key */
-	while (lua_next(ls, -2) != 0) {
+	while (lua_next(ls, -4) != 0) {
                 // key is at index -2, value is at index
                 // -1. We want the values.
 		tags.insert(lua_tostring(ls, -1));
@@ -154,30 +173,61 @@ int falco_rules::add_k8s_audit_filter(lua_State *ls)
 		lua_pop(ls, 1);
 	}
 
+	// An empty guard field means the rule has no guard.
+	std::string guard_field = lua_tostring(ls, -2);
+
+	set<string> guard_values;
+
+	lua_pushnil(ls);  /* first key */
+	while (lua_next(ls, -2) != 0) {
+                // key is at index -2, value is at index
+                // -1. We want the values.
+		guard_values.insert(lua_tostring(ls, -1));
+
+		// Remove value, keep key for next iteration
+		lua_pop(ls, 1);
+	}
+
 	std::string rule = rulec;
-	rules->add_k8s_audit_filter(rule, tags);
+	rules->add_k8s_audit_filter(rule, tags, guard_field, guard_values);
 
 	return 0;
 }
 
-void falco_rules::add_filter(string &rule, set<uint32_t> &evttypes, set<uint32_t> &syscalls, set<string> &tags)
+void falco_rules::add_filter(string &rule, set<uint32_t> &evttypes, set<uint32_t> &syscalls, set<string> &tags,
+			     string &guard_field, set<string> &guard_values)
 {
 	// While the current rule was being parsed, a sinsp_filter
 	// object was being populated by lua_parser. Grab that filter
 	// and pass it to the engine.
 	sinsp_filter *filter = (sinsp_filter *) m_sinsp_lua_parser->get_filter(true);
 
-	m_engine->add_sinsp_filter(rule, evttypes, syscalls, tags, filter);
+	if(guard_field.empty())
+	{
+		m_engine->add_sinsp_filter(rule, evttypes, syscalls, tags, filter);
+	}
+	else
+	{
+		m_engine->add_sinsp_filter(rule, evttypes, syscalls, tags, filter, guard_field, guard_values);
+	}
 }
 
-void falco_rules::add_k8s_audit_filter(string &rule, set<string> &tags)
+void falco_rules::add_k8s_audit_filter(string &rule, set<string> &tags,
+				       string &guard_field, set<string> &guard_values)
 {
 	// While the current rule was being parsed, a sinsp_filter
 	// object was being populated by lua_parser. Grab that filter
 	// and pass it to the engine.
 	json_event_filter *filter = (json_event_filter *) m_json_lua_parser->get_filter(true);
 
-	m_engine->add_k8s_audit_filter(rule, tags, filter);
+	if(guard_field.empty())
+	{
+		m_engine->add_k8s_audit_filter(rule, tags, filter);
+	}
+	else
+	{
+		m_engine->add_k8s_audit_filter(rule, tags, filter, guard_field, guard_values);
+	}
 }
 
 int falco_rules::enable_rule(lua_State *ls)
@@ -224,6 +274,7 @@ void falco_rules::load_rules(const string &rules_content,
 			     bool verbose, bool all_events,
 			     string &extra, bool replace_container_info,
 			     falco_common::priority_type min_priority,
+			     bool reorder_conditions,
 			     uint64_t &required_engine_version)
 {
 	lua_getglobal(m_ls, m_lua_load_rules.c_str());
@@ -425,7 +476,8 @@ void falco_rules::load_rules(const string &rules_content,
 		lua_pushstring(m_ls, extra.c_str());
 		lua_pushboolean(m_ls, (replace_container_info ? 1 : 0));
 		lua_pushnumber(m_ls, min_priority);
-		if(lua_pcall(m_ls, 9, 2, 0) != 0)
+		lua_pushboolean(m_ls, (reorder_conditions ? 1 : 0));
+		if(lua_pcall(m_ls, 10, 2, 0) != 0)
 		{
 			const char* lerr = lua_tostring(m_ls, -1);
 
@@ -477,6 +529,119 @@ void falco_rules::describe_rule(std::string *rule)
 	}
 }
 
+void falco_rules::get_rule_macros(std::map<std::string, std::set<std::string>> &rule_macros)
+{
+	lua_getglobal(m_ls, m_lua_get_rule_macros.c_str());
+	if(lua_isfunction(m_ls, -1))
+	{
+		if(lua_pcall(m_ls, 0, 1, 0) != 0)
+		{
+			const char* lerr = lua_tostring(m_ls, -1);
+			string err = "Could not get rule macros: " + string(lerr);
+			throw falco_exception(err);
+		}
+
+		lua_pushnil(m_ls);  /* first key */
+		while (lua_next(m_ls, -2) != 0) {
+			// key (rule name) is at index -2, value
+			// (list of macro names) is at index -1.
+			std::set<std::string> &macros = rule_macros[lua_tostring(m_ls, -2)];
+
+			lua_pushnil(m_ls);  /* first key */
+			while (lua_next(m_ls, -2) != 0) {
+				macros.insert(lua_tostring(m_ls, -1));
+
+				// Remove value, keep key for next iteration
+				lua_pop(m_ls, 1);
+			}
+
+			// Remove value, keep key for next iteration
+			lua_pop(m_ls, 1);
+		}
+
+		// Remove the returned table
+		lua_pop(m_ls, 1);
+	} else {
+		throw falco_exception("No function " + m_lua_get_rule_macros + " found in lua rule module");
+	}
+}
+
+void falco_rules::get_rule_priorities(std::map<std::string, falco_common::priority_type> &rule_priorities)
+{
+	lua_getglobal(m_ls, m_lua_get_rule_priorities.c_str());
+	if(lua_isfunction(m_ls, -1))
+	{
+		if(lua_pcall(m_ls, 0, 1, 0) != 0)
+		{
+			const char* lerr = lua_tostring(m_ls, -1);
+			string err = "Could not get rule priorities: " + string(lerr);
+			throw falco_exception(err);
+		}
+
+		lua_pushnil(m_ls);  /* first key */
+		while (lua_next(m_ls, -2) != 0) {
+			// key (rule name) is at index -2, value
+			// (priority number) is at index -1.
+			rule_priorities[lua_tostring(m_ls, -2)] = (falco_common::priority_type) lua_tonumber(m_ls, -1);
+
+			// Remove value, keep key for next iteration
+			lua_pop(m_ls, 1);
+		}
+
+		// Remove the returned table
+		lua_pop(m_ls, 1);
+	} else {
+		throw falco_exception("No function " + m_lua_get_rule_priorities + " found in lua rule module");
+	}
+}
+
+void falco_rules::get_rule_infos(std::vector<falco_rule_info> &rule_infos)
+{
+	lua_getglobal(m_ls, m_lua_get_rule_infos.c_str());
+	if(lua_isfunction(m_ls, -1))
+	{
+		if(lua_pcall(m_ls, 0, 1, 0) != 0)
+		{
+			const char* lerr = lua_tostring(m_ls, -1);
+			string err = "Could not get rule infos: " + string(lerr);
+			throw falco_exception(err);
+		}
+
+		rule_infos.clear();
+
+		lua_pushnil(m_ls);  /* first key */
+		while (lua_next(m_ls, -2) != 0) {
+			// key (rule id) is at index -2, value (table
+			// of rule info) is at index -1.
+			uint32_t rule_id = (uint32_t) lua_tonumber(m_ls, -2);
+
+			if(rule_infos.size() < rule_id + 1)
+			{
+				rule_infos.resize(rule_id + 1);
+			}
+
+			falco_rule_info &info = rule_infos[rule_id];
+
+			lua_getfield(m_ls, -1, "rule");
+			info.rule = lua_tostring(m_ls, -1);
+			lua_getfield(m_ls, -2, "source");
+			info.source = lua_tostring(m_ls, -1);
+			lua_getfield(m_ls, -3, "priority_num");
+			info.priority_num = (falco_common::priority_type) lua_tonumber(m_ls, -1);
+			lua_getfield(m_ls, -4, "output");
+			info.format = lua_tostring(m_ls, -1);
+
+			// Remove the fields and the value, keep key
+			// for next iteration
+			lua_pop(m_ls, 5);
+		}
+
+		// Remove the returned table
+		lua_pop(m_ls, 1);
+	} else {
+		throw falco_exception("No function " + m_lua_get_rule_infos + " found in lua rule module");
+	}
+}
 
 falco_rules::~falco_rules()
 {
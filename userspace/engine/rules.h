@@ -20,7 +20,10 @@ limitations under the License.
 #pragma once
 
 #include <set>
+#include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "sinsp.h"
 #include "filter.h"
@@ -32,6 +35,16 @@ limitations under the License.
 
 class falco_engine;
 
+// What falco_engine needs to know about a rule to report a match,
+// looked up by the rule id set on matching events.
+struct falco_rule_info
+{
+	std::string rule;
+	std::string source;
+	falco_common::priority_type priority_num;
+	std::string format;
+};
+
 class falco_rules
 {
  public:
@@ -42,9 +55,21 @@ class falco_rules
 	void load_rules(const string &rules_content, bool verbose, bool all_events,
 			std::string &extra, bool replace_container_info,
 			falco_common::priority_type min_priority,
+			bool reorder_conditions,
 			uint64_t &required_engine_version);
 	void describe_rule(string *rule);
 
+	// Fill in, for each loaded rule, the names of the macros its
+	// condition refers to.
+	void get_rule_macros(std::map<std::string, std::set<std::string>> &rule_macros);
+
+	// Fill in the priority of each loaded rule.
+	void get_rule_priorities(std::map<std::string, falco_common::priority_type> &rule_priorities);
+
+	// Fill in the info of each loaded rule, indexed by rule id.
+	// Ids start at 1, the first entry is left empty.
+	void get_rule_infos(std::vector<falco_rule_info> &rule_infos);
+
 	static void init(lua_State *ls);
 	static int clear_filters(lua_State *ls);
 	static int add_filter(lua_State *ls);
@@ -54,8 +79,10 @@ class falco_rules
 
  private:
 	void clear_filters();
-	void add_filter(string &rule, std::set<uint32_t> &evttypes, std::set<uint32_t> &syscalls, std::set<string> &tags);
-	void add_k8s_audit_filter(string &rule, std::set<string> &tags);
+	void add_filter(string &rule, std::set<uint32_t> &evttypes, std::set<uint32_t> &syscalls, std::set<string> &tags,
+			string &guard_field, std::set<string> &guard_values);
+	void add_k8s_audit_filter(string &rule, std::set<string> &tags,
+				  string &guard_field, std::set<string> &guard_values);
 	void enable_rule(string &rule, bool enabled);
 
 	lua_parser* m_sinsp_lua_parser;
@@ -72,4 +99,7 @@ class falco_rules
 	string m_lua_events = "events";
 	string m_lua_syscalls = "syscalls";
 	string m_lua_describe_rule = "describe_rule";
+	string m_lua_get_rule_macros = "get_rule_macros";
+	string m_lua_get_rule_priorities = "get_rule_priorities";
+	string m_lua_get_rule_infos = "get_rule_infos";
 };
@@ -17,11 +17,14 @@ limitations under the License.
 
 */
 
+#include <chrono>
+
 #include "ruleset.h"
 
 using namespace std;
 
 falco_ruleset::falco_ruleset()
+	: m_num_filters_run(0), m_rule_timing(false)
 {
 }
 
@@ -30,6 +33,7 @@ falco_ruleset::~falco_ruleset()
 	for(const auto &val : m_filters)
 	{
 		delete val.second->filter;
+		delete val.second->guard_check;
 		delete val.second;
 	}
 
@@ -55,6 +59,122 @@ falco_ruleset::ruleset_filters::~ruleset_filters()
 			m_filter_by_event_tag[i] = NULL;
 		}
 	}
+
+	for(uint32_t i = 0; i < m_index_by_event_tag.size(); i++)
+	{
+		delete m_index_by_event_tag[i];
+		m_index_by_event_tag[i] = NULL;
+	}
+}
+
+falco_ruleset::guard_index::guard_index(list<filter_wrapper *> &filters)
+{
+	map<string, size_t> field_idx;
+
+	for(auto &wrap : filters)
+	{
+		uint32_t pos = m_filters.size();
+		m_filters.push_back(wrap);
+
+		if(!wrap->guard_check)
+		{
+			m_unguarded.push_back(pos);
+			continue;
+		}
+
+		auto it = field_idx.find(wrap->guard_field);
+		if(it == field_idx.end())
+		{
+			// The first filter guarding on a given field
+			// lends its filtercheck for extraction.
+			it = field_idx.insert(make_pair(wrap->guard_field, m_guard_fields.size())).first;
+			m_guard_fields.emplace_back();
+			m_guard_fields.back().check = wrap->guard_check;
+		}
+
+		guard_field &gf = m_guard_fields[it->second];
+
+		for(auto &val : wrap->guard_values)
+		{
+			gf.positions[val].push_back(pos);
+		}
+	}
+
+	m_cursors.reserve(m_guard_fields.size() + 1);
+}
+
+falco_ruleset::guard_index::~guard_index()
+{
+}
+
+bool falco_ruleset::guard_index::run(gen_event *evt, uint64_t &num_filters_run)
+{
+	m_cursors.clear();
+
+	if(!m_unguarded.empty())
+	{
+		m_cursors.push_back(cursor{&m_unguarded, 0});
+	}
+
+	for(auto &gf : m_guard_fields)
+	{
+		uint32_t len = 0;
+		uint8_t *val = gf.check->extract(evt, &len);
+
+		// If the field can't be extracted, no filter guarded
+		// on it can match.
+		if(val == NULL)
+		{
+			continue;
+		}
+
+		// Some string fields are returned NUL-terminated
+		// without a length.
+		if(len == 0)
+		{
+			len = strlen((const char *) val);
+		}
+
+		m_tstr.assign((const char *) val, len);
+
+		auto it = gf.positions.find(m_tstr);
+		if(it != gf.positions.end())
+		{
+			m_cursors.push_back(cursor{&(it->second), 0});
+		}
+	}
+
+	// Each list of positions is sorted, and a filter appears in
+	// at most one of them, so merging them visits the candidate
+	// filters in their original order.
+	while(true)
+	{
+		cursor *next = NULL;
+
+		for(auto &cur : m_cursors)
+		{
+			if(cur.next < cur.positions->size() &&
+			   (next == NULL ||
+			    (*cur.positions)[cur.next] < (*next->positions)[next->next]))
+			{
+				next = &cur;
+			}
+		}
+
+		if(next == NULL)
+		{
+			return false;
+		}
+
+		filter_wrapper *wrap = m_filters[(*next->positions)[next->next]];
+		next->next++;
+
+		num_filters_run++;
+		if(run_filter(wrap, evt))
+		{
+			return true;
+		}
+	}
 }
 
 void falco_ruleset::ruleset_filters::add_filter(filter_wrapper *wrap)
@@ -66,10 +186,11 @@ void falco_ruleset::ruleset_filters::add_filter(filter_wrapper *wrap)
 	{
 		if(wrap->event_tags[etag])
 		{
-			added = true;
 			if(m_filter_by_event_tag.size() <= etag)
 			{
 				m_filter_by_event_tag.resize(etag+1);
+				m_num_events_by_event_tag.resize(etag+1, 0);
+				m_num_matched_by_event_tag.resize(etag+1, 0);
 			}
 
 			if(!m_filter_by_event_tag[etag])
@@ -77,7 +198,26 @@ void falco_ruleset::ruleset_filters::add_filter(filter_wrapper *wrap)
 				m_filter_by_event_tag[etag] = new list<filter_wrapper *>();
 			}
 
-			m_filter_by_event_tag[etag]->push_back(wrap);
+			// Insert the filter at its position in load order
+			// rather than at the end, so that disabling and
+			// enabling a rule again does not change which
+			// rule matches an event first.
+			list<filter_wrapper *> *l = m_filter_by_event_tag[etag];
+			auto it = l->begin();
+			while(it != l->end() && (*it)->index < wrap->index)
+			{
+				it++;
+			}
+
+			if(it != l->end() && *it == wrap)
+			{
+				// Already enabled
+				continue;
+			}
+
+			l->insert(it, wrap);
+			invalidate_index(etag);
+			added = true;
 		}
 	}
 
@@ -111,6 +251,8 @@ void falco_ruleset::ruleset_filters::remove_filter(filter_wrapper *wrap)
 						l->erase(it,
 							l->end());
 
+						invalidate_index(etag);
+
 						if(l->size() == 0)
 						{
 							delete l;
@@ -133,7 +275,15 @@ uint64_t falco_ruleset::ruleset_filters::num_filters()
 	return m_num_filters;
 }
 
-bool falco_ruleset::ruleset_filters::run(gen_event *evt, uint32_t etag)
+void falco_ruleset::ruleset_filters::invalidate_index(uint32_t etag)
+{
+	if(etag < m_index_valid.size())
+	{
+		m_index_valid[etag] = false;
+	}
+}
+
+bool falco_ruleset::ruleset_filters::run(gen_event *evt, uint32_t etag, uint64_t &num_filters_run)
 {
 	if(etag >= m_filter_by_event_tag.size())
 	{
@@ -146,10 +296,48 @@ bool falco_ruleset::ruleset_filters::run(gen_event *evt, uint32_t etag)
 		return false;
 	}
 
+	if(m_index_valid.size() <= etag)
+	{
+		m_index_valid.resize(etag+1, false);
+		m_index_by_event_tag.resize(etag+1, NULL);
+	}
+
+	if(!m_index_valid[etag])
+	{
+		delete m_index_by_event_tag[etag];
+		m_index_by_event_tag[etag] = NULL;
+
+		for(auto &wrap : *filters)
+		{
+			if(wrap->guard_check)
+			{
+				m_index_by_event_tag[etag] = new guard_index(*filters);
+				break;
+			}
+		}
+
+		m_index_valid[etag] = true;
+	}
+
+	m_num_events_by_event_tag[etag]++;
+
+	if(m_index_by_event_tag[etag])
+	{
+		if(m_index_by_event_tag[etag]->run(evt, num_filters_run))
+		{
+			m_num_matched_by_event_tag[etag]++;
+			return true;
+		}
+
+		return false;
+	}
+
 	for (auto &wrap : *filters)
 	{
-		if(wrap->filter->run(evt))
+		num_filters_run++;
+		if(run_filter(wrap, evt))
 		{
+			m_num_matched_by_event_tag[etag]++;
 			return true;
 		}
 	}
@@ -171,13 +359,77 @@ void falco_ruleset::ruleset_filters::event_tags_for_ruleset(vector<bool> &event_
 	}
 }
 
+bool falco_ruleset::run_filter(filter_wrapper *wrap, gen_event *evt)
+{
+	bool match;
+
+	wrap->num_evaluated.inc();
+
+	if(wrap->timed)
+	{
+		auto start = chrono::steady_clock::now();
+		match = wrap->filter->run(evt);
+		wrap->eval_time_ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+	}
+	else
+	{
+		match = wrap->filter->run(evt);
+	}
+
+	if(match)
+	{
+		wrap->num_matched.inc();
+	}
+
+	return match;
+}
+
+bool falco_ruleset::ruleset_filters::has_filter(filter_wrapper *wrap, uint32_t etag)
+{
+	if(etag >= m_filter_by_event_tag.size() || !m_filter_by_event_tag[etag])
+	{
+		return false;
+	}
+
+	list<filter_wrapper *> *filters = m_filter_by_event_tag[etag];
+
+	return (find(filters->begin(), filters->end(), wrap) != filters->end());
+}
+
+void falco_ruleset::ruleset_filters::event_tag_coverage(vector<uint64_t> &num_events,
+							vector<uint64_t> &num_matched)
+{
+	num_events = m_num_events_by_event_tag;
+	num_matched = m_num_matched_by_event_tag;
+}
+
 void falco_ruleset::add(string &name,
 			set<string> &tags,
 			set<uint32_t> &event_tags,
 			gen_event_filter *filter)
+{
+	string guard_field;
+	set<string> guard_values;
+
+	add(name, tags, event_tags, filter, guard_field, NULL, guard_values);
+}
+
+void falco_ruleset::add(string &name,
+			set<string> &tags,
+			set<uint32_t> &event_tags,
+			gen_event_filter *filter,
+			string &guard_field,
+			gen_event_filter_check *guard_check,
+			set<string> &guard_values)
 {
 	filter_wrapper *wrap = new filter_wrapper();
 	wrap->filter = filter;
+	wrap->index = m_filters.size();
+	wrap->guard_field = guard_field;
+	wrap->guard_check = guard_check;
+	wrap->guard_values = guard_values;
+	wrap->timed = m_rule_timing;
+	wrap->eval_time_ns = 0;
 
 	for(auto &etag : event_tags)
 	{
@@ -229,6 +481,86 @@ void falco_ruleset::enable(const string &substring, bool enabled, uint16_t rules
 	}
 }
 
+void falco_ruleset::enable_exact(const string &name, bool enabled, uint16_t ruleset)
+{
+	while (m_rulesets.size() < (size_t) ruleset + 1)
+	{
+		m_rulesets.push_back(new ruleset_filters());
+	}
+
+	auto it = m_filters.find(name);
+	if(it == m_filters.end())
+	{
+		return;
+	}
+
+	if(enabled)
+	{
+		m_rulesets[ruleset]->add_filter(it->second);
+	}
+	else
+	{
+		m_rulesets[ruleset]->remove_filter(it->second);
+	}
+}
+
+void falco_ruleset::enabled_rules(set<string> &names, uint16_t ruleset)
+{
+	if(m_rulesets.size() < (size_t) ruleset + 1)
+	{
+		return;
+	}
+
+	ruleset_filters *rs = m_rulesets[ruleset];
+
+	for(auto &val : m_filters)
+	{
+		filter_wrapper *wrap = val.second;
+
+		for(uint32_t etag = 0; etag < wrap->event_tags.size(); etag++)
+		{
+			if(wrap->event_tags[etag] && rs->has_filter(wrap, etag))
+			{
+				names.insert(val.first);
+				break;
+			}
+		}
+	}
+}
+
+void falco_ruleset::event_tags_for_rules(const set<string> &names, vector<bool> &event_tags, uint16_t ruleset)
+{
+	if(m_rulesets.size() < (size_t) ruleset + 1)
+	{
+		return;
+	}
+
+	ruleset_filters *rs = m_rulesets[ruleset];
+
+	for(auto &name : names)
+	{
+		auto it = m_filters.find(name);
+		if(it == m_filters.end())
+		{
+			continue;
+		}
+
+		filter_wrapper *wrap = it->second;
+
+		for(uint32_t etag = 0; etag < wrap->event_tags.size(); etag++)
+		{
+			if(wrap->event_tags[etag] && rs->has_filter(wrap, etag))
+			{
+				if(event_tags.size() < etag + 1)
+				{
+					event_tags.resize(etag + 1, false);
+				}
+				event_tags[etag] = true;
+			}
+		}
+	}
+}
+
 void falco_ruleset::enable_tags(const set<string> &tags, bool enabled, uint16_t ruleset)
 {
 	while (m_rulesets.size() < (size_t) ruleset + 1)
@@ -269,7 +601,32 @@ bool falco_ruleset::run(gen_event *evt, uint32_t etag, uint16_t ruleset)
 		return false;
 	}
 
-	return m_rulesets[ruleset]->run(evt, etag);
+	m_num_events.inc();
+
+	return m_rulesets[ruleset]->run(evt, etag, m_num_filters_run);
+}
+
+void falco_ruleset::run(gen_event **evts, const uint32_t *etags, size_t num_evts,
+			uint16_t ruleset, vector<uint32_t> &matched)
+{
+	matched.clear();
+
+	if(m_rulesets.size() < (size_t) ruleset + 1)
+	{
+		return;
+	}
+
+	ruleset_filters *rs = m_rulesets[ruleset];
+
+	m_num_events.inc(num_evts);
+
+	for(size_t i = 0; i < num_evts; i++)
+	{
+		if(rs->run(evts[i], etags[i], m_num_filters_run))
+		{
+			matched.push_back(i);
+		}
+	}
 }
 
 void falco_ruleset::event_tags_for_ruleset(vector<bool> &evttypes, uint16_t ruleset)
@@ -282,6 +639,82 @@ void falco_ruleset::event_tags_for_ruleset(vector<bool> &evttypes, uint16_t rule
 	return m_rulesets[ruleset]->event_tags_for_ruleset(evttypes);
 }
 
+void falco_ruleset::get_dispatch_stats(uint64_t &num_events, uint64_t &num_filters_run)
+{
+	num_events = m_num_events.get();
+	num_filters_run = m_num_filters_run;
+}
+
+uint64_t falco_ruleset::num_events()
+{
+	return m_num_events.get();
+}
+
+void falco_ruleset::get_rule_counts(map<string, pair<uint64_t, uint64_t>> &counts)
+{
+	for(auto &val : m_filters)
+	{
+		counts[val.first] = make_pair(val.second->num_evaluated.get(), val.second->num_matched.get());
+	}
+}
+
+void falco_ruleset::rule_coverage_for_ruleset(map<string, rule_coverage> &coverage, uint16_t ruleset)
+{
+	if(m_rulesets.size() < (size_t) ruleset + 1)
+	{
+		return;
+	}
+
+	ruleset_filters *rs = m_rulesets[ruleset];
+
+	vector<uint64_t> num_events;
+	vector<uint64_t> num_matched;
+	rs->event_tag_coverage(num_events, num_matched);
+
+	for(const auto &val : m_filters)
+	{
+		filter_wrapper *wrap = val.second;
+		bool enabled = false;
+		uint64_t num_reached = 0;
+
+		for(uint32_t etag = 0; etag < wrap->event_tags.size(); etag++)
+		{
+			if(wrap->event_tags[etag] && rs->has_filter(wrap, etag))
+			{
+				enabled = true;
+				num_reached += num_events[etag];
+			}
+		}
+
+		if(enabled)
+		{
+			coverage[val.first] = rule_coverage{num_reached, wrap->num_evaluated.get(), wrap->num_matched.get(), wrap->eval_time_ns};
+		}
+	}
+}
+
+void falco_ruleset::set_rule_timing(bool enabled)
+{
+	m_rule_timing = enabled;
+
+	for(auto &val : m_filters)
+	{
+		val.second->timed = enabled;
+	}
+}
+
+void falco_ruleset::event_tag_coverage_for_ruleset(vector<uint64_t> &num_events,
+						   vector<uint64_t> &num_matched,
+						   uint16_t ruleset)
+{
+	if(m_rulesets.size() < (size_t) ruleset + 1)
+	{
+		return;
+	}
+
+	m_rulesets[ruleset]->event_tag_coverage(num_events, num_matched);
+}
+
 falco_sinsp_ruleset::falco_sinsp_ruleset()
 {
 }
@@ -295,6 +728,21 @@ void falco_sinsp_ruleset::add(string &name,
 			      set<uint32_t> &syscalls,
 			      set<string> &tags,
 			      sinsp_filter* filter)
+{
+	string guard_field;
+	set<string> guard_values;
+
+	add(name, evttypes, syscalls, tags, filter, guard_field, NULL, guard_values);
+}
+
+void falco_sinsp_ruleset::add(string &name,
+			      set<uint32_t> &evttypes,
+			      set<uint32_t> &syscalls,
+			      set<string> &tags,
+			      sinsp_filter* filter,
+			      string &guard_field,
+			      gen_event_filter_check *guard_check,
+			      set<string> &guard_values)
 {
 	set<uint32_t> event_tags;
 
@@ -323,13 +771,17 @@ void falco_sinsp_ruleset::add(string &name,
 		event_tags.insert(syscall_to_event_tag(syscallid));
 	}
 
-	falco_ruleset::add(name, tags, event_tags, (gen_event_filter *) filter);
+	falco_ruleset::add(name, tags, event_tags, (gen_event_filter *) filter,
+			   guard_field, guard_check, guard_values);
 }
 
 bool falco_sinsp_ruleset::run(sinsp_evt *evt, uint16_t ruleset)
 {
-	uint32_t etag;
+	return falco_ruleset::run((gen_event*) evt, event_tag(evt), ruleset);
+}
 
+uint32_t falco_sinsp_ruleset::event_tag(sinsp_evt *evt)
+{
 	uint16_t etype = evt->get_type();
 
 	if(etype == PPME_GENERIC_E || etype == PPME_GENERIC_X)
@@ -337,14 +789,10 @@ bool falco_sinsp_ruleset::run(sinsp_evt *evt, uint16_t ruleset)
 		sinsp_evt_param *parinfo = evt->get_param(0);
 		uint16_t syscallid = *(uint16_t *)parinfo->m_val;
 
-		etag = syscall_to_event_tag(syscallid);
-	}
-	else
-	{
-		etag = evttype_to_event_tag(etype);
+		return syscall_to_event_tag(syscallid);
 	}
 
-	return falco_ruleset::run((gen_event*) evt, etag, ruleset);
+	return evttype_to_event_tag(etype);
 }
 
 void falco_sinsp_ruleset::evttypes_for_ruleset(vector<bool> &evttypes, uint16_t ruleset)
@@ -372,11 +820,11 @@ void falco_sinsp_ruleset::syscalls_for_ruleset(vector<bool> &syscalls, uint16_t
 
 	event_tags_for_ruleset(event_tags, ruleset);
 
-	syscalls.assign(PPM_EVENT_MAX+1, false);
+	syscalls.assign(PPM_SC_MAX+1, false);
 
 	for(uint32_t syscallid = 0; syscallid < PPM_SC_MAX; syscallid++)
 	{
-		uint32_t etag = evttype_to_event_tag(syscallid);
+		uint32_t etag = syscall_to_event_tag(syscallid);
 
 		if(etag < event_tags.size() && event_tags[etag])
 		{
@@ -385,6 +833,45 @@ void falco_sinsp_ruleset::syscalls_for_ruleset(vector<bool> &syscalls, uint16_t
 	}
 }
 
+void falco_sinsp_ruleset::evttype_coverage_for_ruleset(vector<uint64_t> &evttype_events,
+						       vector<uint64_t> &evttype_matched,
+						       vector<uint64_t> &syscall_events,
+						       vector<uint64_t> &syscall_matched,
+						       uint16_t ruleset)
+{
+	vector<uint64_t> num_events;
+	vector<uint64_t> num_matched;
+
+	event_tag_coverage_for_ruleset(num_events, num_matched, ruleset);
+
+	evttype_events.assign(PPM_EVENT_MAX+1, 0);
+	evttype_matched.assign(PPM_EVENT_MAX+1, 0);
+	syscall_events.assign(PPM_SC_MAX+1, 0);
+	syscall_matched.assign(PPM_SC_MAX+1, 0);
+
+	for(uint32_t etype = 0; etype < PPM_EVENT_MAX; etype++)
+	{
+		uint32_t etag = evttype_to_event_tag(etype);
+
+		if(etag < num_events.size())
+		{
+			evttype_events[etype] = num_events[etag];
+			evttype_matched[etype] = num_matched[etag];
+		}
+	}
+
+	for(uint32_t syscallid = 0; syscallid < PPM_SC_MAX; syscallid++)
+	{
+		uint32_t etag = syscall_to_event_tag(syscallid);
+
+		if(etag < num_events.size())
+		{
+			syscall_events[syscallid] = num_events[etag];
+			syscall_matched[syscallid] = num_matched[etag];
+		}
+	}
+}
+
 uint32_t falco_sinsp_ruleset::evttype_to_event_tag(uint32_t evttype)
 {
 	return evttype;
@@ -24,12 +24,14 @@ limitations under the License.
 #include <vector>
 #include <list>
 #include <map>
+#include <unordered_map>
 
 #include "sinsp.h"
 #include "filter.h"
 #include "event.h"
 
 #include "gen_filter.h"
+#include "atomic_counter.h"
 
 class falco_ruleset
 {
@@ -42,6 +44,21 @@ public:
 		 std::set<uint32_t> &event_tags,
 		 gen_event_filter* filter);
 
+	// Identical to above, but also provides a guard for the
+	// filter: a field, a filtercheck for that field and a set of
+	// values, one of which the filtercheck must extract for the
+	// filter to have any chance of matching. Guards are used to
+	// build a secondary index per event tag, so filters whose
+	// guard can not match an event are never run. The ruleset
+	// takes ownership of guard_check.
+	void add(std::string &name,
+		 std::set<std::string> &tags,
+		 std::set<uint32_t> &event_tags,
+		 gen_event_filter* filter,
+		 std::string &guard_field,
+		 gen_event_filter_check *guard_check,
+		 std::set<std::string> &guard_values);
+
 	// rulesets are arbitrary numbers and should be managed by the caller.
         // Note that rulesets are used to index into a std::vector so
         // specifying unnecessarily large rulesets will result in
@@ -51,6 +68,12 @@ public:
 	// their enabled status to enabled.
 	void enable(const std::string &substring, bool enabled, uint16_t ruleset = 0);
 
+	// Set the enabled status of the rule with exactly this name.
+	void enable_exact(const std::string &name, bool enabled, uint16_t ruleset = 0);
+
+	// Fill in the names of the rules enabled for the provided ruleset.
+	void enabled_rules(std::set<std::string> &names, uint16_t ruleset = 0);
+
 	// Find those rules that have a tag in the set of tags and set
 	// their enabled status to enabled. Note that the enabled
 	// status is on the rules, and not the tags--if a rule R has
@@ -67,19 +90,148 @@ public:
 	// Match all filters against the provided event.
 	bool run(gen_event *evt, uint32_t etag, uint16_t ruleset = 0);
 
+	// Match a batch of events, each with its own event tag,
+	// against the given ruleset. Fills in matched with the
+	// indexes of the events that matched a rule. The ruleset is
+	// only looked up once for the whole batch.
+	void run(gen_event **evts, const uint32_t *etags, size_t num_evts,
+		 uint16_t ruleset, std::vector<uint32_t> &matched);
+
 	// Populate the provided vector, indexed by event tag, of the
 	// event tags associated with the given ruleset id. For
 	// example, event_tags[10] = true would mean that this ruleset
 	// relates to event tag 10.
 	void event_tags_for_ruleset(std::vector<bool> &event_tags, uint16_t ruleset);
 
+	// Identical to above, but only for the rules with the
+	// provided names.
+	void event_tags_for_rules(const std::set<std::string> &names, std::vector<bool> &event_tags, uint16_t ruleset);
+
+	// Return the number of events passed to run() and the
+	// number of filters actually run against those events,
+	// across all rulesets. The ratio of the two shows how well
+	// the event tag and guard indexes narrow down candidates.
+	void get_dispatch_stats(uint64_t &num_events, uint64_t &num_filters_run);
+
+	// Return the number of events passed to run(). Can be called
+	// from any thread.
+	uint64_t num_events();
+
+	// Fill in, indexed by rule name, the number of events each
+	// rule's filter was evaluated against and matched, across all
+	// rulesets. Unlike rule_coverage_for_ruleset, this can be
+	// called from another thread while events are being run, as
+	// long as no rules are being added.
+	void get_rule_counts(std::map<std::string, std::pair<uint64_t, uint64_t>> &counts);
+
+	// Per-rule counts of how far events got for a given ruleset.
+	struct rule_coverage {
+		// Events whose event tag led to the rule
+		uint64_t num_reached;
+
+		// Events the rule's filter was actually run
+		// against. This can be lower than num_reached when
+		// a guard skipped the filter or an earlier rule
+		// already matched.
+		uint64_t num_evaluated;
+
+		// Events the rule's filter matched
+		uint64_t num_matched;
+
+		// Total time spent running the rule's filter. Only
+		// measured when rule timing is enabled.
+		uint64_t eval_time_ns;
+	};
+
+	// Enable/disable measuring the time spent running each
+	// filter, reported in rule_coverage.
+	void set_rule_timing(bool enabled);
+
+	// Fill in coverage, indexed by rule name, for all rules
+	// enabled in the given ruleset. Counts for evaluated/matched
+	// are cumulative across rulesets.
+	void rule_coverage_for_ruleset(std::map<std::string, rule_coverage> &coverage, uint16_t ruleset);
+
+	// Populate the provided vectors, indexed by event tag, with
+	// the number of events having that tag passed to run() for
+	// the given ruleset, and the number of those that matched a
+	// rule. Events with tags that no rule relates to are not
+	// counted.
+	void event_tag_coverage_for_ruleset(std::vector<uint64_t> &num_events,
+					    std::vector<uint64_t> &num_matched,
+					    uint16_t ruleset);
+
 private:
 
 	struct filter_wrapper {
 		gen_event_filter *filter;
 
+		// The order in which the filter was added. The
+		// filters for an event tag are kept in this order.
+		uint32_t index;
+
 		// Indexes from event tag to enabled/disabled.
 		std::vector<bool> event_tags;
+
+		// When non-NULL, the filter can only match events
+		// for which guard_check (a filtercheck for
+		// guard_field) extracts one of guard_values.
+		std::string guard_field;
+		gen_event_filter_check *guard_check;
+		std::set<std::string> guard_values;
+
+		// Coverage counters, updated by run()
+		atomic_counter num_evaluated;
+		atomic_counter num_matched;
+
+		bool timed;
+		uint64_t eval_time_ns;
+	};
+
+	// Run a single filter against the event, updating its
+	// coverage counters.
+	static bool run_filter(filter_wrapper *wrap, gen_event *evt);
+
+	// A secondary index over the filters for a single event
+	// tag. Filters are grouped by the field of their guard and
+	// then by guard value. Filters without a guard are always
+	// candidates.
+	class guard_index {
+	public:
+		guard_index(std::list<filter_wrapper *> &filters);
+		virtual ~guard_index();
+
+		// Run the candidate filters for this event, in the
+		// same order as they appear in the event tag's list
+		// of filters, stopping at the first match.
+		bool run(gen_event *evt, uint64_t &num_filters_run);
+
+	private:
+		struct guard_field {
+			// Used to extract the field value from events.
+			gen_event_filter_check *check;
+
+			// Maps from guard value to the (sorted)
+			// positions of the filters having that value.
+			std::unordered_map<std::string, std::vector<uint32_t>> positions;
+		};
+
+		struct cursor {
+			const std::vector<uint32_t> *positions;
+			size_t next;
+		};
+
+		// All filters, in event tag list order.
+		std::vector<filter_wrapper *> m_filters;
+
+		// Positions of filters without any guard.
+		std::vector<uint32_t> m_unguarded;
+
+		std::vector<guard_field> m_guard_fields;
+
+		// Scratch space reused for every event
+		std::vector<cursor> m_cursors;
+		std::string m_tstr;
 	};
 
 	// A group of filters all having the same ruleset
@@ -94,17 +246,40 @@ private:
 
 		uint64_t num_filters();
 
-		bool run(gen_event *evt, uint32_t etag);
+		bool run(gen_event *evt, uint32_t etag, uint64_t &num_filters_run);
 
 		void event_tags_for_ruleset(std::vector<bool> &event_tags);
 
+		// Whether the filter is enabled for the given event tag
+		bool has_filter(filter_wrapper *wrap, uint32_t etag);
+
+		void event_tag_coverage(std::vector<uint64_t> &num_events,
+					std::vector<uint64_t> &num_matched);
+
 	private:
+		// Drop the guard index for the given event tag. It
+		// will be rebuilt on the next call to run().
+		void invalidate_index(uint32_t etag);
+
 		uint64_t m_num_filters;
 
 		// Maps from event tag to a list of filters. There can
 		// be multiple filters for a given event tag.
 		std::vector<std::list<filter_wrapper *> *> m_filter_by_event_tag;
 
+		// Maps from event tag to a guard index built from the
+		// corresponding list above. NULL when not built yet,
+		// or when no filter for the event tag has a guard.
+		std::vector<guard_index *> m_index_by_event_tag;
+
+		// Whether the entry in m_index_by_event_tag is
+		// up-to-date with the list of filters.
+		std::vector<bool> m_index_valid;
+
+		// Maps from event tag to the number of events seen
+		// by run() and the number of those that matched.
+		std::vector<uint64_t> m_num_events_by_event_tag;
+		std::vector<uint64_t> m_num_matched_by_event_tag;
 	};
 
 	std::vector<ruleset_filters *> m_rulesets;
@@ -115,6 +290,11 @@ private:
 	// This holds all the filters passed to add(), so they can
 	// be cleaned up.
 	std::map<std::string,filter_wrapper *> m_filters;
+
+	atomic_counter m_num_events;
+	uint64_t m_num_filters_run;
+
+	bool m_rule_timing;
 };
 
 // falco_sinsp_ruleset is a specialization of falco_ruleset that
@@ -131,8 +311,20 @@ public:
 		 std::set<std::string> &tags,
 		 sinsp_filter* filter);
 
+	void add(std::string &name,
+		 std::set<uint32_t> &evttypes,
+		 std::set<uint32_t> &syscalls,
+		 std::set<std::string> &tags,
+		 sinsp_filter* filter,
+		 std::string &guard_field,
+		 gen_event_filter_check *guard_check,
+		 std::set<std::string> &guard_values);
+
 	bool run(sinsp_evt *evt, uint16_t ruleset = 0);
 
+	// The event tag used to match the event against rules
+	uint32_t event_tag(sinsp_evt *evt);
+
 	// Populate the provided vector, indexed by event type, of the
 	// event types associated with the given ruleset id. For
 	// example, evttypes[10] = true would mean that this ruleset
@@ -145,6 +337,16 @@ public:
 	// relates to syscall code 10.
 	void syscalls_for_ruleset(std::vector<bool> &syscalls, uint16_t ruleset);
 
+	// Populate the provided vectors, indexed by event type and by
+	// syscall code respectively, with the number of events passed
+	// to run() for the given ruleset and the number of those
+	// that matched a rule.
+	void evttype_coverage_for_ruleset(std::vector<uint64_t> &evttype_events,
+					  std::vector<uint64_t> &evttype_matched,
+					  std::vector<uint64_t> &syscall_events,
+					  std::vector<uint64_t> &syscall_matched,
+					  uint16_t ruleset);
+
 private:
 	uint32_t evttype_to_event_tag(uint32_t evttype);
 	uint32_t syscall_to_event_tag(uint32_t syscallid);
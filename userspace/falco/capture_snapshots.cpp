@@ -0,0 +1,390 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "capture_snapshots.h"
+#include "falco_common.h"
+#include "logger.h"
+
+using namespace std;
+
+const size_t capture_snapshots::block_size;
+
+// A tmpfs, so that opening a snapshot on the capture thread, which
+// writes the process and container tables, does no disk I/O
+static const string s_spool_dir = "/dev/shm";
+
+capture_snapshots::capture_snapshots(sinsp *inspector, const config &cfg)
+	: m_inspector(inspector),
+	  m_config(cfg),
+	  m_ring_bytes(0),
+	  m_stopping(false)
+{
+	m_thread = thread(&capture_snapshots::run, this);
+}
+
+capture_snapshots::~capture_snapshots()
+{
+	flush();
+}
+
+shared_ptr<capture_snapshots::block> capture_snapshots::new_block(size_t min_size)
+{
+	// Reuse a block dropped from the ring once no snapshot refers
+	// to it any more. The writer thread drops its references with
+	// a release decrement, the fence makes its reads of the block
+	// happen before the block is overwritten.
+	for(auto it = m_free_blocks.begin(); it != m_free_blocks.end(); ++it)
+	{
+		if(it->use_count() == 1 && (*it)->size >= min_size)
+		{
+			atomic_thread_fence(memory_order_acquire);
+			shared_ptr<block> b = *it;
+			m_free_blocks.erase(it);
+			b->used = 0;
+			return b;
+		}
+	}
+
+	shared_ptr<block> b = make_shared<block>();
+	b->size = max(min_size, block_size);
+	b->data.reset(new uint8_t[b->size]);
+	b->used = 0;
+	return b;
+}
+
+void capture_snapshots::add_event(sinsp_evt *evt)
+{
+	scap_evt *pevt = (evt->m_poriginal_evt ? evt->m_poriginal_evt : evt->m_pevt);
+	uint64_t ts = evt->get_ts();
+	size_t len = (sizeof(record) + pevt->len + 7) & ~((size_t) 7);
+
+	if(m_ring.empty() || m_ring.back()->size - m_ring.back()->used < len)
+	{
+		shared_ptr<block> b = new_block(len);
+		m_ring.push_back(b);
+		m_ring_bytes += b->size;
+
+		if(m_collecting)
+		{
+			m_collecting_blocks.push_back(b);
+		}
+	}
+
+	block &b = *m_ring.back();
+	record *rec = (record *) (b.data.get() + b.used);
+	rec->ts = ts;
+	rec->cpuid = evt->get_cpuid();
+	rec->pad = 0;
+	rec->len = pevt->len;
+	memcpy(rec + 1, pevt, pevt->len);
+	b.used += len;
+	b.last_ts = ts;
+
+	// Drop the oldest blocks, always keeping the one being filled
+	while(m_ring.size() > 1 &&
+	      (m_ring_bytes > m_config.max_bytes ||
+	       m_ring.front()->last_ts + m_config.pre_ns < ts))
+	{
+		m_ring_bytes -= m_ring.front()->size;
+		if(m_free_blocks.size() < 2)
+		{
+			m_free_blocks.push_back(m_ring.front());
+		}
+		m_ring.pop_front();
+	}
+
+	if(m_collecting && ts >= m_collecting->end_ts)
+	{
+		finish();
+	}
+}
+
+void capture_snapshots::trigger(const std::string &rule, uint64_t ts)
+{
+	if(m_collecting ||
+	   (!m_config.rules.empty() && m_config.rules.find(rule) == m_config.rules.end()))
+	{
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		if(m_pending.size() >= m_config.max_pending)
+		{
+			m_num_skipped.add();
+			return;
+		}
+	}
+
+	unique_ptr<snapshot> snap(new snapshot());
+	snap->rule = rule;
+	snap->filename = m_config.directory + "/falco-" + to_string(ts) + ".scap";
+	snap->start_ts = (ts > m_config.pre_ns ? ts - m_config.pre_ns : 0);
+	snap->end_ts = ts + m_config.post_ns;
+
+	// Open the snapshot now, so the process and container tables
+	// are the ones of the time of the alert, and the events
+	// before it refer to threads that existed then.
+	string spool = s_spool_dir + "/falco-snapshot-XXXXXX";
+	int fd = mkstemp(&spool[0]);
+	if(fd < 0)
+	{
+		falco_logger::log(LOG_ERR, "Could not create capture snapshot spool file in " + s_spool_dir + ": " + strerror(errno) + "\n");
+		m_num_skipped.add();
+		return;
+	}
+	close(fd);
+	snap->spool_filename = spool;
+
+	snap->dumper.reset(new sinsp_dumper(m_inspector));
+	try
+	{
+		snap->dumper->open(snap->spool_filename, m_config.compress, true);
+	}
+	catch(sinsp_exception &e)
+	{
+		falco_logger::log(LOG_ERR, "Could not open capture snapshot " + snap->spool_filename + ": " + e.what() + "\n");
+		unlink(snap->spool_filename.c_str());
+		m_num_skipped.add();
+		return;
+	}
+
+	m_collecting = move(snap);
+	m_collecting_blocks.assign(m_ring.begin(), m_ring.end());
+
+	if(m_config.post_ns == 0)
+	{
+		finish();
+	}
+}
+
+void capture_snapshots::finish()
+{
+	unique_ptr<snapshot> snap(move(m_collecting));
+
+	for(auto &b : m_collecting_blocks)
+	{
+		snap->blocks.push_back(make_pair(b, b->used));
+	}
+	m_collecting_blocks.clear();
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_pending.push_back(move(snap));
+	}
+	m_cv.notify_one();
+}
+
+void capture_snapshots::flush()
+{
+	if(!m_thread.joinable())
+	{
+		return;
+	}
+
+	if(m_collecting)
+	{
+		finish();
+	}
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_cv.notify_one();
+	m_thread.join();
+}
+
+uint64_t capture_snapshots::num_written()
+{
+	return m_num_written.get();
+}
+
+uint64_t capture_snapshots::num_skipped()
+{
+	return m_num_skipped.get();
+}
+
+void capture_snapshots::run()
+{
+	while(true)
+	{
+		unique_ptr<snapshot> snap;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cv.wait(lock, [this]() { return !m_pending.empty() || m_stopping; });
+
+			if(m_pending.empty())
+			{
+				// Stopping, with everything written
+				break;
+			}
+
+			snap = move(m_pending.front());
+		}
+
+		write(*snap);
+
+		// Only drop the snapshot from the queue once written, so
+		// that trigger() counts it against max_pending
+		lock_guard<mutex> lock(m_mutex);
+		m_pending.pop_front();
+	}
+}
+
+void capture_snapshots::write(snapshot &snap)
+{
+	sinsp_evt evt;
+	uint64_t num_events = 0;
+
+	try
+	{
+		for(auto &bp : snap.blocks)
+		{
+			uint8_t *data = bp.first->data.get();
+			size_t pos = 0;
+
+			while(pos < bp.second)
+			{
+				record *rec = (record *) (data + pos);
+				pos += (sizeof(record) + rec->len + 7) & ~((size_t) 7);
+
+				if(rec->ts < snap.start_ts || rec->ts > snap.end_ts)
+				{
+					continue;
+				}
+
+				evt.init((uint8_t *) (rec + 1), rec->cpuid);
+				snap.dumper->dump(&evt);
+				num_events++;
+			}
+		}
+
+		snap.dumper->close();
+	}
+	catch(sinsp_exception &e)
+	{
+		falco_logger::log(LOG_ERR, "Could not write capture snapshot " + snap.filename + ": " + e.what() + "\n");
+		m_num_skipped.add();
+		snap.dumper.reset();
+		snap.blocks.clear();
+		unlink(snap.spool_filename.c_str());
+		return;
+	}
+
+	snap.dumper.reset();
+	snap.blocks.clear();
+
+	try
+	{
+		move_to_directory(snap);
+	}
+	catch(falco_exception &e)
+	{
+		falco_logger::log(LOG_ERR, "Could not write capture snapshot " + snap.filename + ": " + e.what() + "\n");
+		m_num_skipped.add();
+		unlink(snap.spool_filename.c_str());
+		return;
+	}
+
+	falco_logger::log(LOG_INFO, "Wrote capture snapshot " + snap.filename + " for rule " + snap.rule +
+			  " (" + to_string(num_events) + " events)\n");
+	m_num_written.add();
+}
+
+void capture_snapshots::move_to_directory(snapshot &snap)
+{
+	if(rename(snap.spool_filename.c_str(), snap.filename.c_str()) == 0)
+	{
+		return;
+	}
+
+	if(errno != EXDEV)
+	{
+		throw falco_exception(strerror(errno));
+	}
+
+	// The spool is on another filesystem, so copy the file
+	int in = open(snap.spool_filename.c_str(), O_RDONLY);
+	if(in < 0)
+	{
+		throw falco_exception(strerror(errno));
+	}
+
+	int out = open(snap.filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(out < 0)
+	{
+		string err = strerror(errno);
+		close(in);
+		throw falco_exception(err);
+	}
+
+	char buf[64 * 1024];
+	string err;
+	ssize_t n;
+	while(err.empty() && (n = read(in, buf, sizeof(buf))) != 0)
+	{
+		if(n < 0)
+		{
+			if(errno != EINTR)
+			{
+				err = strerror(errno);
+			}
+			continue;
+		}
+
+		for(ssize_t off = 0; off < n; )
+		{
+			ssize_t w = ::write(out, buf + off, n - off);
+			if(w < 0)
+			{
+				if(errno != EINTR)
+				{
+					err = strerror(errno);
+					break;
+				}
+				continue;
+			}
+			off += w;
+		}
+	}
+
+	close(in);
+	if(close(out) != 0 && err.empty())
+	{
+		err = strerror(errno);
+	}
+
+	if(!err.empty())
+	{
+		unlink(snap.filename.c_str());
+		throw falco_exception(err);
+	}
+
+	unlink(snap.spool_filename.c_str());
+}
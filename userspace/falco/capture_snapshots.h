@@ -0,0 +1,166 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sinsp.h"
+
+#include "atomic_counter.h"
+
+// Keeps the most recent syscall events in an in-memory ring and,
+// when selected rules match, writes the events from shortly before
+// to shortly after the match to a .scap file. This gives the context
+// of an alert without writing every event to disk as -w does.
+//
+// The events are copied into large blocks, which are dropped from
+// the ring once they are older than the pre-alert window or the ring
+// is over its size limit. A snapshot keeps references to the blocks
+// it covers, so they stay alive until it has been written. When an
+// alert triggers a snapshot, the capture thread opens it in a file
+// in /dev/shm, which writes the process and container tables as
+// they are at that time, without disk I/O. A background thread then
+// writes the events and moves the file to its directory.
+class capture_snapshots
+{
+public:
+	struct config
+	{
+		// Where the files go, as
+		// <directory>/falco-<alert ts>.scap
+		std::string directory;
+
+		// The events kept before an alert, by age and by
+		// total size
+		uint64_t pre_ns;
+		uint64_t max_bytes;
+
+		// How long to keep collecting events after an alert
+		uint64_t post_ns;
+
+		// The rules triggering a snapshot. All rules if empty.
+		std::set<std::string> rules;
+
+		bool compress;
+
+		// The maximum number of snapshots waiting to be
+		// written. Alerts beyond that are not snapshotted.
+		uint32_t max_pending;
+	};
+
+	capture_snapshots(sinsp *inspector, const config &cfg);
+
+	virtual ~capture_snapshots();
+
+	// Called on the capture thread for every event, before it is
+	// filtered.
+	void add_event(sinsp_evt *evt);
+
+	// Called on the capture thread when rule matched an event
+	// with timestamp ts. Alerts while a snapshot is being
+	// collected are covered by that snapshot.
+	void trigger(const std::string &rule, uint64_t ts);
+
+	// Write the snapshot being collected, if any, and wait for
+	// all of them to be written. No events may be added after.
+	void flush();
+
+	uint64_t num_written();
+	uint64_t num_skipped();
+
+private:
+	// An event, as stored in a block
+	struct record
+	{
+		uint64_t ts;
+		uint16_t cpuid;
+		uint16_t pad;
+		uint32_t len;
+		// Followed by len bytes of scap event, padded to 8 bytes
+	};
+
+	struct block
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+		size_t used;
+		uint64_t last_ts;
+	};
+
+	struct snapshot
+	{
+		std::string rule;
+		std::string filename;
+
+		// Where the snapshot is written before it is moved
+		// to filename
+		std::string spool_filename;
+		uint64_t start_ts;
+		uint64_t end_ts;
+
+		// The blocks covering the snapshot, with the number of
+		// bytes of each to read. Only set when the snapshot is
+		// handed to the writer, as the last block is still
+		// being filled until then.
+		std::vector<std::pair<std::shared_ptr<block>, size_t>> blocks;
+
+		std::unique_ptr<sinsp_dumper> dumper;
+	};
+
+	std::shared_ptr<block> new_block(size_t min_size);
+
+	// Hand the snapshot being collected to the writer thread
+	void finish();
+
+	void run();
+	void write(snapshot &snap);
+
+	// Move the spool file of snap to its filename
+	void move_to_directory(snapshot &snap);
+
+	static const size_t block_size = 1024 * 1024;
+
+	sinsp *m_inspector;
+	config m_config;
+
+	// Only used by the capture thread
+	std::deque<std::shared_ptr<block>> m_ring;
+	size_t m_ring_bytes;
+	std::vector<std::shared_ptr<block>> m_free_blocks;
+	std::unique_ptr<snapshot> m_collecting;
+	std::vector<std::shared_ptr<block>> m_collecting_blocks;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::unique_ptr<snapshot>> m_pending;
+	bool m_stopping;
+	std::thread m_thread;
+
+	atomic_counter m_num_written;
+	atomic_counter m_num_skipped;
+};
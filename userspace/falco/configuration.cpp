@@ -18,6 +18,7 @@ limitations under the License.
 */
 
 #include <algorithm>
+#include <cstdlib>
 
 #include <dirent.h>
 #include <sys/types.h>
@@ -32,10 +33,23 @@ using namespace std;
 falco_configuration::falco_configuration()
 	: m_buffered_outputs(false),
 	  m_time_format_iso_8601(false),
+	  m_syslog_native(false),
 	  m_webserver_enabled(false),
 	  m_webserver_listen_port(8765),
 	  m_webserver_k8s_audit_endpoint("/k8s_audit"),
+	  m_webserver_k8s_audit_lazy_parse(false),
+	  m_webserver_k8s_audit_workers(1),
+	  m_webserver_metrics_endpoint("/metrics"),
 	  m_webserver_ssl_enabled(false),
+	  m_sampling_k8s_audit(-1),
+	  m_k8s_audit_prefilter_dedupe(false),
+	  m_k8s_audit_prefilter_dedupe_window(10000),
+	  m_capture_snapshots_enabled(false),
+	  m_capture_snapshots_pre_secs(10),
+	  m_capture_snapshots_post_secs(5),
+	  m_capture_snapshots_max_mb(100),
+	  m_capture_snapshots_max_pending(2),
+	  m_capture_snapshots_compress(true),
 	  m_config(NULL)
 {
 }
@@ -97,6 +111,7 @@ void falco_configuration::init(string conf_filename, list<string> &cmdline_optio
 		keep_alive = m_config->get_scalar<string>("file_output", "keep_alive", "");
 		file_output.options["keep_alive"] = keep_alive;
 
+		read_output_limits("file_output", file_output);
 		m_outputs.push_back(file_output);
 	}
 
@@ -104,6 +119,7 @@ void falco_configuration::init(string conf_filename, list<string> &cmdline_optio
 	stdout_output.name = "stdout";
 	if (m_config->get_scalar<bool>("stdout_output", "enabled", false))
 	{
+		read_output_limits("stdout_output", stdout_output);
 		m_outputs.push_back(stdout_output);
 	}
 
@@ -111,6 +127,7 @@ void falco_configuration::init(string conf_filename, list<string> &cmdline_optio
 	syslog_output.name = "syslog";
 	if (m_config->get_scalar<bool>("syslog_output", "enabled", false))
 	{
+		read_output_limits("syslog_output", syslog_output);
 		m_outputs.push_back(syslog_output);
 	}
 
@@ -129,6 +146,7 @@ void falco_configuration::init(string conf_filename, list<string> &cmdline_optio
 		keep_alive = m_config->get_scalar<string>("program_output", "keep_alive", "");
 		program_output.options["keep_alive"] = keep_alive;
 
+		read_output_limits("program_output", program_output);
 		m_outputs.push_back(program_output);
 	}
 
@@ -145,6 +163,7 @@ void falco_configuration::init(string conf_filename, list<string> &cmdline_optio
 		}
 		http_output.options["url"] = url;
 
+		read_output_limits("http_output", http_output);
 		m_outputs.push_back(http_output);
 	}
 
@@ -179,9 +198,15 @@ void falco_configuration::init(string conf_filename, list<string> &cmdline_optio
 	falco_logger::log_stderr = m_config->get_scalar<bool>("log_stderr", false);
 	falco_logger::log_syslog = m_config->get_scalar<bool>("log_syslog", true);
 
+	m_syslog_native = m_config->get_scalar<bool>("syslog", "native", false);
+	m_syslog_socket = m_config->get_scalar<string>("syslog", "socket", "/dev/log");
+
 	m_webserver_enabled = m_config->get_scalar<bool>("webserver", "enabled", false);
 	m_webserver_listen_port = m_config->get_scalar<uint32_t>("webserver", "listen_port", 8765);
 	m_webserver_k8s_audit_endpoint = m_config->get_scalar<string>("webserver", "k8s_audit_endpoint", "/k8s_audit");
+	m_webserver_k8s_audit_lazy_parse = m_config->get_scalar<bool>("webserver", "k8s_audit_lazy_parse", false);
+	m_webserver_k8s_audit_workers = m_config->get_scalar<uint32_t>("webserver", "k8s_audit_workers", 1);
+	m_webserver_metrics_endpoint = m_config->get_scalar<string>("webserver", "metrics_endpoint", "/metrics");
 	m_webserver_ssl_enabled = m_config->get_scalar<bool>("webserver", "ssl_enabled", false);
 	m_webserver_ssl_certificate = m_config->get_scalar<string>("webserver", "ssl_certificate","/etc/falco/falco.pem");
 
@@ -221,6 +246,90 @@ void falco_configuration::init(string conf_filename, list<string> &cmdline_optio
 	m_syscall_evt_drop_max_burst = m_config->get_scalar<double>("syscall_event_drops", "max_burst", 10);
 
 	m_syscall_evt_simulate_drops = m_config->get_scalar<bool>("syscall_event_drops", "simulate_drops", false);
+
+	m_syscall_evt_load_shedding = m_config->get_scalar<bool>("syscall_event_drops", "load_shedding", false);
+	m_syscall_evt_load_shedding_recovery_secs = m_config->get_scalar<uint32_t>("syscall_event_drops", "load_shedding_recovery_secs", 30);
+
+	string shedding_priority = m_config->get_scalar<string>("syscall_event_drops", "load_shedding_max_priority", "notice");
+
+	auto shedding_comp = [shedding_priority] (string &s) {
+		return (strcasecmp(s.c_str(), shedding_priority.c_str()) == 0);
+	};
+
+	if((it = std::find_if(falco_common::priority_names.begin(), falco_common::priority_names.end(), shedding_comp)) == falco_common::priority_names.end())
+	{
+		throw invalid_argument("Unknown load_shedding_max_priority \"" + shedding_priority + "\"--must be one of emergency, alert, critical, error, warning, notice, informational, debug");
+	}
+	m_syscall_evt_load_shedding_max_priority = (falco_common::priority_type) (it - falco_common::priority_names.begin());
+
+	m_sampling_k8s_audit = m_config->get_scalar<double>("sampling", "k8s_audit", -1);
+	if(m_sampling_k8s_audit > 1)
+	{
+		throw invalid_argument("Error reading config file (" + m_config_file + "): sampling k8s_audit must be between 0 and 1");
+	}
+
+	std::list<string> sampling_evttypes;
+	m_config->get_sequence(sampling_evttypes, "sampling", "evttypes");
+
+	for(std::string &spec : sampling_evttypes)
+	{
+		size_t colon = spec.rfind(':');
+		char *end = NULL;
+		double fraction = -1;
+
+		if(colon != string::npos)
+		{
+			fraction = strtod(spec.c_str() + colon + 1, &end);
+		}
+
+		if(colon == string::npos || colon == 0 || *end != '\0' || fraction < 0 || fraction > 1)
+		{
+			throw invalid_argument("Error reading config file (" + m_config_file + "): sampling evttype " + spec + " must be <event type>:<fraction between 0 and 1>");
+		}
+
+		m_sampling_evttypes[spec.substr(0, colon)] = fraction;
+	}
+
+	m_config->get_sequence(m_k8s_audit_prefilter_stages, "k8s_audit_prefilter", "stages");
+	m_config->get_sequence(m_k8s_audit_prefilter_verbs, "k8s_audit_prefilter", "verbs");
+	m_config->get_sequence(m_k8s_audit_prefilter_users, "k8s_audit_prefilter", "users");
+	m_config->get_sequence(m_k8s_audit_prefilter_resources, "k8s_audit_prefilter", "resources");
+	m_k8s_audit_prefilter_dedupe = m_config->get_scalar<bool>("k8s_audit_prefilter", "dedupe_audit_ids", false);
+	m_k8s_audit_prefilter_dedupe_window = m_config->get_scalar<uint32_t>("k8s_audit_prefilter", "dedupe_window", 10000);
+	m_k8s_audit_prefilter_dedupe_keep_stage = m_config->get_scalar<string>("k8s_audit_prefilter", "dedupe_keep_stage", "");
+
+	m_capture_snapshots_enabled = m_config->get_scalar<bool>("capture_snapshots", "enabled", false);
+	m_capture_snapshots_directory = m_config->get_scalar<string>("capture_snapshots", "directory", "/var/lib/falco/snapshots");
+	m_capture_snapshots_pre_secs = m_config->get_scalar<uint32_t>("capture_snapshots", "pre_secs", 10);
+	m_capture_snapshots_post_secs = m_config->get_scalar<uint32_t>("capture_snapshots", "post_secs", 5);
+	m_capture_snapshots_max_mb = m_config->get_scalar<uint32_t>("capture_snapshots", "max_mb", 100);
+	m_capture_snapshots_max_pending = m_config->get_scalar<uint32_t>("capture_snapshots", "max_pending", 2);
+	m_capture_snapshots_compress = m_config->get_scalar<bool>("capture_snapshots", "compress", true);
+	m_config->get_sequence(m_capture_snapshots_rules, "capture_snapshots", "rules");
+
+	if(m_capture_snapshots_enabled && m_capture_snapshots_max_mb == 0)
+	{
+		throw invalid_argument("Error reading config file (" + m_config_file + "): capture_snapshots.max_mb must be greater than 0");
+	}
+}
+
+void falco_configuration::read_output_limits(const string &key, falco_outputs::output_config &oc)
+{
+	string priority = m_config->get_scalar<string>(key, "min_priority", "debug");
+
+	auto comp = [priority] (string &s) {
+		return (strcasecmp(s.c_str(), priority.c_str()) == 0);
+	};
+
+	auto it = std::find_if(falco_common::priority_names.begin(), falco_common::priority_names.end(), comp);
+	if(it == falco_common::priority_names.end())
+	{
+		throw invalid_argument("Unknown " + key + ".min_priority \"" + priority + "\"--must be one of emergency, alert, critical, error, warning, notice, informational, debug");
+	}
+	oc.min_priority = (falco_common::priority_type) (it - falco_common::priority_names.begin());
+
+	oc.rate = m_config->get_scalar<uint32_t>(key, "rate", 0);
+	oc.max_burst = m_config->get_scalar<uint32_t>(key, "max_burst", 1000);
 }
 
 void falco_configuration::read_rules_file_directory(const string &path, list<string> &rules_filenames)
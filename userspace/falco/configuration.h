@@ -26,7 +26,9 @@ limitations under the License.
 #include <string>
 #include <vector>
 #include <list>
+#include <map>
 #include <set>
+#include <unordered_set>
 #include <iostream>
 
 #include "event_drops.h"
@@ -207,15 +209,51 @@ class falco_configuration
 	bool m_buffered_outputs;
 	bool m_time_format_iso_8601;
 
+	bool m_syslog_native;
+	std::string m_syslog_socket;
+
 	bool m_webserver_enabled;
 	uint32_t m_webserver_listen_port;
 	std::string m_webserver_k8s_audit_endpoint;
+	bool m_webserver_k8s_audit_lazy_parse;
+	uint32_t m_webserver_k8s_audit_workers;
+	std::string m_webserver_metrics_endpoint;
 	bool m_webserver_ssl_enabled;
 	std::string m_webserver_ssl_certificate;
 	std::set<syscall_evt_drop_mgr::action> m_syscall_evt_drop_actions;
 	double m_syscall_evt_drop_rate;
 	double m_syscall_evt_drop_max_burst;
 
+	bool m_syscall_evt_load_shedding;
+	falco_common::priority_type m_syscall_evt_load_shedding_max_priority;
+	uint32_t m_syscall_evt_load_shedding_recovery_secs;
+
+	// Fraction of events to keep, by event type name. A negative
+	// k8s audit fraction leaves k8s audit events alone.
+	std::map<std::string, double> m_sampling_evttypes;
+	double m_sampling_k8s_audit;
+
+	// Values of k8s audit event fields to keep before parsing the
+	// events. Empty sets keep all events.
+	std::unordered_set<std::string> m_k8s_audit_prefilter_stages;
+	std::unordered_set<std::string> m_k8s_audit_prefilter_verbs;
+	std::unordered_set<std::string> m_k8s_audit_prefilter_users;
+	std::unordered_set<std::string> m_k8s_audit_prefilter_resources;
+	bool m_k8s_audit_prefilter_dedupe;
+	uint32_t m_k8s_audit_prefilter_dedupe_window;
+	std::string m_k8s_audit_prefilter_dedupe_keep_stage;
+
+	// Capture snapshots written around alerts of the given rules
+	// (all rules if empty)
+	bool m_capture_snapshots_enabled;
+	std::string m_capture_snapshots_directory;
+	uint32_t m_capture_snapshots_pre_secs;
+	uint32_t m_capture_snapshots_post_secs;
+	uint32_t m_capture_snapshots_max_mb;
+	uint32_t m_capture_snapshots_max_pending;
+	bool m_capture_snapshots_compress;
+	std::set<std::string> m_capture_snapshots_rules;
+
 	// Only used for testing
 	bool m_syscall_evt_simulate_drops;
 
@@ -231,6 +269,10 @@ class falco_configuration
 	 */
 	void set_cmdline_option(const std::string &spec);
 
+	// Read the min_priority, rate and max_burst options of the
+	// output configured under key.
+	void read_output_limits(const std::string &key, falco_outputs::output_config &oc);
+
 	yaml_configuration* m_config;
 };
 
@@ -17,16 +17,22 @@ limitations under the License.
 
 */
 
+#include <string.h>
+
 #include "event_drops.h"
 
 syscall_evt_drop_mgr::syscall_evt_drop_mgr()
-	: m_num_syscall_evt_drops(0),
-	  m_num_actions(0),
-	  m_inspector(NULL),
+	: m_inspector(NULL),
 	  m_outputs(NULL),
 	  m_next_check_ts(0),
-	  m_simulate_drops(false)
+	  m_simulate_drops(false),
+	  m_shedding_engine(NULL),
+	  m_shedding_max_priority(falco_common::PRIORITY_DEBUG),
+	  m_shedding_recovery_secs(0),
+	  m_shed_priority(falco_common::PRIORITY_DEBUG),
+	  m_secs_without_drops(0)
 {
+	m_shed_priority_metric.set(m_shed_priority);
 }
 
 syscall_evt_drop_mgr::~syscall_evt_drop_mgr()
@@ -50,6 +56,15 @@ void syscall_evt_drop_mgr::init(sinsp *inspector,
 	m_simulate_drops = simulate_drops;
 }
 
+void syscall_evt_drop_mgr::set_load_shedding(falco_engine *engine,
+					     falco_common::priority_type max_priority,
+					     uint32_t recovery_secs)
+{
+	m_shedding_engine = engine;
+	m_shedding_max_priority = max_priority;
+	m_shedding_recovery_secs = recovery_secs;
+}
+
 bool syscall_evt_drop_mgr::process_event(sinsp *inspector, sinsp_evt *evt)
 {
 	if(m_next_check_ts == 0)
@@ -76,21 +91,33 @@ bool syscall_evt_drop_mgr::process_event(sinsp *inspector, sinsp_evt *evt)
 
 		m_last_stats = stats;
 
+		m_num_driver_evts.set(stats.n_evts);
+		m_num_driver_drops.set(stats.n_drops);
+		m_num_driver_drops_buffer.set(stats.n_drops_buffer);
+		m_num_driver_drops_pf.set(stats.n_drops_pf);
+		m_num_driver_drops_bug.set(stats.n_drops_bug);
+		m_num_driver_preemptions.set(stats.n_preemptions);
+
 		if(m_simulate_drops)
 		{
 			falco_logger::log(LOG_INFO, "Simulating syscall event drop");
 			delta.n_drops++;
 		}
 
+		if(m_shedding_engine)
+		{
+			update_shedding(evt->get_ts(), delta.n_drops > 0);
+		}
+
 		if(delta.n_drops > 0)
 		{
-			m_num_syscall_evt_drops++;
+			m_num_syscall_evt_drops.inc();
 
 			// There were new drops in the last second. If
 			// the token bucket allows, perform actions.
 			if(m_bucket.claim(1, evt->get_ts()))
 			{
-				m_num_actions++;
+				m_num_actions.inc();
 
 				return perform_actions(evt->get_ts(), delta, inspector->is_bpf_enabled());
 			}
@@ -107,14 +134,43 @@ bool syscall_evt_drop_mgr::process_event(sinsp *inspector, sinsp_evt *evt)
 void syscall_evt_drop_mgr::print_stats()
 {
 	fprintf(stderr, "Syscall event drop monitoring:\n");
-	fprintf(stderr, "   - event drop detected: %lu occurrences\n", m_num_syscall_evt_drops);
-	fprintf(stderr, "   - num times actions taken: %lu\n", m_num_actions);
+	fprintf(stderr, "   - event drop detected: %lu occurrences\n", m_num_syscall_evt_drops.get());
+	fprintf(stderr, "   - num times actions taken: %lu\n", m_num_actions.get());
+}
+
+void syscall_evt_drop_mgr::get_counts(uint64_t &num_drop_occurrences,
+				      uint64_t &num_actions,
+				      uint64_t &num_driver_evts,
+				      std::map<std::string, uint64_t> &num_driver_drops)
+{
+	num_drop_occurrences = m_num_syscall_evt_drops.get();
+	num_actions = m_num_actions.get();
+	num_driver_evts = m_num_driver_evts.get();
+
+	num_driver_drops["buffer"] = m_num_driver_drops_buffer.get();
+	num_driver_drops["page_fault"] = m_num_driver_drops_pf.get();
+	num_driver_drops["bug"] = m_num_driver_drops_bug.get();
+}
+
+void syscall_evt_drop_mgr::get_driver_stats(scap_stats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+
+	stats.n_evts = m_num_driver_evts.get();
+	stats.n_drops = m_num_driver_drops.get();
+	stats.n_drops_buffer = m_num_driver_drops_buffer.get();
+	stats.n_drops_pf = m_num_driver_drops_pf.get();
+	stats.n_drops_bug = m_num_driver_drops_bug.get();
+	stats.n_preemptions = m_num_driver_preemptions.get();
 }
 
 bool syscall_evt_drop_mgr::perform_actions(uint64_t now, scap_stats &delta, bool bpf_enabled)
 {
 	std::string rule = "Falco internal: syscall event drop";
-	std::string msg = rule + ". " + std::to_string(delta.n_drops) + " system calls dropped in last second.";
+	std::string msg = rule + ". " + std::to_string(delta.n_drops) + " system calls dropped in last second" +
+		" (buffer full: " + std::to_string(delta.n_drops_buffer) +
+		", page faults: " + std::to_string(delta.n_drops_pf) +
+		", driver bugs: " + std::to_string(delta.n_drops_bug) + ").";
 
 	std::map<std::string,std::string> output_fields;
 
@@ -123,6 +179,7 @@ bool syscall_evt_drop_mgr::perform_actions(uint64_t now, scap_stats &delta, bool
 	output_fields["n_drops_buffer"] = std::to_string(delta.n_drops_buffer);
 	output_fields["n_drops_pf"] = std::to_string(delta.n_drops_pf);
 	output_fields["n_drops_bug"] = std::to_string(delta.n_drops_bug);
+	output_fields["n_preemptions"] = std::to_string(delta.n_preemptions);
 	output_fields["ebpf_enabled"] = std::to_string(bpf_enabled);
 	bool should_exit = false;
 
@@ -164,3 +221,83 @@ bool syscall_evt_drop_mgr::perform_actions(uint64_t now, scap_stats &delta, bool
 
 	return true;
 }
+
+void syscall_evt_drop_mgr::update_shedding(uint64_t now, bool drops)
+{
+	if(drops)
+	{
+		m_secs_without_drops = 0;
+
+		// Priorities are ordered from most (0) to least
+		// severe, so shedding one more level means lowering
+		// m_shed_priority. Shedding goes up to and including
+		// the rules with m_shedding_max_priority, but never
+		// the emergency rules.
+		if(m_shed_priority >= m_shedding_max_priority &&
+		   m_shed_priority > falco_common::PRIORITY_EMERGENCY)
+		{
+			shed_rules(now, (falco_common::priority_type) (m_shed_priority - 1),
+				   "system calls dropped in last second");
+		}
+	}
+	else if(m_shed_priority < falco_common::PRIORITY_DEBUG)
+	{
+		if(++m_secs_without_drops >= m_shedding_recovery_secs)
+		{
+			m_secs_without_drops = 0;
+
+			shed_rules(now, (falco_common::priority_type) (m_shed_priority + 1),
+				   "no system calls dropped in last " + std::to_string(m_shedding_recovery_secs) + " seconds");
+		}
+	}
+}
+
+void syscall_evt_drop_mgr::shed_rules(uint64_t now, falco_common::priority_type priority, const std::string &reason)
+{
+	std::set<std::string> shed;
+	bool shedding = (priority < m_shed_priority);
+
+	m_shedding_engine->shed_rules(priority, shed);
+	m_shed_priority = priority;
+
+	if(shedding)
+	{
+		m_num_shed.inc();
+	}
+	else
+	{
+		m_num_restored.inc();
+	}
+	m_num_rules_shed.set(shed.size());
+	m_shed_priority_metric.set(priority);
+
+	std::string rule = "Falco internal: load shedding";
+	std::string msg = rule + ". " + reason + ", " +
+		(shedding ? "disabling" : "enabling") + " rules with priority " +
+		falco_common::priority_names[shedding ? m_shed_priority + 1 : m_shed_priority] +
+		". " + std::to_string(shed.size()) + " rules disabled.";
+
+	std::map<std::string,std::string> output_fields;
+	output_fields["action"] = (shedding ? "shed" : "restore");
+	output_fields["priority"] = falco_common::priority_names[shedding ? m_shed_priority + 1 : m_shed_priority];
+	output_fields["num_rules_shed"] = std::to_string(shed.size());
+
+	falco_logger::log(LOG_WARNING, msg);
+
+	m_outputs->handle_msg(now,
+			      falco_common::PRIORITY_WARNING,
+			      msg,
+			      rule,
+			      output_fields);
+}
+
+void syscall_evt_drop_mgr::get_shedding_counts(uint64_t &num_shed,
+					       uint64_t &num_restored,
+					       uint64_t &num_rules_shed,
+					       falco_common::priority_type &priority)
+{
+	num_shed = m_num_shed.get();
+	num_restored = m_num_restored.get();
+	num_rules_shed = m_num_rules_shed.get();
+	priority = (falco_common::priority_type) m_shed_priority_metric.get();
+}
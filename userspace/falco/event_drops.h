@@ -19,9 +19,11 @@ limitations under the License.
 #pragma once
 
 #include <set>
+#include <map>
 
 #include <sinsp.h>
 #include <token_bucket.h>
+#include <atomic_counter.h>
 
 #include "logger.h"
 #include "falco_outputs.h"
@@ -50,6 +52,18 @@ public:
 		  double max_tokens,
 		  bool simulate_drops);
 
+	// Enable adaptive load shedding. Each second in which the
+	// driver dropped events, the syscall rules at the next
+	// (more severe) priority level are disabled, starting with
+	// Debug rules and up to and including max_priority.
+	// Emergency rules are never disabled. After recovery_secs
+	// seconds in a row without drops, the last level shed is
+	// enabled again. Every change is logged, sent to the
+	// outputs as an alert and counted in the metrics.
+	void set_load_shedding(falco_engine *engine,
+			       falco_common::priority_type max_priority,
+			       uint32_t recovery_secs);
+
 	// Call this for every event. The class will take care of
 	// periodically measuring the scap stats, looking for syscall
 	// event drops, and performing any actions.
@@ -59,13 +73,52 @@ public:
 
 	void print_stats();
 
+	// Fill in the number of times drops were detected and
+	// actions were taken, and the driver's total number of events
+	// and of drops by reason, as of the last check. Can be called
+	// from any thread.
+	void get_counts(uint64_t &num_drop_occurrences,
+			uint64_t &num_actions,
+			uint64_t &num_driver_evts,
+			std::map<std::string, uint64_t> &num_driver_drops);
+
+	// Fill in the driver's counters (events, drops, drops by
+	// reason, preemptions) as of the last check, which happens
+	// about once a second. Can be called from any thread, unlike
+	// sinsp::get_capture_stats.
+	void get_driver_stats(scap_stats &stats);
+
+	// Fill in the number of times rules were shed and restored,
+	// the number of rules currently shed, and the least severe
+	// priority of the rules still enabled. Can be called from any
+	// thread.
+	void get_shedding_counts(uint64_t &num_shed,
+				 uint64_t &num_restored,
+				 uint64_t &num_rules_shed,
+				 falco_common::priority_type &priority);
+
 protected:
 
 	// Perform all configured actions.
 	bool perform_actions(uint64_t now, scap_stats &delta, bool bpf_enabled);
 
-	uint64_t m_num_syscall_evt_drops;
-	uint64_t m_num_actions;
+	// Called once a second with whether there were drops, to
+	// shed or restore rules.
+	void update_shedding(uint64_t now, bool drops);
+
+	// Shed all rules less severe than priority, and report it.
+	void shed_rules(uint64_t now, falco_common::priority_type priority, const std::string &reason);
+
+	atomic_counter m_num_syscall_evt_drops;
+	atomic_counter m_num_actions;
+
+	// Copies of the driver stats read in process_event()
+	atomic_counter m_num_driver_evts;
+	atomic_counter m_num_driver_drops;
+	atomic_counter m_num_driver_drops_buffer;
+	atomic_counter m_num_driver_drops_pf;
+	atomic_counter m_num_driver_drops_bug;
+	atomic_counter m_num_driver_preemptions;
 	sinsp *m_inspector;
 	falco_outputs *m_outputs;
 	std::set<action> m_actions;
@@ -73,6 +126,19 @@ protected:
 	uint64_t m_next_check_ts;
 	scap_stats m_last_stats;
 	bool m_simulate_drops;
+
+	// Load shedding state. Rules with a priority less severe
+	// than m_shed_priority are currently disabled.
+	falco_engine *m_shedding_engine;
+	falco_common::priority_type m_shedding_max_priority;
+	uint32_t m_shedding_recovery_secs;
+	falco_common::priority_type m_shed_priority;
+	uint32_t m_secs_without_drops;
+
+	atomic_counter m_num_shed;
+	atomic_counter m_num_restored;
+	atomic_counter m_num_rules_shed;
+	atomic_counter m_shed_priority_metric;
 };
 
 
@@ -27,6 +27,7 @@ limitations under the License.
 #include <algorithm>
 #include <string>
 #include <functional>
+#include <chrono>
 #include <signal.h>
 #include <fcntl.h>
 #include <sys/utsname.h>
@@ -47,6 +48,8 @@ limitations under the License.
 #include "config_falco.h"
 #include "statsfilewriter.h"
 #include "webserver.h"
+#include "k8s_audit_replay.h"
+#include "capture_snapshots.h"
 
 typedef function<void(sinsp* inspector)> open_t;
 
@@ -84,7 +87,8 @@ static void usage()
 	   "Options:\n"
 	   " -h, --help                    Print this page\n"
 	   " -c                            Configuration file (default " FALCO_SOURCE_CONF_FILE ", " FALCO_INSTALL_CONF_FILE ")\n"
-	   " -A                            Monitor all events, including those with EF_DROP_FALCO flag.\n"
+	   " -A                            Monitor all events, including those with EF_DROP_FALCO flag\n"
+	   "                               and those not used by any enabled rule.\n"
 	   " -b, --print-base64            Print data buffers in base64.\n"
 	   "                               This is useful for encoding binary data that needs to be used over media designed to.\n"
 	   " --cri <path>                  Path to CRI socket for container metadata.\n"
@@ -95,6 +99,10 @@ static void usage()
 	   "                               Available event sources are: syscall, k8s_audit.\n"
 	   "                               It can be passed multiple times.\n"
 	   "                               Can not disable both the event sources.\n"
+	   " --disable-condition-reordering\n"
+	   "                               Evaluate rule conditions in the order they are written, instead of running\n"
+	   "                               cheap, selective checks first. Useful to compare rule evaluation times with\n"
+	   "                               --rule-coverage.\n"
 	   " -D <substring>                Disable any rules with names having the substring <substring>. Can be specified multiple times.\n"
 	   "                               Can not be specified with -t.\n"
 	   " -e <events_file>              Read the events from <events_file> (in .scap format for sinsp events, or jsonl for\n"
@@ -112,6 +120,10 @@ static void usage()
 	   "                               for this option, it will be interpreted as the name of a file containing bearer token.\n"
 	   "                               Note that the format of this command-line option prohibits use of files whose names contain\n"
 	   "                               ':' or '#' characters in the file name.\n"
+	   " --k8s-audit-replay-threads <num>\n"
+	   "                               When reading k8s audit events from a file with -e, parse the events on <num>\n"
+	   "                               threads. Events are still run through the rules, and alerts output, in file\n"
+	   "                               order. Defaults to one thread per cpu.\n"
 	   " -L                            Show the name and description of all rules and exit.\n"
 	   " -l <rule>                     Show the name and description of the rule with name <rule> and exit.\n"
 	   " --list [<source>]             List all defined fields. If <source> is provided, only list those fields for\n"
@@ -135,6 +147,11 @@ static void usage()
 	   " -P, --pidfile <pid_file>      When run as a daemon, write pid to specified file\n"
        " -r <rules_file>               Rules file/directory (defaults to value set in configuration file, or /etc/falco_rules.yaml).\n"
        "                               Can be specified multiple times to read from multiple files/directories.\n"
+	   " --rule-coverage <file>        When used with -e, write to <file> a json object with, for each enabled rule\n"
+	   "                               and each macro, the number of events that reached, were evaluated by and\n"
+	   "                               matched it, and for each event type/syscall used by the rules, the number of\n"
+	   "                               events seen and matched. Useful to find rules that never fire.\n"
+	   "                               Also measures the time spent evaluating each rule.\n"
 	   " -s <stats_file>               If specified, write statistics related to falco's reading/processing of events\n"
 	   "                               to this file. (Only useful in live mode).\n"
 	   " --stats_interval <msec>       When using -s <stats_file>, write statistics every <msec> ms.\n"
@@ -178,42 +195,126 @@ static void display_fatal_err(const string &msg)
 // Splitting into key=value or key.subkey=value will be handled by configuration class.
 std::list<string> cmdline_options;
 
-// Read a jsonl file containing k8s audit events and pass each to the engine.
+// Read a jsonl file containing k8s audit events and pass each to the
+// engine, parsing the events on num_threads threads.
 void read_k8s_audit_trace_file(falco_engine *engine,
 			       falco_outputs *outputs,
-			       string &trace_filename)
+			       string &trace_filename,
+			       uint32_t num_threads,
+			       k8s_audit_shards *shards)
 {
-	ifstream ifs(trace_filename);
+	k8s_audit_replay replay(engine, outputs, num_threads, shards);
 
-	uint64_t line_num = 0;
+	auto start = std::chrono::steady_clock::now();
 
-	while(ifs)
-	{
-		string line, errstr;
+	uint64_t num_evts = replay.replay(trace_filename);
+
+	double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	fprintf(stderr, "Elapsed time: %.3lf, K8s Audit Events: %" PRIu64 ", %.2lf eps\n",
+		duration,
+		num_evts,
+		(duration > 0 ? num_evts / duration : 0));
+}
+
+static std::string read_file(std::string filename)
+{
+	std::ifstream t(filename);
+	std::string str((std::istreambuf_iterator<char>(t)),
+			std::istreambuf_iterator<char>());
+
+	return str;
+}
+
+//
+// Tell the driver to stop sending event types that no enabled rule
+// can match. Event types that sinsp needs to maintain its thread and
+// fd tables, as well as internal/meta events, are always kept. The
+// generic event is kept if any rule refers to a syscall by
+// name. Returns the number of event types that were masked out.
+//
+static uint32_t set_driver_eventmask(falco_engine *engine, sinsp *inspector)
+{
+	vector<bool> evttypes;
+	vector<bool> syscalls;
+	uint32_t num_masked = 0;
+
+	engine->evttypes_for_ruleset(evttypes);
+	engine->syscalls_for_ruleset(syscalls);
 
-		getline(ifs, line);
-		line_num++;
+	bool need_generic = (find(syscalls.begin(), syscalls.end(), true) != syscalls.end());
 
-		if(line == "")
+	const struct ppm_event_info *etable = inspector->get_event_info_tables()->m_event_info;
+
+	for(uint32_t j = 0; j < PPM_EVENT_MAX; j++)
+	{
+		if(evttypes[j] ||
+		   (etable[j].flags & (EF_CREATES_FD | EF_DESTROYS_FD | EF_MODIFIES_STATE)) ||
+		   (etable[j].category & (EC_INTERNAL | EC_METAEVENT)) ||
+		   (need_generic && (j == PPME_GENERIC_E || j == PPME_GENERIC_X)))
 		{
 			continue;
 		}
 
-		if(!k8s_audit_handler::accept_data(engine, outputs, line, errstr))
+		inspector->unset_eventmask(j);
+		num_masked++;
+	}
+
+	return num_masked;
+}
+
+//
+// Apply the per event type sampling from the config file
+//
+static void set_event_sampling(falco_engine *engine, sinsp *inspector, falco_configuration &config)
+{
+	const struct ppm_event_info *etable = inspector->get_event_info_tables()->m_event_info;
+
+	for(auto &it : config.m_sampling_evttypes)
+	{
+		bool found = false;
+
+		// Both the enter and exit events share the name
+		for(uint32_t j = 0; j < PPM_EVENT_MAX; j++)
+		{
+			if(it.first == etable[j].name)
+			{
+				engine->set_evttype_sampling(j, it.second);
+				found = true;
+			}
+		}
+
+		if(!found)
 		{
-			falco_logger::log(LOG_ERR, "Could not read k8s audit event line #" + to_string(line_num) + ", \"" + line + "\": " + errstr + ", stopping");
-			return;
+			throw falco_exception("Unknown event type \"" + it.first + "\" in sampling evttypes");
 		}
+
+		falco_logger::log(LOG_INFO, "Keeping a fraction " + to_string(it.second) + " of " + it.first + " events\n");
+	}
+
+	if(config.m_sampling_k8s_audit >= 0)
+	{
+		engine->set_k8s_audit_sampling(config.m_sampling_k8s_audit);
+		falco_logger::log(LOG_INFO, "Keeping a fraction " + to_string(config.m_sampling_k8s_audit) + " of k8s audit events\n");
 	}
 }
 
-static std::string read_file(std::string filename)
+// Apply the k8s audit prefilter from the config file
+static void set_k8s_audit_prefilter(falco_engine *engine, falco_configuration &config)
 {
-	std::ifstream t(filename);
-	std::string str((std::istreambuf_iterator<char>(t)),
-			std::istreambuf_iterator<char>());
+	k8s_audit_prefilter &prefilter = engine->get_k8s_audit_prefilter();
 
-	return str;
+	prefilter.set_values(k8s_audit_prefilter::R_STAGE, config.m_k8s_audit_prefilter_stages);
+	prefilter.set_values(k8s_audit_prefilter::R_VERB, config.m_k8s_audit_prefilter_verbs);
+	prefilter.set_values(k8s_audit_prefilter::R_USER, config.m_k8s_audit_prefilter_users);
+	prefilter.set_values(k8s_audit_prefilter::R_RESOURCE, config.m_k8s_audit_prefilter_resources);
+	prefilter.set_dedupe(config.m_k8s_audit_prefilter_dedupe, config.m_k8s_audit_prefilter_dedupe_window,
+			     config.m_k8s_audit_prefilter_dedupe_keep_stage);
+
+	if(prefilter.enabled())
+	{
+		falco_logger::log(LOG_INFO, "Prefiltering k8s audit events before parsing them\n");
+	}
 }
 
 //
@@ -228,11 +329,14 @@ uint64_t do_inspect(falco_engine *engine,
 		    string &stats_filename,
 		    uint64_t stats_interval,
 		    bool all_events,
+		    uint32_t num_masked_evttypes,
+		    capture_snapshots *snapshots,
 		    int &result)
 {
 	uint64_t num_evts = 0;
 	int32_t rc;
 	sinsp_evt* ev;
+	falco_engine::rule_result res;
 	StatsFileWriter writer;
 	uint64_t duration_start = 0;
 
@@ -243,11 +347,20 @@ uint64_t do_inspect(falco_engine *engine,
 		      config.m_syscall_evt_drop_max_burst,
 		      config.m_syscall_evt_simulate_drops);
 
+	if(config.m_syscall_evt_load_shedding)
+	{
+		sdropmgr.set_load_shedding(engine,
+					   config.m_syscall_evt_load_shedding_max_priority,
+					   config.m_syscall_evt_load_shedding_recovery_secs);
+	}
+
 	if (stats_filename != "")
 	{
 		string errstr;
 
-		if (!writer.init(inspector, stats_filename, stats_interval, errstr))
+		writer.set_masked_evttypes(num_masked_evttypes);
+
+		if (!writer.init(&sdropmgr, engine, outputs, stats_filename, stats_interval, errstr))
 		{
 			throw falco_exception(errstr);
 		}
@@ -261,8 +374,6 @@ uint64_t do_inspect(falco_engine *engine,
 
 		rc = inspector->next(&ev);
 
-		writer.handle();
-
 		if(g_reopen_outputs)
 		{
 			outputs->reopen_outputs();
@@ -303,6 +414,11 @@ uint64_t do_inspect(falco_engine *engine,
 			}
 		}
 
+		if(snapshots)
+		{
+			snapshots->add_event(ev);
+		}
+
 		if(!sdropmgr.process_event(inspector, ev))
 		{
 			result = EXIT_FAILURE;
@@ -319,10 +435,14 @@ uint64_t do_inspect(falco_engine *engine,
 		// engine, which will match the event against the set
 		// of rules. If a match is found, pass the event to
 		// the outputs.
-		unique_ptr<falco_engine::rule_result> res = engine->process_sinsp_event(ev);
-		if(res)
+		if(engine->process_sinsp_event(ev, res))
 		{
-			outputs->handle_event(res->evt, res->rule, res->source, res->priority_num, res->format);
+			outputs->handle_event(res.evt, res.info->rule, res.info->source, res.priority_num, res.info->format);
+
+			if(snapshots)
+			{
+				snapshots->trigger(res.info->rule, ev->get_ts());
+			}
 		}
 
 		num_evts++;
@@ -399,6 +519,9 @@ int falco_init(int argc, char **argv)
 	sinsp_evt::param_fmt event_buffer_format = sinsp_evt::PF_NORMAL;
 	falco_engine *engine = NULL;
 	falco_outputs *outputs = NULL;
+	k8s_audit_shards *k8s_shards = NULL;
+	syslog_sink *native_syslog = NULL;
+	capture_snapshots *snapshots = NULL;
 	syscall_evt_drop_mgr sdropmgr;
 	int op;
 	int long_index = 0;
@@ -413,6 +536,7 @@ int falco_init(int argc, char **argv)
 	string describe_rule = "";
 	list<string> validate_rules_filenames;
 	string stats_filename = "";
+	string rule_coverage_filename = "";
 	uint64_t stats_interval = 5000;
 	bool verbose = false;
 	bool names_only = false;
@@ -432,6 +556,9 @@ int falco_init(int argc, char **argv)
 	set<string> disable_sources;
 	bool disable_syscall = false;
 	bool disable_k8s_audit = false;
+	bool reorder_conditions = true;
+	uint32_t k8s_audit_replay_threads = 0;
+	uint32_t num_masked_evttypes = 0;
 
 	// Used for writing trace files
 	int duration_seconds = 0;
@@ -453,17 +580,20 @@ int falco_init(int argc, char **argv)
 	{
 		{"cri", required_argument, 0},
         {"daemon", no_argument, 0, 'd'},
+        {"disable-condition-reordering", no_argument, 0},
         {"disable-source", required_argument, 0},
         {"help", no_argument, 0, 'h'},
         {"ignored-events", no_argument, 0, 'i'},
         {"k8s-api-cert", required_argument, 0, 'K'},
         {"k8s-api", required_argument, 0, 'k'},
+        {"k8s-audit-replay-threads", required_argument, 0},
         {"list", optional_argument, 0},
         {"mesos-api", required_argument, 0, 'm'},
         {"option", required_argument, 0, 'o'},
         {"pidfile", required_argument, 0, 'P'},
         {"print-base64", no_argument, 0, 'b'},
         {"print", required_argument, 0, 'p'},
+        {"rule-coverage", required_argument, 0},
         {"snaplen", required_argument, 0, 'S'},
         {"stats_interval", required_argument, 0},
         {"support", no_argument, 0},
@@ -631,10 +761,22 @@ int falco_init(int argc, char **argv)
 				{
 					stats_interval = atoi(optarg);
 				}
+				else if (string(long_options[long_index].name) == "rule-coverage")
+				{
+					rule_coverage_filename = optarg;
+				}
 				else if (string(long_options[long_index].name) == "support")
 				{
 					print_support = true;
 				}
+				else if (string(long_options[long_index].name) == "k8s-audit-replay-threads")
+				{
+					k8s_audit_replay_threads = atoi(optarg);
+				}
+				else if (string(long_options[long_index].name) == "disable-condition-reordering")
+				{
+					reorder_conditions = false;
+				}
 				else if (string(long_options[long_index].name) == "disable-source")
 				{
 					if(optarg != NULL)
@@ -677,6 +819,8 @@ int falco_init(int argc, char **argv)
 		engine = new falco_engine();
 		engine->set_inspector(inspector);
 		engine->set_extra(output_format, replace_container_info);
+		engine->set_reorder_conditions(reorder_conditions);
+		engine->set_rule_timing(rule_coverage_filename != "");
 
 		if(list_flds)
 		{
@@ -711,6 +855,10 @@ int falco_init(int argc, char **argv)
 			throw std::invalid_argument("If -d is provided, a pid file must also be provided");
 		}
 
+		if (rule_coverage_filename != "" && trace_filename == "") {
+			throw std::invalid_argument("--rule-coverage can only be used when reading events from a file with -e");
+		}
+
 		ifstream conf_stream;
 		if (conf_filename.size())
 		{
@@ -782,6 +930,22 @@ int falco_init(int argc, char **argv)
 			falco_logger::log(LOG_INFO, "Falco initialized. No configuration file found, proceeding with defaults\n");
 		}
 
+		if(config.m_syslog_native)
+		{
+			string errstr;
+			native_syslog = new syslog_sink(config.m_syslog_socket);
+			if(native_syslog->open(errstr))
+			{
+				falco_logger::set_syslog_sink(native_syslog);
+			}
+			else
+			{
+				falco_logger::log(LOG_ERR, errstr + ", using syslog() instead\n");
+				delete native_syslog;
+				native_syslog = NULL;
+			}
+		}
+
 		if (rules_filenames.size())
 		{
 			config.m_rules_filenames = rules_filenames;
@@ -848,6 +1012,20 @@ int falco_init(int argc, char **argv)
 			engine->enable_rule_by_tag(enabled_rule_tags, true);
 		}
 
+		set_event_sampling(engine, inspector, config);
+
+		engine->set_k8s_audit_lazy_parse(config.m_webserver_k8s_audit_lazy_parse);
+		set_k8s_audit_prefilter(engine, config);
+
+		// The worker engines are clones of engine, so this must
+		// come after all rules are loaded and enabled, and
+		// before the outputs are initialized.
+		if(config.m_webserver_k8s_audit_workers > 1 && !disable_k8s_audit)
+		{
+			falco_logger::log(LOG_INFO, "Checking k8s audit events against the rules on " + to_string(config.m_webserver_k8s_audit_workers) + " workers\n");
+			k8s_shards = new k8s_audit_shards(engine, config.m_webserver_k8s_audit_workers);
+		}
+
 		if(print_support)
 		{
 			nlohmann::json support;
@@ -954,6 +1132,9 @@ int falco_init(int argc, char **argv)
 		if (daemon && !g_daemonized) {
 			pid_t pid, sid;
 
+			// The log writer thread would not survive the fork
+			falco_logger::flush();
+
 			pid = fork();
 			if (pid < 0) {
 				// error
@@ -1089,6 +1270,25 @@ int falco_init(int argc, char **argv)
 			inspector->start_dropping_mode(1);
 		}
 
+		// Only live captures are filtered at the driver. When
+		// writing a capture file with -w or capture snapshots,
+		// keep every event so the files are complete. On a
+		// reload (SIGHUP) falco reopens the inspector, so the
+		// mask always reflects the currently loaded rules.
+		if(trace_filename.empty() && !disable_syscall && !all_events && outfile == "" &&
+		   !config.m_capture_snapshots_enabled)
+		{
+			try
+			{
+				num_masked_evttypes = set_driver_eventmask(engine, inspector);
+				falco_logger::log(LOG_INFO, "Masked " + to_string(num_masked_evttypes) + " event types not used by any enabled rule\n");
+			}
+			catch(sinsp_exception &e)
+			{
+				falco_logger::log(LOG_WARNING, string("Could not set driver event mask: ") + e.what() + "\n");
+			}
+		}
+
 		if(outfile != "")
 		{
 			inspector->setup_cycle_writer(outfile, rollover_mb, duration_seconds, file_limit, event_limit, compress);
@@ -1158,7 +1358,7 @@ int falco_init(int argc, char **argv)
 		{
 			std::string ssl_option = (config.m_webserver_ssl_enabled ? " (SSL)" : "");
 			falco_logger::log(LOG_INFO, "Starting internal webserver, listening on port " + to_string(config.m_webserver_listen_port) + ssl_option + "\n");
-			webserver.init(&config, engine, outputs);
+			webserver.init(&config, engine, outputs, &sdropmgr, k8s_shards);
 			webserver.start();
 		}
 
@@ -1166,12 +1366,29 @@ int falco_init(int argc, char **argv)
 		{
 			read_k8s_audit_trace_file(engine,
 						  outputs,
-						  trace_filename);
+						  trace_filename,
+						  k8s_audit_replay_threads,
+						  k8s_shards);
 		}
 		else
 		{
 			uint64_t num_evts;
 
+			if(config.m_capture_snapshots_enabled && !disable_syscall)
+			{
+				capture_snapshots::config scfg;
+				scfg.directory = config.m_capture_snapshots_directory;
+				scfg.pre_ns = config.m_capture_snapshots_pre_secs * ONE_SECOND_IN_NS;
+				scfg.post_ns = config.m_capture_snapshots_post_secs * ONE_SECOND_IN_NS;
+				scfg.max_bytes = config.m_capture_snapshots_max_mb * 1024 * 1024ULL;
+				scfg.max_pending = config.m_capture_snapshots_max_pending;
+				scfg.compress = config.m_capture_snapshots_compress;
+				scfg.rules = config.m_capture_snapshots_rules;
+
+				snapshots = new capture_snapshots(inspector, scfg);
+				falco_logger::log(LOG_INFO, "Writing capture snapshots to " + scfg.directory + "\n");
+			}
+
 			num_evts = do_inspect(engine,
 					      outputs,
 					      inspector,
@@ -1181,8 +1398,21 @@ int falco_init(int argc, char **argv)
 					      stats_filename,
 					      stats_interval,
 					      all_events,
+					      num_masked_evttypes,
+					      snapshots,
 					      result);
 
+			// Write the snapshot being collected while the
+			// inspector is still open
+			if(snapshots)
+			{
+				snapshots->flush();
+				falco_logger::log(LOG_INFO, "Capture snapshots written: " + to_string(snapshots->num_written()) +
+						  ", skipped: " + to_string(snapshots->num_skipped()) + "\n");
+				delete snapshots;
+				snapshots = NULL;
+			}
+
 			duration = ((double)clock()) / CLOCKS_PER_SEC - duration;
 
 			inspector->get_capture_stats(&cstats);
@@ -1201,6 +1431,31 @@ int falco_init(int argc, char **argv)
 
 		}
 
+		if(verbose)
+		{
+			uint64_t num_rule_evts, num_filters_run;
+
+			engine->get_dispatch_stats(num_rule_evts, num_filters_run);
+
+			fprintf(stderr, "Events checked against rules: %" PRIu64 ", Rule filters run: %" PRIu64 ", %.2lf filters/event\n",
+				num_rule_evts,
+				num_filters_run,
+				(num_rule_evts == 0 ? 0.0 : (double) num_filters_run / num_rule_evts));
+		}
+
+		if(rule_coverage_filename != "")
+		{
+			nlohmann::json coverage;
+			engine->get_rule_coverage(coverage);
+
+			ofstream coverage_stream(rule_coverage_filename);
+			if(!coverage_stream.is_open())
+			{
+				throw falco_exception("Could not open rule coverage file " + rule_coverage_filename + " for writing");
+			}
+			coverage_stream << coverage.dump(2) << endl;
+		}
+
 		inspector->close();
 		engine->print_stats();
 		sdropmgr.print_stats();
@@ -1217,10 +1472,19 @@ int falco_init(int argc, char **argv)
 
 exit:
 
+	delete k8s_shards;
+	delete snapshots;
 	delete inspector;
 	delete engine;
 	delete outputs;
 
+	if(native_syslog)
+	{
+		falco_logger::set_syslog_sink(NULL);
+		falco_logger::flush();
+		delete native_syslog;
+	}
+
 	return result;
 }
 
@@ -133,17 +133,52 @@ void falco_outputs::add_output(output_config oc)
 		throw falco_exception(string(lerr));
 	}
 
+	output_limits limits;
+	limits.min_priority = oc.min_priority;
+	limits.rate_limited = (oc.rate > 0);
+	if(limits.rate_limited)
+	{
+		limits.tb.init(oc.rate, oc.max_burst);
+	}
+	m_output_limits.push_back(limits);
 }
 
-void falco_outputs::handle_event(gen_event *ev, string &rule, string &source,
-				 falco_common::priority_type priority, string &format)
+void falco_outputs::handle_event(gen_event *ev, const string &rule, const string &source,
+				 falco_common::priority_type priority, const string &format)
 {
+	// Don't take a token, or format the event, if no output
+	// wants an alert of this priority.
+	bool wanted = false;
+	for(auto &limits : m_output_limits)
+	{
+		if(priority <= limits.min_priority)
+		{
+			wanted = true;
+			break;
+		}
+	}
+
+	if(!wanted)
+	{
+		return;
+	}
+
 	if(!m_notifications_tb.claim())
 	{
+		m_num_rate_limited.add();
 		falco_logger::log(LOG_DEBUG, "Skipping rate-limited notification for rule " + rule + "\n");
 		return;
 	}
 
+	if(!select_outputs(priority))
+	{
+		m_num_rate_limited.add();
+		falco_logger::log(LOG_DEBUG, "Skipping notification for rule " + rule + ", rate-limited by all outputs\n");
+		return;
+	}
+
+	m_num_alerts[priority].add();
+
 	lua_getglobal(m_ls, m_lua_output_event.c_str());
 
 	if(lua_isfunction(m_ls, -1))
@@ -155,7 +190,9 @@ void falco_outputs::handle_event(gen_event *ev, string &rule, string &source,
 		lua_pushnumber(m_ls, priority);
 		lua_pushstring(m_ls, format.c_str());
 
-		if(lua_pcall(m_ls, 6, 0, 0) != 0)
+		push_selected_outputs();
+
+		if(lua_pcall(m_ls, 7, 0, 0) != 0)
 		{
 			const char* lerr = lua_tostring(m_ls, -1);
 			string err = "Error invoking function output: " + string(lerr);
@@ -169,6 +206,35 @@ void falco_outputs::handle_event(gen_event *ev, string &rule, string &source,
 
 }
 
+bool falco_outputs::select_outputs(falco_common::priority_type priority)
+{
+	m_selected_outputs.clear();
+	for(uint32_t i = 0; i < m_output_limits.size(); i++)
+	{
+		output_limits &limits = m_output_limits[i];
+
+		if(priority > limits.min_priority ||
+		   (limits.rate_limited && !limits.tb.claim()))
+		{
+			continue;
+		}
+
+		m_selected_outputs.push_back(i + 1);
+	}
+
+	return !m_selected_outputs.empty();
+}
+
+void falco_outputs::push_selected_outputs()
+{
+	lua_createtable(m_ls, m_selected_outputs.size(), 0);
+	for(uint32_t i = 0; i < m_selected_outputs.size(); i++)
+	{
+		lua_pushnumber(m_ls, m_selected_outputs[i]);
+		lua_rawseti(m_ls, -2, i + 1);
+	}
+}
+
 void falco_outputs::handle_msg(uint64_t now,
 			       falco_common::priority_type priority,
 			       std::string &msg,
@@ -177,28 +243,37 @@ void falco_outputs::handle_msg(uint64_t now,
 {
 	std::string full_msg;
 
+	// Internal messages skip the notification rate limiter, but
+	// not the priority and rate limits of each output.
+	if(!select_outputs(priority))
+	{
+		falco_logger::log(LOG_DEBUG, "Skipping message for rule " + rule + ", filtered by all outputs\n");
+		return;
+	}
+
 	if(m_json_output)
 	{
-		nlohmann::json jmsg;
-
-		// Convert the time-as-nanoseconds to a more json-friendly ISO8601.
-		time_t evttime = now/1000000000;
-		char time_sec[20]; // sizeof "YYYY-MM-DDTHH:MM:SS"
-		char time_ns[12]; // sizeof ".sssssssssZ"
-		string iso8601evttime;
-
-		strftime(time_sec, sizeof(time_sec), "%FT%T", gmtime(&evttime));
-		snprintf(time_ns, sizeof(time_ns), ".%09luZ", now % 1000000000);
-		iso8601evttime = time_sec;
-		iso8601evttime += time_ns;
-
-		jmsg["output"] = msg;
-		jmsg["priority"] = "Critical";
-		jmsg["rule"] = rule;
-		jmsg["time"] = iso8601evttime;
-		jmsg["output_fields"] = output_fields;
-
-		full_msg = jmsg.dump();
+		m_json_writer.clear();
+		m_json_writer.begin_object();
+		m_json_writer.key("output");
+		m_json_writer.value(msg);
+		m_json_writer.key("output_fields");
+		m_json_writer.begin_object();
+		for(auto &pair : output_fields)
+		{
+			m_json_writer.key(pair.first);
+			m_json_writer.value(pair.second);
+		}
+		m_json_writer.end_object();
+		m_json_writer.key("priority");
+		m_json_writer.value(falco_common::priority_names[priority]);
+		m_json_writer.key("rule");
+		m_json_writer.value(rule);
+		m_json_writer.key("time");
+		m_json_writer.iso_8601_value(now);
+		m_json_writer.end_object();
+
+		full_msg = m_json_writer.str();
 	}
 	else
 	{
@@ -206,7 +281,7 @@ void falco_outputs::handle_msg(uint64_t now,
 		bool first = true;
 
 		sinsp_utils::ts_to_string(now, &timestr, false, true);
-		full_msg = timestr + ": " + falco_common::priority_names[LOG_CRIT] + " " + msg + "(";
+		full_msg = timestr + ": " + falco_common::priority_names[priority] + " " + msg + "(";
 		for(auto &pair : output_fields)
 		{
 			if(first)
@@ -229,8 +304,9 @@ void falco_outputs::handle_msg(uint64_t now,
 		lua_pushstring(m_ls, full_msg.c_str());
 		lua_pushstring(m_ls, falco_common::priority_names[priority].c_str());
 		lua_pushnumber(m_ls, priority);
+		push_selected_outputs();
 
-		if(lua_pcall(m_ls, 3, 0, 0) != 0)
+		if(lua_pcall(m_ls, 4, 0, 0) != 0)
 		{
 			const char* lerr = lua_tostring(m_ls, -1);
 			string err = "Error invoking function output: " + string(lerr);
@@ -244,6 +320,17 @@ void falco_outputs::handle_msg(uint64_t now,
 
 }
 
+void falco_outputs::get_alert_counts(std::vector<uint64_t> &num_alerts, uint64_t &num_rate_limited)
+{
+	num_alerts.clear();
+	for(auto &cnt : m_num_alerts)
+	{
+		num_alerts.push_back(cnt.get());
+	}
+
+	num_rate_limited = m_num_rate_limited.get();
+}
+
 void falco_outputs::reopen_outputs()
 {
 	lua_getglobal(m_ls, m_lua_output_reopen.c_str());
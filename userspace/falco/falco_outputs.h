@@ -32,6 +32,8 @@ extern "C" {
 #include "json_evt.h"
 #include "falco_common.h"
 #include "token_bucket.h"
+#include "atomic_counter.h"
+#include "json_writer.h"
 #include "falco_engine.h"
 
 //
@@ -52,6 +54,16 @@ public:
 	{
 		std::string name;
 		std::map<std::string, std::string> options;
+
+		// Alerts with a lower priority than min_priority are
+		// not sent to the output.
+		falco_common::priority_type min_priority = falco_common::PRIORITY_DEBUG;
+
+		// When rate is not 0, the alerts sent to the output
+		// are also rate limited on their own, in addition to
+		// the rate limit for all outputs.
+		uint32_t rate = 0;
+		uint32_t max_burst = 0;
 	};
 
 	void init(bool json_output,
@@ -63,12 +75,16 @@ public:
 
 	//
 	// ev is an event that has matched some rule. Pass the event
-	// to all configured outputs.
+	// to all configured outputs. The priority and rate limits of
+	// the outputs are checked first, and the event is only
+	// formatted if some output will send it.
 	//
-	void handle_event(gen_event *ev, std::string &rule, std::string &source,
-			  falco_common::priority_type priority, std::string &format);
+	void handle_event(gen_event *ev, const std::string &rule, const std::string &source,
+			  falco_common::priority_type priority, const std::string &format);
 
-	// Send a generic message to all outputs. Not necessarily associated with any event.
+	// Send a generic message to the outputs. Not necessarily
+	// associated with any event. Like alerts, the message is only
+	// sent to the outputs whose priority and rate limits allow it.
 	void handle_msg(uint64_t now,
 			falco_common::priority_type priority,
 			std::string &msg,
@@ -77,10 +93,31 @@ public:
 
 	void reopen_outputs();
 
+	// Fill in the number of alerts sent, indexed by priority, and
+	// the number of alerts skipped by the notification rate
+	// limiter. Can be called from any thread.
+	void get_alert_counts(std::vector<uint64_t> &num_alerts, uint64_t &num_rate_limited);
+
 	static int handle_http(lua_State *ls);
 
 private:
 
+	// The per output limits, in the order the outputs were added
+	struct output_limits
+	{
+		falco_common::priority_type min_priority;
+		bool rate_limited;
+		token_bucket tb;
+	};
+
+	// Fill in m_selected_outputs with the outputs that take an
+	// alert or message of the given priority, claiming a token from
+	// their rate limits. Returns false if there are none.
+	bool select_outputs(falco_common::priority_type priority);
+
+	// Push m_selected_outputs as a lua table
+	void push_selected_outputs();
+
 	falco_engine *m_falco_engine;
 
 	bool m_initialized;
@@ -88,6 +125,20 @@ private:
 	// Rate limits notifications
 	token_bucket m_notifications_tb;
 
+	std::vector<output_limits> m_output_limits;
+
+	// The (lua, 1-based) indexes of the outputs an alert is sent
+	// to, reused for each alert.
+	std::vector<uint32_t> m_selected_outputs;
+
+	// Alerts are sent both from the event processing loop and
+	// from the webserver thread, so these are updated with add().
+	atomic_counter m_num_alerts[falco_common::PRIORITY_DEBUG + 1];
+	atomic_counter m_num_rate_limited;
+
+	// Used by handle_msg
+	json_writer m_json_writer;
+
 	bool m_buffered;
 	bool m_json_output;
 	bool m_time_format_iso_8601;
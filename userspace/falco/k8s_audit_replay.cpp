@@ -0,0 +1,272 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <thread>
+
+#include "falco_common.h"
+#include "logger.h"
+#include "webserver.h"
+#include "k8s_audit_replay.h"
+
+using namespace std;
+
+// Chunks are cut at the first newline after this many bytes.
+static const size_t CHUNK_SIZE = 1024 * 1024;
+
+k8s_audit_replay::k8s_audit_replay(falco_engine *engine, falco_outputs *outputs, uint32_t num_threads,
+				   k8s_audit_shards *shards)
+	: m_engine(engine),
+	  m_outputs(outputs),
+	  m_num_threads(num_threads),
+	  m_shards(shards),
+	  m_max_ahead(0),
+	  m_next_chunk(0),
+	  m_consumed(0),
+	  m_stop(false)
+{
+	if(m_num_threads == 0)
+	{
+		m_num_threads = thread::hardware_concurrency();
+	}
+
+	if(m_num_threads == 0)
+	{
+		m_num_threads = 1;
+	}
+
+	m_max_ahead = 2 * m_num_threads;
+}
+
+k8s_audit_replay::~k8s_audit_replay()
+{
+}
+
+uint64_t k8s_audit_replay::replay(const string &filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		throw falco_exception("Could not open k8s audit trace file " + filename + ": " + strerror(errno));
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		string err = strerror(errno);
+		close(fd);
+		throw falco_exception("Could not stat k8s audit trace file " + filename + ": " + err);
+	}
+
+	size_t len = st.st_size;
+	if(len == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	void *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(data == MAP_FAILED)
+	{
+		throw falco_exception("Could not map k8s audit trace file " + filename + ": " + strerror(errno));
+	}
+
+	madvise(data, len, MADV_SEQUENTIAL);
+
+	const char *begin = (const char *) data;
+	const char *end = begin + len;
+
+	m_chunks.clear();
+	for(const char *p = begin; p < end; )
+	{
+		const char *cend = end;
+
+		if((size_t) (end - p) > CHUNK_SIZE)
+		{
+			cend = (const char *) memchr(p + CHUNK_SIZE, '\n', end - p - CHUNK_SIZE);
+			cend = (cend == NULL ? end : cend + 1);
+		}
+
+		m_chunks.emplace_back();
+		chunk &c = m_chunks.back();
+		c.begin = p;
+		c.end = cend;
+		c.ready = false;
+		c.num_lines = 0;
+		c.failed = false;
+		c.failed_line = 0;
+
+		p = cend;
+	}
+
+	m_next_chunk = 0;
+	m_consumed = 0;
+	m_stop = false;
+
+	// Dropping duplicate events depends on the order in which
+	// they are parsed, so chunks are then parsed one at a time,
+	// in file order.
+	uint32_t num_workers = m_num_threads;
+	if(m_engine->get_k8s_audit_prefilter().dedupe())
+	{
+		num_workers = 1;
+	}
+
+	vector<thread> workers;
+	for(uint32_t i = 0; i < min((size_t) num_workers, m_chunks.size()); i++)
+	{
+		workers.emplace_back(&k8s_audit_replay::parse_chunks, this);
+	}
+
+	uint64_t num_evts = 0;
+	uint64_t line_num = 0;
+	string errstr;
+
+	for(size_t i = 0; i < m_chunks.size(); i++)
+	{
+		chunk &c = m_chunks[i];
+
+		{
+			unique_lock<mutex> lock(m_mtx);
+			m_parsed_cv.wait(lock, [&c] { return c.ready; });
+		}
+
+		num_evts += c.evts.size();
+
+		if(!k8s_audit_handler::process_events(m_engine, m_outputs, c.evts, errstr, m_shards))
+		{
+			falco_logger::log(LOG_ERR, "Could not process k8s audit events from line #" + to_string(line_num + 1) + ": " + errstr + ", stopping");
+			break;
+		}
+
+		if(c.failed)
+		{
+			const char *lbegin = c.begin;
+			for(uint64_t l = 1; l < c.failed_line; l++)
+			{
+				lbegin = (const char *) memchr(lbegin, '\n', c.end - lbegin) + 1;
+			}
+			const char *lend = (const char *) memchr(lbegin, '\n', c.end - lbegin);
+			string line(lbegin, (lend == NULL ? c.end : lend));
+
+			falco_logger::log(LOG_ERR, "Could not read k8s audit event line #" + to_string(line_num + c.failed_line) + ", \"" + line + "\": " + c.errstr + ", stopping");
+			break;
+		}
+
+		line_num += c.num_lines;
+
+		{
+			lock_guard<mutex> lock(m_mtx);
+			c.evts.clear();
+			c.evts_arena->reset();
+			m_consumed = i + 1;
+		}
+		m_consumed_cv.notify_all();
+	}
+
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_stop = true;
+	}
+	m_consumed_cv.notify_all();
+
+	for(auto &w : workers)
+	{
+		w.join();
+	}
+
+	m_chunks.clear();
+	munmap(data, len);
+
+	return num_evts;
+}
+
+void k8s_audit_replay::parse_chunks()
+{
+	while(true)
+	{
+		size_t idx;
+
+		{
+			unique_lock<mutex> lock(m_mtx);
+			m_consumed_cv.wait(lock, [this] {
+				return m_stop || m_next_chunk >= m_chunks.size() ||
+					m_next_chunk < m_consumed + m_max_ahead;
+			});
+
+			if(m_stop || m_next_chunk >= m_chunks.size())
+			{
+				return;
+			}
+
+			idx = m_next_chunk++;
+		}
+
+		chunk &c = m_chunks[idx];
+		parse_chunk(c);
+
+		{
+			lock_guard<mutex> lock(m_mtx);
+			c.ready = true;
+		}
+		m_parsed_cv.notify_all();
+	}
+}
+
+void k8s_audit_replay::parse_chunk(chunk &c)
+{
+	const char *p = c.begin;
+
+	while(p < c.end)
+	{
+		const char *lend = (const char *) memchr(p, '\n', c.end - p);
+		if(lend == NULL)
+		{
+			lend = c.end;
+		}
+
+		c.num_lines++;
+
+		if(lend != p)
+		{
+			// Parse into a separate list so a line that fails
+			// half way through an EventList adds no events.
+			json_event_list evts(c.evts.get_allocator());
+
+			if(!k8s_audit_handler::parse_data(m_engine, p, lend - p, evts, c.errstr))
+			{
+				c.failed = true;
+				c.failed_line = c.num_lines;
+				return;
+			}
+
+			c.evts.splice(c.evts.end(), evts);
+		}
+
+		p = lend + 1;
+	}
+}
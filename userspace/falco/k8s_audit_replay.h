@@ -0,0 +1,105 @@
+/*
+Copyright (C) 2016-2019 Draios Inc dba Sysdig.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "falco_engine.h"
+#include "falco_outputs.h"
+#include "json_evt.h"
+#include "k8s_audit_shards.h"
+
+//
+// Replays a jsonl file of k8s audit events, as read with -e.
+//
+// The file is mmapped and split into chunks of whole lines. A pool of
+// threads parses the chunks into json events, which is where most of
+// the time goes. The engine is not thread-safe, so the events are run
+// through the rules on the calling thread, one chunk at a time in file
+// order, which keeps alerts in the same order as the events in the
+// file. When shards is provided, the events of a chunk are run
+// through the rules on its workers instead. When the engine's k8s
+// audit prefilter drops duplicates, a single thread parses the chunks
+// so duplicates are found in file order.
+//
+class k8s_audit_replay
+{
+public:
+	// A num_threads of 0 uses one thread per cpu.
+	k8s_audit_replay(falco_engine *engine, falco_outputs *outputs, uint32_t num_threads,
+			 k8s_audit_shards *shards = NULL);
+	virtual ~k8s_audit_replay();
+
+	// Replay all events in the file. Returns the number of
+	// events that were run through the rules. Stops at the first
+	// line that can not be parsed. Throws falco_exception if the
+	// file can not be read.
+	uint64_t replay(const std::string &filename);
+
+private:
+	struct chunk
+	{
+		chunk()
+			: evts_arena(new arena()),
+			  evts(arena_allocator<json_event>(evts_arena.get()))
+		{
+		}
+
+		const char *begin;
+		const char *end;
+
+		// Filled in by a worker thread. The events are
+		// allocated from the chunk's arena, reset once they
+		// are processed.
+		bool ready;
+		std::unique_ptr<arena> evts_arena;
+		json_event_list evts;
+		uint64_t num_lines;
+		bool failed;
+		uint64_t failed_line;
+		std::string errstr;
+	};
+
+	void parse_chunks();
+	void parse_chunk(chunk &c);
+
+	falco_engine *m_engine;
+	falco_outputs *m_outputs;
+	uint32_t m_num_threads;
+	k8s_audit_shards *m_shards;
+
+	std::vector<chunk> m_chunks;
+
+	// Workers only parse up to this many chunks ahead of the
+	// chunk being processed, to bound memory usage on large files.
+	size_t m_max_ahead;
+
+	std::mutex m_mtx;
+	std::condition_variable m_parsed_cv;
+	std::condition_variable m_consumed_cv;
+	size_t m_next_chunk;
+	size_t m_consumed;
+	bool m_stop;
+};
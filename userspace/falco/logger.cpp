@@ -17,11 +17,18 @@ limitations under the License.
 
 */
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "logger.h"
 #include "chisel_api.h"
 
 #include "falco_common.h"
+#include "atomic_counter.h"
 
 const static struct luaL_reg ll_falco [] =
 {
@@ -32,6 +39,8 @@ const static struct luaL_reg ll_falco [] =
 int falco_logger::level = LOG_INFO;
 bool falco_logger::time_format_iso_8601 = false;
 
+static std::atomic<syslog_sink *> s_syslog_sink(nullptr);
+
 void falco_logger::init(lua_State *ls)
 {
 	luaL_openlib(ls, "falco", ll_falco, 0);
@@ -42,6 +51,11 @@ void falco_logger::set_time_format_iso_8601(bool val)
 	falco_logger::time_format_iso_8601 = val;
 }
 
+void falco_logger::set_syslog_sink(syslog_sink *sink)
+{
+	s_syslog_sink.store(sink, std::memory_order_release);
+}
+
 void falco_logger::set_level(string &level)
 {
 	if(level == "emergency")
@@ -91,7 +105,16 @@ int falco_logger::syslog(lua_State *ls) {
 	}
 
 	const char *msg = luaL_checkstring(ls, 2);
-	::syslog(priority, "%s", msg);
+
+	syslog_sink *sink = s_syslog_sink.load(std::memory_order_acquire);
+	if(sink != NULL)
+	{
+		sink->send(priority, msg, strlen(msg));
+	}
+	else
+	{
+		::syslog(priority, "%s", msg);
+	}
 
 	return 0;
 }
@@ -99,67 +122,388 @@ int falco_logger::syslog(lua_State *ls) {
 bool falco_logger::log_stderr = true;
 bool falco_logger::log_syslog = true;
 
-void falco_logger::log(int priority, const string msg)
+namespace {
+
+// A bounded multi producer, single consumer queue of log
+// messages. Each slot has a sequence number telling whether it is
+// free to be written at a given position or holds a message to be
+// read, so producers only contend on the write position. The
+// message strings are reused, so once warmed up logging does not
+// allocate.
+//
+// The log settings are saved along with each message, as they can
+// change while the writer thread runs.
+enum log_flags {
+	LF_SYSLOG = 1,
+	LF_STDERR = 2,
+	LF_ISO_8601 = 4
+};
+
+class log_ring
 {
+public:
+	log_ring()
+		: m_slots(new slot[s_num_slots]),
+		  m_write_pos(0),
+		  m_read_pos(0)
+	{
+		for(uint64_t i = 0; i < s_num_slots; i++)
+		{
+			m_slots[i].seq.store(i, std::memory_order_relaxed);
+			m_slots[i].msg.reserve(256);
+		}
+	}
 
-	if(priority > falco_logger::level)
+	// On success, also returns the number of messages waiting
+	// to be read, including this one
+	bool push(int priority, uint8_t flags, time_t ts, const string &msg, uint64_t &num_pending)
+	{
+		uint64_t pos = m_write_pos.load(std::memory_order_relaxed);
+		slot *s;
+
+		while(true)
+		{
+			s = &m_slots[pos & (s_num_slots - 1)];
+			uint64_t seq = s->seq.load(std::memory_order_acquire);
+			int64_t diff = (int64_t) seq - (int64_t) pos;
+
+			if(diff == 0)
+			{
+				if(m_write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if(diff < 0)
+			{
+				// Full
+				return false;
+			}
+			else
+			{
+				pos = m_write_pos.load(std::memory_order_relaxed);
+			}
+		}
+
+		s->priority = priority;
+		s->flags = flags;
+		s->ts = ts;
+		s->msg.assign(msg);
+		s->seq.store(pos + 1, std::memory_order_release);
+
+		num_pending = pos + 1 - m_read_pos.load(std::memory_order_relaxed);
+
+		return true;
+	}
+
+	// Only called by the writer thread
+	template<typename F>
+	bool pop(F fn)
+	{
+		uint64_t pos = m_read_pos.load(std::memory_order_relaxed);
+		slot &s = m_slots[pos & (s_num_slots - 1)];
+
+		if(s.seq.load(std::memory_order_acquire) != pos + 1)
+		{
+			return false;
+		}
+
+		fn(s.priority, s.flags, s.ts, s.msg);
+
+		s.seq.store(pos + s_num_slots, std::memory_order_release);
+		m_read_pos.store(pos + 1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	static const uint64_t s_num_slots = 1024;
+
+private:
+	struct slot {
+		std::atomic<uint64_t> seq;
+		int priority;
+		uint8_t flags;
+		time_t ts;
+		string msg;
+	};
+
+	std::unique_ptr<slot[]> m_slots;
+	std::atomic<uint64_t> m_write_pos;
+	std::atomic<uint64_t> m_read_pos;
+};
+
+class log_writer
+{
+public:
+	log_writer()
+		: m_running(false),
+		  m_stopping(false),
+		  m_exiting(false),
+		  m_waiting(false),
+		  m_last_flags(LF_SYSLOG | LF_STDERR),
+		  m_last_ts(-1),
+		  m_last_iso_8601(false)
 	{
-		return;
 	}
 
-	string copy = msg;
+	virtual ~log_writer()
+	{
+		// Messages logged from here on, e.g. by other static
+		// destructors, are written right away
+		m_exiting.store(true, std::memory_order_release);
+		stop();
+	}
 
-	if (falco_logger::log_syslog)
+	void log(int priority, uint8_t flags, time_t ts, const string &msg)
 	{
-		// Syslog output should not have any trailing newline
-		if(copy.back() == '\n')
+		if(m_exiting.load(std::memory_order_acquire))
+		{
+			m_out.clear();
+			write(priority, flags, ts, msg);
+			fwrite(m_out.data(), 1, m_out.size(), stderr);
+			return;
+		}
+
+		if(!m_running.load(std::memory_order_acquire))
 		{
-			copy.pop_back();
+			start();
 		}
 
-		::syslog(priority, "%s", copy.c_str());
+		uint64_t num_pending;
+		if(!m_ring.push(priority, flags, ts, msg, num_pending))
+		{
+			m_num_dropped.add(1);
+			return;
+		}
+
+		// Errors are written as soon as possible, the rest
+		// at the next tick of the writer unless the ring
+		// buffer is filling up
+		if((priority <= LOG_ERR || num_pending >= log_ring::s_num_slots / 4) &&
+		   m_waiting.load(std::memory_order_acquire))
+		{
+			m_cv.notify_one();
+		}
 	}
 
-	if (falco_logger::log_stderr)
+	void stop()
 	{
-		// log output should always have a trailing newline
-		if(copy.back() != '\n')
+		std::lock_guard<std::mutex> lock(m_start_mutex);
+
+		if(!m_running.load(std::memory_order_acquire))
+		{
+			return;
+		}
+
 		{
-			copy.push_back('\n');
+			std::lock_guard<std::mutex> wlock(m_mutex);
+			m_stopping = true;
 		}
+		m_cv.notify_one();
+		m_thread.join();
+
+		m_stopping = false;
+		m_running.store(false, std::memory_order_release);
+	}
 
-		std::time_t result = std::time(nullptr);
-		if(falco_logger::time_format_iso_8601)
+	uint64_t num_dropped()
+	{
+		return m_num_dropped.get();
+	}
+
+private:
+	void start()
+	{
+		std::lock_guard<std::mutex> lock(m_start_mutex);
+
+		if(m_running.load(std::memory_order_acquire))
 		{
-			char buf[sizeof "YYYY-MM-DDTHH:MM:SS-0000"];
-			struct tm *gtm = std::gmtime(&result);
-			if(gtm == NULL ||
-			   (strftime(buf, sizeof(buf), "%FT%T%z", gtm) == 0))
+			return;
+		}
+
+		m_thread = std::thread(&log_writer::run, this);
+		m_running.store(true, std::memory_order_release);
+	}
+
+	void run()
+	{
+		uint64_t num_reported_dropped = m_num_dropped.get();
+
+		while(true)
+		{
+			drain(num_reported_dropped);
+
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if(m_stopping)
+			{
+				// Anything pushed before stop() was
+				// called is written here at the latest
+				drain(num_reported_dropped);
+				break;
+			}
+
+			m_waiting.store(true, std::memory_order_release);
+			m_cv.wait_for(lock, std::chrono::milliseconds(100));
+			m_waiting.store(false, std::memory_order_release);
+		}
+	}
+
+	// Writes all the messages in the ring buffer, with a single
+	// write to stderr
+	void drain(uint64_t &num_reported_dropped)
+	{
+		auto fn = [this] (int priority, uint8_t flags, time_t ts, const string &msg) {
+			write(priority, flags, ts, msg);
+			m_last_flags = flags;
+		};
+
+		m_out.clear();
+		while(m_ring.pop(fn))
+		{
+		}
+
+		uint64_t num_dropped = m_num_dropped.get();
+		if(num_dropped != num_reported_dropped)
+		{
+			write(LOG_WARNING, m_last_flags, std::time(nullptr),
+			      to_string(num_dropped - num_reported_dropped) + " log messages dropped, log buffer full");
+			num_reported_dropped = num_dropped;
+		}
+
+		if(m_out.size() > 0)
+		{
+			fwrite(m_out.data(), 1, m_out.size(), stderr);
+		}
+	}
+
+	// Sends the message to syslog and appends the stderr line to
+	// m_out
+	void write(int priority, uint8_t flags, time_t ts, const string &msg)
+	{
+		size_t len = msg.size();
+
+		if(len > 0 && msg[len - 1] == '\n')
+		{
+			len--;
+		}
+
+		if(flags & LF_SYSLOG)
+		{
+			// Syslog output should not have any trailing newline
+			syslog_sink *sink = s_syslog_sink.load(std::memory_order_acquire);
+			if(sink != NULL)
 			{
-				sprintf(buf, "N/A");
+				sink->send(priority, msg.data(), len);
 			}
 			else
 			{
-				fprintf(stderr, "%s: %s", buf, msg.c_str());
+				::syslog(priority, "%.*s", (int) len, msg.c_str());
+			}
+		}
+
+		if(flags & LF_STDERR)
+		{
+			m_out.append(timestamp(ts, (flags & LF_ISO_8601) != 0));
+			m_out.append(": ");
+			m_out.append(msg, 0, len);
+			// log output should always have a trailing newline
+			m_out.push_back('\n');
+		}
+	}
+
+	// Formatting the time is only done once per second
+	const string &timestamp(time_t ts, bool iso_8601)
+	{
+		if(ts == m_last_ts && iso_8601 == m_last_iso_8601)
+		{
+			return m_last_tstr;
+		}
+
+		m_last_ts = ts;
+		m_last_iso_8601 = iso_8601;
+
+		struct tm tm;
+		char buf[64];
+		if(m_last_iso_8601)
+		{
+			if(gmtime_r(&ts, &tm) == NULL ||
+			   strftime(buf, sizeof(buf), "%FT%T%z", &tm) == 0)
+			{
+				m_last_tstr = "N/A";
+			}
+			else
+			{
+				m_last_tstr = buf;
 			}
 		}
 		else
 		{
-			struct tm *ltm = std::localtime(&result);
-			char *atime = (ltm ? std::asctime(ltm) : NULL);
-			string tstr;
-			if(atime)
+			// Same as asctime(), without the trailing newline
+			if(localtime_r(&ts, &tm) == NULL ||
+			   strftime(buf, sizeof(buf), "%a %b %e %T %Y", &tm) == 0)
 			{
-				tstr = atime;
-				tstr = tstr.substr(0, 24);// remove trailling newline
+				m_last_tstr = "N/A";
 			}
 			else
 			{
-				tstr = "N/A";
+				m_last_tstr = buf;
 			}
-			fprintf(stderr, "%s: %s", tstr.c_str(), msg.c_str());
 		}
+
+		return m_last_tstr;
 	}
+
+	log_ring m_ring;
+	atomic_counter m_num_dropped;
+
+	std::atomic<bool> m_running;
+	bool m_stopping;
+	std::atomic<bool> m_exiting;
+	std::atomic<bool> m_waiting;
+	std::mutex m_start_mutex;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::thread m_thread;
+
+	// Only used by the writer thread
+	string m_out;
+	uint8_t m_last_flags;
+	time_t m_last_ts;
+	bool m_last_iso_8601;
+	string m_last_tstr;
+};
+
+log_writer s_writer;
+
 }
 
+void falco_logger::log(int priority, const string msg)
+{
+	if(priority > falco_logger::level ||
+	   !(falco_logger::log_syslog || falco_logger::log_stderr))
+	{
+		return;
+	}
+
+	uint8_t flags = (falco_logger::log_syslog ? LF_SYSLOG : 0) |
+		(falco_logger::log_stderr ? LF_STDERR : 0) |
+		(falco_logger::time_format_iso_8601 ? LF_ISO_8601 : 0);
+
+	s_writer.log(priority, flags, std::time(nullptr), msg);
+}
 
+void falco_logger::flush()
+{
+	s_writer.stop();
+
+	syslog_sink *sink = s_syslog_sink.load(std::memory_order_acquire);
+	if(sink != NULL)
+	{
+		sink->flush();
+	}
+}
+
+uint64_t falco_logger::num_dropped()
+{
+	return s_writer.num_dropped();
+}
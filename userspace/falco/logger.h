@@ -22,6 +22,8 @@ limitations under the License.
 #include "sinsp.h"
 #include <syslog.h>
 
+#include "syslog_sink.h"
+
 extern "C" {
 #include "lua.h"
 #include "lualib.h"
@@ -35,14 +37,32 @@ class falco_logger
 
 	static void set_time_format_iso_8601(bool val);
 
+	// Send syslog messages, from both log() and falco.syslog(),
+	// to sink instead of calling syslog(). NULL goes back to
+	// syslog(). The sink must outlive its use, i.e. be
+	// unset and followed by a flush() before deleting it.
+	static void set_syslog_sink(syslog_sink *sink);
+
 	// Will throw exception if level is unknown.
 	static void set_level(string &level);
 
 	// value = falco.syslog(level, message)
 	static int syslog(lua_State *ls);
 
+	// Messages are put in a ring buffer and written to syslog
+	// and/or stderr by a background thread, started with the
+	// first message. If the ring buffer is full the message is
+	// dropped and counted.
 	static void log(int priority, const string msg);
 
+	// Write all pending messages and stop the background
+	// thread. It is started again by the next message. Must be
+	// called before forking.
+	static void flush();
+
+	// Messages dropped because the ring buffer was full
+	static uint64_t num_dropped();
+
 	static int level;
 	static bool log_stderr;
 	static bool log_syslog;
@@ -152,7 +152,8 @@ end
 function mod.http_reopen()
 end
 
-function output_event(event, rule, source, priority, priority_num, format)
+-- selected holds the indexes of the outputs to send the event to
+function output_event(event, rule, source, priority, priority_num, format, selected)
    -- If format starts with a *, remove it, as we're adding our own
    -- prefix here.
    if format:sub(1,1) == "*" then
@@ -183,13 +184,16 @@ function output_event(event, rule, source, priority, priority_num, format)
 
    msg = formats.format_event(event, rule, source, priority, format)
 
-   for index,o in ipairs(outputs) do
+   for i,index in ipairs(selected) do
+      local o = outputs[index]
       o.output(priority, priority_num, msg, o.options)
    end
 end
 
-function output_msg(msg, priority, priority_num)
-   for index,o in ipairs(outputs) do
+-- selected holds the indexes of the outputs to send the message to
+function output_msg(msg, priority, priority_num, selected)
+   for i,index in ipairs(selected) do
+      local o = outputs[index]
       o.output(priority, priority_num, msg, o.options)
    end
 end
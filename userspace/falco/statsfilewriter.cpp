@@ -17,55 +17,46 @@ limitations under the License.
 
 */
 
-#include <sys/time.h>
-#include <signal.h>
+#include <string.h>
+#include <chrono>
 
 #include "statsfilewriter.h"
+#include "logger.h"
 
 using namespace std;
 
-static bool g_save_stats = false;
-static void timer_handler (int signum)
-{
-	g_save_stats = true;
-}
-
 extern char **environ;
 
 StatsFileWriter::StatsFileWriter()
-	: m_num_stats(0), m_inspector(NULL)
+	: m_num_stats(0), m_num_masked_evttypes(0), m_sdropmgr(NULL),
+	  m_engine(NULL), m_outputs(NULL), m_interval_msec(0), m_stop(false)
 {
 }
 
 StatsFileWriter::~StatsFileWriter()
 {
+	stop();
 	m_output.close();
 }
 
-bool StatsFileWriter::init(sinsp *inspector, string &filename, uint32_t interval_msec, string &errstr)
+bool StatsFileWriter::init(syscall_evt_drop_mgr *sdropmgr,
+			   falco_engine *engine,
+			   falco_outputs *outputs,
+			   string &filename,
+			   uint32_t interval_msec,
+			   string &errstr)
 {
-	struct itimerval timer;
-	struct sigaction handler;
-
-	m_inspector = inspector;
+	m_sdropmgr = sdropmgr;
+	m_engine = engine;
+	m_outputs = outputs;
+	m_interval_msec = interval_msec;
 
 	m_output.exceptions ( ofstream::failbit | ofstream::badbit );
 	m_output.open(filename, ios_base::app);
 
-	memset (&handler, 0, sizeof (handler));
-	handler.sa_handler = &timer_handler;
-	if (sigaction(SIGALRM, &handler, NULL) == -1)
+	if(m_interval_msec == 0)
 	{
-		errstr = string("Could not set up signal handler for periodic timer: ") + strerror(errno);
-		return false;
-	}
-
-	timer.it_value.tv_sec = 0;
-	timer.it_value.tv_usec = interval_msec * 1000;
-	timer.it_interval = timer.it_value;
-	if (setitimer(ITIMER_REAL, &timer, NULL) == -1)
-	{
-		errstr = string("Could not set up periodic timer: ") + strerror(errno);
+		errstr = string("Stats interval must be greater than 0");
 		return false;
 	}
 
@@ -93,47 +84,126 @@ bool StatsFileWriter::init(sinsp *inspector, string &filename, uint32_t interval
 		}
 	}
 
+	m_stop = false;
+	m_thread = thread(&StatsFileWriter::run, this);
+
 	return true;
 }
 
-void StatsFileWriter::handle()
+void StatsFileWriter::set_masked_evttypes(uint32_t num_masked_evttypes)
 {
-	if (g_save_stats)
+	m_num_masked_evttypes = num_masked_evttypes;
+}
+
+void StatsFileWriter::stop()
+{
+	if(!m_thread.joinable())
 	{
-		scap_stats cstats;
-		scap_stats delta;
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(m_mtx);
+		m_stop = true;
+	}
+	m_cv.notify_all();
 
-		g_save_stats = false;
-		m_num_stats++;
-		m_inspector->get_capture_stats(&cstats);
+	m_thread.join();
+}
+
+void StatsFileWriter::run()
+{
+	auto next = chrono::steady_clock::now();
+	bool stopping = false;
+
+	while(!stopping)
+	{
+		next += chrono::milliseconds(m_interval_msec);
 
-		if(m_num_stats == 1)
 		{
-			delta = cstats;
+			unique_lock<mutex> lock(m_mtx);
+			stopping = m_cv.wait_until(lock, next, [this] { return m_stop; });
 		}
-		else
+
+		sample();
+
+		// Write everything collected since the last
+		// successful write in one go. If the write fails
+		// (e.g. the disk is full), keep the samples and try
+		// again at the next interval.
+		try
 		{
-			delta.n_evts = cstats.n_evts - m_last_stats.n_evts;
-			delta.n_drops = cstats.n_drops - m_last_stats.n_drops;
-			delta.n_preemptions = cstats.n_preemptions - m_last_stats.n_preemptions;
+			m_output.clear();
+			m_output.write(m_buf.data(), m_buf.size());
+			m_output.flush();
+			m_buf.clear();
 		}
-
-		m_output << "{\"sample\": " << m_num_stats;
-		if(m_extra != "")
+		catch(ios_base::failure &e)
 		{
-			m_output << ", " << m_extra;
+			falco_logger::log(LOG_ERR, string("Could not write stats file: ") + e.what() + "\n");
 		}
-		m_output << ", \"cur\": {" <<
-			"\"events\": " << cstats.n_evts <<
-			", \"drops\": " << cstats.n_drops <<
-			", \"preemptions\": " << cstats.n_preemptions <<
-			"}, \"delta\": {" <<
-			"\"events\": " << delta.n_evts <<
-			", \"drops\": " << delta.n_drops <<
-			", \"preemptions\": " << delta.n_preemptions <<
-			"}, \"drop_pct\": " << (delta.n_evts == 0 ? 0 : (100.0*delta.n_drops/delta.n_evts)) <<
-			"}," << endl;
-
-		m_last_stats = cstats;
 	}
 }
+
+void StatsFileWriter::sample()
+{
+	scap_stats cstats;
+	scap_stats delta;
+
+	m_num_stats++;
+
+	m_sdropmgr->get_driver_stats(cstats);
+
+	if(m_num_stats == 1)
+	{
+		delta = cstats;
+	}
+	else
+	{
+		delta.n_evts = cstats.n_evts - m_last_stats.n_evts;
+		delta.n_drops = cstats.n_drops - m_last_stats.n_drops;
+		delta.n_preemptions = cstats.n_preemptions - m_last_stats.n_preemptions;
+	}
+
+	map<string, uint64_t> num_events, num_sampled_out;
+	m_engine->get_source_counts(num_events, num_sampled_out);
+
+	vector<uint64_t> num_alerts;
+	uint64_t num_alerts_total = 0;
+	uint64_t num_rate_limited;
+	m_outputs->get_alert_counts(num_alerts, num_rate_limited);
+	for(auto n : num_alerts)
+	{
+		num_alerts_total += n;
+	}
+
+	char drop_pct[32];
+	snprintf(drop_pct, sizeof(drop_pct), "%g", (delta.n_evts == 0 ? 0 : (100.0*delta.n_drops/delta.n_evts)));
+
+	m_buf += "{\"sample\": " + to_string(m_num_stats);
+	if(m_extra != "")
+	{
+		m_buf += ", " + m_extra;
+	}
+	m_buf += ", \"cur\": {"
+		"\"events\": " + to_string(cstats.n_evts) +
+		", \"drops\": " + to_string(cstats.n_drops) +
+		", \"preemptions\": " + to_string(cstats.n_preemptions) +
+		"}, \"delta\": {"
+		"\"events\": " + to_string(delta.n_evts) +
+		", \"drops\": " + to_string(delta.n_drops) +
+		", \"preemptions\": " + to_string(delta.n_preemptions) +
+		"}, \"drop_pct\": " + drop_pct +
+		", \"masked_evttypes\": " + to_string(m_num_masked_evttypes) +
+		", \"engine\": {"
+		"\"syscall_events\": " + to_string(num_events["syscall"]) +
+		", \"k8s_audit_events\": " + to_string(num_events["k8s_audit"]) +
+		", \"syscall_sampled_out\": " + to_string(num_sampled_out["syscall"]) +
+		", \"k8s_audit_sampled_out\": " + to_string(num_sampled_out["k8s_audit"]) +
+		"}, \"outputs\": {"
+		"\"alerts\": " + to_string(num_alerts_total) +
+		", \"rate_limited\": " + to_string(num_rate_limited) +
+		"}},\n";
+
+	m_last_stats = cstats;
+}
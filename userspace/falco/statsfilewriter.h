@@ -22,30 +22,71 @@ limitations under the License.
 #include <fstream>
 #include <string>
 #include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <sinsp.h>
 
-// Periodically collects scap stats files and writes them to a file as
-// json.
+#include "falco_engine.h"
+#include "falco_outputs.h"
+#include "event_drops.h"
+
+// Periodically collects scap stats, along with engine and output
+// counters, and writes them to a file as json.
+//
+// Collection happens on a background thread, so the event
+// processing loop does not need to do anything. The scap stats are
+// the copies syscall_evt_drop_mgr publishes each time it reads them
+// on the capture thread (about once a second), and the
+// engine/output counters are atomic_counters, so none of them
+// require synchronizing with the event processing loop or calling
+// into the driver from this thread.
 
 class StatsFileWriter {
 public:
 	StatsFileWriter();
 	virtual ~StatsFileWriter();
 
-	// Returns success as bool. On false fills in errstr.
-	bool init(sinsp *inspector, std::string &filename,
+	// Returns success as bool. On false fills in errstr. Starts
+	// the background thread, which runs until stop() is called
+	// or the object is destroyed. sdropmgr must stay alive until
+	// then.
+	bool init(syscall_evt_drop_mgr *sdropmgr,
+		  falco_engine *engine,
+		  falco_outputs *outputs,
+		  std::string &filename,
 		  uint32_t interval_msec,
 		  string &errstr);
 
-	// Should be called often (like for each event in a sinsp
-	// loop).
-	void handle();
+	// Number of event types masked out at the driver, reported
+	// with each sample. Must be called before init().
+	void set_masked_evttypes(uint32_t num_masked_evttypes);
+
+	// Stop the background thread, after it writes a last sample.
+	void stop();
 
 protected:
+	void run();
+
+	// Collect one sample and append it, as a line of json, to
+	// m_buf.
+	void sample();
+
 	uint32_t m_num_stats;
-	sinsp *m_inspector;
+	uint32_t m_num_masked_evttypes;
+	syscall_evt_drop_mgr *m_sdropmgr;
+	falco_engine *m_engine;
+	falco_outputs *m_outputs;
 	std::ofstream m_output;
 	std::string m_extra;
 	scap_stats m_last_stats;
+	uint32_t m_interval_msec;
+
+	std::string m_buf;
+
+	std::thread m_thread;
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	bool m_stop;
 };
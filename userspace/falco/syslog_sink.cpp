@@ -0,0 +1,331 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "syslog_sink.h"
+
+using namespace std;
+
+const size_t syslog_sink::max_queued;
+const size_t syslog_sink::max_batch;
+
+syslog_sink::syslog_sink(const std::string &socket_path,
+			 const std::string &app_name,
+			 int facility)
+	: m_socket_path(socket_path),
+	  m_app_name(app_name),
+	  m_facility(facility),
+	  m_fd(-1),
+	  m_running(false),
+	  m_stopping(false),
+	  m_num_queued(0),
+	  m_cached_secs(UINT64_MAX),
+	  m_cached_time_len(0)
+{
+}
+
+syslog_sink::~syslog_sink()
+{
+	flush();
+
+	if(m_fd != -1)
+	{
+		close(m_fd);
+	}
+}
+
+bool syslog_sink::open(std::string &errstr)
+{
+	if(m_socket_path.size() >= sizeof(((struct sockaddr_un *) 0)->sun_path))
+	{
+		errstr = "Syslog socket path " + m_socket_path + " too long";
+		return false;
+	}
+
+	if(!connect_socket())
+	{
+		errstr = "Could not connect to syslog socket " + m_socket_path + ": " + strerror(errno);
+		return false;
+	}
+
+	return true;
+}
+
+bool syslog_sink::connect_socket()
+{
+	if(m_fd != -1)
+	{
+		close(m_fd);
+	}
+
+	m_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(m_fd == -1)
+	{
+		return false;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, m_socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+	if(connect(m_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+	{
+		int err = errno;
+		close(m_fd);
+		m_fd = -1;
+		errno = err;
+		return false;
+	}
+
+	return true;
+}
+
+void syslog_sink::send(int priority, const char *msg, size_t len)
+{
+	uint64_t ts = chrono::duration_cast<chrono::microseconds>(
+		chrono::system_clock::now().time_since_epoch()).count();
+
+	// Syslog messages should not have a trailing newline
+	if(len > 0 && msg[len - 1] == '\n')
+	{
+		len--;
+	}
+
+	bool wake;
+	{
+		lock_guard<mutex> lock(m_mutex);
+
+		if(m_num_queued >= max_queued)
+		{
+			m_num_dropped.add();
+			return;
+		}
+
+		if(m_queue.size() <= m_num_queued)
+		{
+			m_queue.emplace_back();
+		}
+
+		entry &e = m_queue[m_num_queued++];
+		e.priority = (priority & LOG_PRIMASK);
+		e.ts = ts;
+		e.msg.assign(msg, len);
+
+		if(!m_running)
+		{
+			m_running = true;
+			m_thread = thread(&syslog_sink::run, this);
+		}
+
+		wake = (m_num_queued == 1);
+	}
+
+	if(wake)
+	{
+		m_cv.notify_one();
+	}
+}
+
+void syslog_sink::flush()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+
+		if(!m_running)
+		{
+			return;
+		}
+
+		m_stopping = true;
+	}
+	m_cv.notify_one();
+	m_thread.join();
+
+	lock_guard<mutex> lock(m_mutex);
+	m_stopping = false;
+	m_running = false;
+}
+
+uint64_t syslog_sink::num_sent()
+{
+	return m_num_sent.get();
+}
+
+uint64_t syslog_sink::num_dropped()
+{
+	return m_num_dropped.get();
+}
+
+void syslog_sink::run()
+{
+	char hostname[256];
+	if(gethostname(hostname, sizeof(hostname)) != 0)
+	{
+		strcpy(hostname, "-");
+	}
+	hostname[sizeof(hostname) - 1] = '\0';
+
+	m_header_suffix = string(" ") + hostname + " " + m_app_name + " " + to_string(getpid()) + " - - ";
+
+	while(true)
+	{
+		size_t num;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_cv.wait(lock, [this]() { return m_num_queued > 0 || m_stopping; });
+
+			if(m_num_queued == 0)
+			{
+				// Stopping, with everything sent
+				break;
+			}
+
+			swap(m_queue, m_sending);
+			num = m_num_queued;
+			m_num_queued = 0;
+		}
+
+		send_entries(num);
+	}
+}
+
+void syslog_sink::render_header(size_t i, const entry &e)
+{
+	// <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD, with
+	// the time in UTC with microseconds. Everything up to the
+	// seconds is only formatted once per second.
+	string &hdr = m_headers[i];
+	uint64_t secs = e.ts / 1000000;
+
+	if(secs != m_cached_secs)
+	{
+		time_t t = secs;
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		m_cached_time_len = strftime(m_cached_time, sizeof(m_cached_time), "%FT%T.", &tm);
+		m_cached_secs = secs;
+	}
+
+	char usecs[7];
+	uint64_t frac = e.ts % 1000000;
+	for(int j = 5; j >= 0; j--)
+	{
+		usecs[j] = '0' + (frac % 10);
+		frac /= 10;
+	}
+	usecs[6] = 'Z';
+
+	hdr = "<";
+	hdr += to_string(m_facility | e.priority);
+	hdr += ">1 ";
+	hdr.append(m_cached_time, m_cached_time_len);
+	hdr.append(usecs, sizeof(usecs));
+	hdr += m_header_suffix;
+}
+
+void syslog_sink::send_entries(size_t num)
+{
+	if(m_headers.size() < max_batch)
+	{
+		m_headers.resize(max_batch);
+		m_iovs.resize(max_batch * 2);
+		m_msgs.resize(max_batch);
+	}
+
+	for(size_t start = 0; start < num; start += max_batch)
+	{
+		size_t batch = min(num - start, max_batch);
+
+		for(size_t i = 0; i < batch; i++)
+		{
+			entry &e = m_sending[start + i];
+			render_header(i, e);
+
+			m_iovs[i * 2].iov_base = (void *) m_headers[i].data();
+			m_iovs[i * 2].iov_len = m_headers[i].size();
+			m_iovs[i * 2 + 1].iov_base = (void *) e.msg.data();
+			m_iovs[i * 2 + 1].iov_len = e.msg.size();
+
+			memset(&m_msgs[i], 0, sizeof(m_msgs[i]));
+			m_msgs[i].msg_hdr.msg_iov = &m_iovs[i * 2];
+			m_msgs[i].msg_hdr.msg_iovlen = 2;
+		}
+
+		size_t sent = 0;
+		bool reconnected = false;
+		while(sent < batch)
+		{
+			int ret;
+			if(m_fd == -1)
+			{
+				ret = -1;
+				errno = ENOTCONN;
+			}
+			else
+			{
+				ret = sendmmsg(m_fd, &m_msgs[sent], batch - sent, 0);
+			}
+
+			if(ret > 0)
+			{
+				sent += ret;
+				m_num_sent.inc(ret);
+				continue;
+			}
+
+			if(ret < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			// The syslog daemon may have been restarted, try
+			// to connect again once per batch
+			if(ret < 0 && !reconnected &&
+			   (errno == ECONNREFUSED || errno == ENOTCONN || errno == ENOENT))
+			{
+				reconnected = true;
+				if(connect_socket())
+				{
+					continue;
+				}
+			}
+
+			// Otherwise, e.g. for a message that is too
+			// large, skip the message that failed, or the
+			// whole batch if the socket could not be connected
+			if(m_fd == -1)
+			{
+				m_num_dropped.add(batch - sent);
+				break;
+			}
+
+			m_num_dropped.add();
+			sent++;
+		}
+	}
+}
@@ -0,0 +1,119 @@
+/*
+Copyright (C) 2018 Draios inc.
+
+This file is part of falco.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+*/
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <syslog.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "atomic_counter.h"
+
+// Sends messages to the local syslog daemon over its unix socket,
+// in RFC 5424 format. Instead of a syslog() call per message, each
+// formatting the message and sending it under libc's lock, messages
+// are queued and sent by a background thread, in batches with
+// sendmmsg(). The headers are pre-rendered, only the timestamp
+// changes between messages.
+class syslog_sink
+{
+public:
+	syslog_sink(const std::string &socket_path = "/dev/log",
+		    const std::string &app_name = "falco",
+		    int facility = LOG_USER);
+	virtual ~syslog_sink();
+
+	// Connect to the socket. Returns false and fills in errstr
+	// on failure.
+	bool open(std::string &errstr);
+
+	// Queue a message, with a syslog priority (LOG_EMERG ...
+	// LOG_DEBUG). Can be called from any thread. The background
+	// thread is started with the first message. If the queue is
+	// full the message is dropped and counted.
+	void send(int priority, const char *msg, size_t len);
+
+	// Send all queued messages and stop the background
+	// thread. It is started again by the next message. Must be
+	// called before forking.
+	void flush();
+
+	uint64_t num_sent();
+	uint64_t num_dropped();
+
+	static const size_t max_queued = 4096;
+	static const size_t max_batch = 64;
+
+private:
+	struct entry
+	{
+		int priority;
+		uint64_t ts;
+		std::string msg;
+	};
+
+	void run();
+
+	// Send the first num entries of m_sending
+	void send_entries(size_t num);
+
+	// Fill in m_headers[i] for the given entry
+	void render_header(size_t i, const entry &e);
+
+	bool connect_socket();
+
+	std::string m_socket_path;
+	std::string m_app_name;
+	int m_facility;
+	int m_fd;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::thread m_thread;
+	bool m_running;
+	bool m_stopping;
+
+	// Messages are added to m_queue, and the thread swaps it
+	// with m_sending to send them. The entries are reused.
+	std::vector<entry> m_queue;
+	size_t m_num_queued;
+	std::vector<entry> m_sending;
+
+	// Only used by the background thread
+	std::vector<std::string> m_headers;
+	std::vector<struct iovec> m_iovs;
+	std::vector<struct mmsghdr> m_msgs;
+
+	// " HOSTNAME APP-NAME PROCID - - ", set when the thread
+	// starts as the pid changes when forking
+	std::string m_header_suffix;
+	uint64_t m_cached_secs;
+	char m_cached_time[32];
+	size_t m_cached_time_len;
+
+	atomic_counter m_num_sent;
+	atomic_counter m_num_dropped;
+};
@@ -23,12 +23,14 @@ limitations under the License.
 #include "falco_common.h"
 #include "webserver.h"
 #include "json_evt.h"
+#include "logger.h"
 
 using json = nlohmann::json;
 using namespace std;
 
-k8s_audit_handler::k8s_audit_handler(falco_engine *engine, falco_outputs *outputs)
-	: m_engine(engine), m_outputs(outputs)
+k8s_audit_handler::k8s_audit_handler(falco_engine *engine, falco_outputs *outputs,
+				     k8s_audit_shards *shards)
+	: m_engine(engine), m_outputs(outputs), m_shards(shards)
 {
 }
 
@@ -39,14 +41,66 @@ k8s_audit_handler::~k8s_audit_handler()
 bool k8s_audit_handler::accept_data(falco_engine *engine,
 				    falco_outputs *outputs,
 				    std::string &data,
-				    std::string &errstr)
+				    std::string &errstr,
+				    k8s_audit_shards *shards)
 {
-	std::list<json_event> jevts;
+	// The events of the request, and the values they cache, are
+	// all released at once with the arena.
+	arena evts_arena;
+	json_event_list jevts((arena_allocator<json_event>(&evts_arena)));
+
+	if(!parse_data(engine, data.data(), data.size(), jevts, errstr))
+	{
+		return false;
+	}
+
+	return process_events(engine, outputs, jevts, errstr, shards);
+}
+
+bool k8s_audit_handler::parse_data(falco_engine *engine,
+				   const char *data, size_t len,
+				   json_event_list &jevts,
+				   std::string &errstr)
+{
+	// Events are only parsed into json objects after the
+	// prefilter has dropped the ones it does not want, if any.
+	if(engine->k8s_audit_lazy_parse() ||
+	   engine->get_k8s_audit_prefilter().enabled())
+	{
+		std::shared_ptr<json_index> doc = std::make_shared<json_index>();
+		string err;
+		bool ok;
+
+		if(!doc->index(data, len, err))
+		{
+			errstr = string("Could not parse data: ") + err;
+			return false;
+		}
+
+		try
+		{
+			ok = engine->parse_k8s_audit_raw(doc, jevts, engine->k8s_audit_lazy_parse());
+		}
+		catch(json::parse_error &e)
+		{
+			errstr = string("Could not parse data: ") + e.what();
+			return false;
+		}
+
+		if(!ok)
+		{
+			errstr = string("Data not recognized as a k8s audit event");
+			return false;
+		}
+
+		return true;
+	}
+
 	json j;
 
 	try
 	{
-		j = json::parse(data);
+		j = json::parse(data, data + len);
 	}
 	catch(json::parse_error &e)
 	{
@@ -74,17 +128,57 @@ bool k8s_audit_handler::accept_data(falco_engine *engine,
 		return false;
 	}
 
-	for(auto &jev : jevts)
+	return true;
+}
+
+bool k8s_audit_handler::process_events(falco_engine *engine,
+				       falco_outputs *outputs,
+				       json_event_list &jevts,
+				       std::string &errstr,
+				       k8s_audit_shards *shards)
+{
+	if(shards != NULL)
 	{
-		std::unique_ptr<falco_engine::rule_result> res;
-		res = engine->process_k8s_audit_event(&jev);
+		std::vector<json_event *> evts;
+		bool ok = true;
+
+		for(auto &jev : jevts)
+		{
+			evts.push_back(&jev);
+		}
+
+		shards->process_events(evts.data(), evts.size(), [&](falco_engine::rule_result &res) {
+				if(!ok)
+				{
+					return;
+				}
+
+				try {
+					outputs->handle_event(res.evt, res.info->rule,
+							      res.info->source, res.priority_num,
+							      res.info->format);
+				}
+				catch(falco_exception &e)
+				{
+					errstr = string("Internal error handling output: ") + e.what();
+					fprintf(stderr, "%s\n", errstr.c_str());
+					ok = false;
+				}
+			});
+
+		return ok;
+	}
 
-		if(res)
+	falco_engine::rule_result res;
+
+	for(auto &jev : jevts)
+	{
+		if(engine->process_k8s_audit_event(&jev, res))
 		{
 			try {
-				outputs->handle_event(res->evt, res->rule,
-							res->source, res->priority_num,
-							res->format);
+				outputs->handle_event(res.evt, res.info->rule,
+							res.info->source, res.priority_num,
+							res.info->format);
 			}
 			catch(falco_exception &e)
 			{
@@ -100,7 +194,7 @@ bool k8s_audit_handler::accept_data(falco_engine *engine,
 
 bool k8s_audit_handler::accept_uploaded_data(std::string &post_data, std::string &errstr)
 {
-	return k8s_audit_handler::accept_data(m_engine, m_outputs, post_data, errstr);
+	return k8s_audit_handler::accept_data(m_engine, m_outputs, post_data, errstr, m_shards);
 }
 
 
@@ -156,8 +250,187 @@ bool k8s_audit_handler::handlePost(CivetServer *server, struct mg_connection *co
 	return true;
 }
 
+metrics_handler::metrics_handler(falco_engine *engine, falco_outputs *outputs, syscall_evt_drop_mgr *sdropmgr)
+	: m_engine(engine), m_outputs(outputs), m_sdropmgr(sdropmgr)
+{
+}
+
+metrics_handler::~metrics_handler()
+{
+}
+
+bool metrics_handler::handleGet(CivetServer *server, struct mg_connection *conn)
+{
+	std::string body;
+
+	render(m_engine, m_outputs, m_sdropmgr, body);
+
+	mg_send_http_ok(conn, "text/plain; version=0.0.4", body.size());
+	mg_printf(conn, "%s", body.c_str());
+
+	return true;
+}
+
+// Escape a label value as required by the exposition format
+static std::string label_value(const std::string &val)
+{
+	std::string ret;
+
+	for(auto c : val)
+	{
+		switch(c)
+		{
+		case '\\':
+			ret += "\\\\";
+			break;
+		case '"':
+			ret += "\\\"";
+			break;
+		case '\n':
+			ret += "\\n";
+			break;
+		default:
+			ret += c;
+		}
+	}
+
+	return ret;
+}
+
+static void add_header(std::string &out, const char *name, const char *type, const char *help)
+{
+	out += string("# HELP ") + name + " " + help + "\n";
+	out += string("# TYPE ") + name + " " + type + "\n";
+}
+
+static void add_sample(std::string &out, const char *name, const std::string &labels, uint64_t value)
+{
+	out += name;
+	if(!labels.empty())
+	{
+		out += "{" + labels + "}";
+	}
+	out += " " + to_string(value) + "\n";
+}
+
+void metrics_handler::render(falco_engine *engine,
+			     falco_outputs *outputs,
+			     syscall_evt_drop_mgr *sdropmgr,
+			     std::string &out)
+{
+	std::map<std::string, uint64_t> num_events, num_sampled_out;
+	engine->get_source_counts(num_events, num_sampled_out);
+
+	add_header(out, "falco_events_total", "counter", "Events checked against the rules, by source.");
+	for(auto &it : num_events)
+	{
+		add_sample(out, "falco_events_total", "source=\"" + it.first + "\"", it.second);
+	}
+
+	std::map<std::string, uint64_t> num_evttype_sampled_out;
+	engine->get_sampled_out_counts(num_evttype_sampled_out);
+
+	add_header(out, "falco_events_sampled_out_total", "counter", "Events not checked against the rules because of sampling, by event type.");
+	for(auto &it : num_evttype_sampled_out)
+	{
+		add_sample(out, "falco_events_sampled_out_total", "evttype=\"" + label_value(it.first) + "\"", it.second);
+	}
+
+	add_header(out, "falco_events_dropped_total", "counter", "Events not checked against the rules, by source and reason.");
+	for(auto &it : num_sampled_out)
+	{
+		add_sample(out, "falco_events_dropped_total", "source=\"" + it.first + "\",reason=\"sampling\"", it.second);
+	}
+
+	std::map<std::string, uint64_t> num_prefiltered;
+	engine->get_k8s_audit_prefiltered_counts(num_prefiltered);
+
+	for(auto &it : num_prefiltered)
+	{
+		add_sample(out, "falco_events_dropped_total", "source=\"k8s_audit\",reason=\"prefilter_" + it.first + "\"", it.second);
+	}
+
+	if(sdropmgr)
+	{
+		uint64_t num_drop_occurrences, num_actions, num_driver_evts;
+		std::map<std::string, uint64_t> num_driver_drops;
+
+		sdropmgr->get_counts(num_drop_occurrences, num_actions, num_driver_evts, num_driver_drops);
+
+		for(auto &it : num_driver_drops)
+		{
+			add_sample(out, "falco_events_dropped_total", "source=\"syscall\",reason=\"driver_" + it.first + "\"", it.second);
+		}
+
+		add_header(out, "falco_driver_events_total", "counter", "Events seen by the kernel module or ebpf probe.");
+		add_sample(out, "falco_driver_events_total", "", num_driver_evts);
+
+		add_header(out, "falco_syscall_drop_occurrences_total", "counter", "Seconds in which the driver dropped events.");
+		add_sample(out, "falco_syscall_drop_occurrences_total", "", num_drop_occurrences);
+
+		add_header(out, "falco_syscall_drop_actions_total", "counter", "Times the syscall_event_drops actions were taken.");
+		add_sample(out, "falco_syscall_drop_actions_total", "", num_actions);
+
+		uint64_t num_shed, num_restored, num_rules_shed;
+		falco_common::priority_type shed_priority;
+
+		sdropmgr->get_shedding_counts(num_shed, num_restored, num_rules_shed, shed_priority);
+
+		add_header(out, "falco_load_shedding_decisions_total", "counter", "Times load shedding disabled or enabled back a priority level of rules.");
+		add_sample(out, "falco_load_shedding_decisions_total", "action=\"shed\"", num_shed);
+		add_sample(out, "falco_load_shedding_decisions_total", "action=\"restore\"", num_restored);
+
+		add_header(out, "falco_load_shedding_rules_shed", "gauge", "Rules currently disabled by load shedding.");
+		add_sample(out, "falco_load_shedding_rules_shed", "", num_rules_shed);
+
+		add_header(out, "falco_load_shedding_min_priority", "gauge", "Least severe priority (0=Emergency, 7=Debug) of the rules still enabled.");
+		add_sample(out, "falco_load_shedding_min_priority", "", shed_priority);
+	}
+
+	std::map<std::string, std::pair<uint64_t, uint64_t>> rule_counts;
+	engine->get_rule_counts(rule_counts);
+
+	add_header(out, "falco_rule_evaluations_total", "counter", "Events each rule's condition was evaluated against.");
+	for(auto &it : rule_counts)
+	{
+		add_sample(out, "falco_rule_evaluations_total", "rule=\"" + label_value(it.first) + "\"", it.second.first);
+	}
+
+	add_header(out, "falco_rule_matches_total", "counter", "Events that matched each rule's condition.");
+	for(auto &it : rule_counts)
+	{
+		add_sample(out, "falco_rule_matches_total", "rule=\"" + label_value(it.first) + "\"", it.second.second);
+	}
+
+	std::vector<uint64_t> num_alerts;
+	uint64_t num_rate_limited;
+	outputs->get_alert_counts(num_alerts, num_rate_limited);
+
+	add_header(out, "falco_alerts_total", "counter", "Alerts sent to the outputs, by priority.");
+	for(size_t i = 0; i < num_alerts.size() && i < falco_common::priority_names.size(); i++)
+	{
+		add_sample(out, "falco_alerts_total", "priority=\"" + falco_common::priority_names[i] + "\"", num_alerts[i]);
+	}
+
+	add_header(out, "falco_alerts_rate_limited_total", "counter", "Alerts not sent because of the outputs rate limit.");
+	add_sample(out, "falco_alerts_rate_limited_total", "", num_rate_limited);
+
+	add_header(out, "falco_log_messages_dropped_total", "counter", "Log messages dropped because the log buffer was full.");
+	add_sample(out, "falco_log_messages_dropped_total", "", falco_logger::num_dropped());
+
+	std::vector<std::pair<std::string, uint64_t>> load_times;
+	engine->get_rules_load_times(load_times);
+
+	add_header(out, "falco_rules_load_duration_seconds", "gauge", "Time it took to load each rules file.");
+	for(auto &it : load_times)
+	{
+		out += "falco_rules_load_duration_seconds{file=\"" + label_value(it.first) + "\"} " +
+			to_string(it.second / 1000000000.0) + "\n";
+	}
+}
+
 falco_webserver::falco_webserver()
-	: m_config(NULL)
+	: m_config(NULL), m_sdropmgr(NULL), m_shards(NULL)
 {
 }
 
@@ -168,11 +441,15 @@ falco_webserver::~falco_webserver()
 
 void falco_webserver::init(falco_configuration *config,
 			   falco_engine *engine,
-			   falco_outputs *outputs)
+			   falco_outputs *outputs,
+			   syscall_evt_drop_mgr *sdropmgr,
+			   k8s_audit_shards *shards)
 {
 	m_config = config;
 	m_engine = engine;
 	m_outputs = outputs;
+	m_sdropmgr = sdropmgr;
+	m_shards = shards;
 }
 
 template<typename T, typename ...Args>
@@ -230,8 +507,14 @@ void falco_webserver::start()
 		throw falco_exception("Could not create embedded webserver");
 	}
 
-	m_k8s_audit_handler = make_unique<k8s_audit_handler>(m_engine, m_outputs);
+	m_k8s_audit_handler = make_unique<k8s_audit_handler>(m_engine, m_outputs, m_shards);
 	m_server->addHandler(m_config->m_webserver_k8s_audit_endpoint, *m_k8s_audit_handler);
+
+	if(!m_config->m_webserver_metrics_endpoint.empty())
+	{
+		m_metrics_handler = make_unique<metrics_handler>(m_engine, m_outputs, m_sdropmgr);
+		m_server->addHandler(m_config->m_webserver_metrics_endpoint, *m_metrics_handler);
+	}
 }
 
 void falco_webserver::stop()
@@ -240,5 +523,6 @@ void falco_webserver::stop()
 	{
 		m_server = NULL;
 		m_k8s_audit_handler = NULL;
+		m_metrics_handler = NULL;
 	}
 }
@@ -24,11 +24,14 @@ limitations under the License.
 #include "configuration.h"
 #include "falco_engine.h"
 #include "falco_outputs.h"
+#include "k8s_audit_shards.h"
+#include "event_drops.h"
 
 class k8s_audit_handler : public CivetHandler
 {
 public:
-	k8s_audit_handler(falco_engine *engine, falco_outputs *outputs);
+	k8s_audit_handler(falco_engine *engine, falco_outputs *outputs,
+			  k8s_audit_shards *shards = NULL);
 	virtual ~k8s_audit_handler();
 
 	bool handleGet(CivetServer *server, struct mg_connection *conn);
@@ -36,14 +39,61 @@ public:
 
 	static bool accept_data(falco_engine *engine,
 				falco_outputs *outputs,
-				std::string &post_data, std::string &errstr);
+				std::string &post_data, std::string &errstr,
+				k8s_audit_shards *shards = NULL);
+
+	// The two halves of accept_data. parse_data only parses the
+	// data into events and only uses the engine's k8s audit
+	// prefilter, which is thread safe, so it can be called from
+	// multiple threads at once, unless the prefilter drops
+	// duplicates, which depends on the order of the calls.
+	// process_events runs the events through the rules. It must
+	// be called from a single thread, with the events in the
+	// order they were received. When shards is provided, the
+	// events are run through the rules on its workers instead of
+	// engine.
+	static bool parse_data(falco_engine *engine,
+			       const char *data, size_t len,
+			       json_event_list &jevts,
+			       std::string &errstr);
+
+	static bool process_events(falco_engine *engine,
+				   falco_outputs *outputs,
+				   json_event_list &jevts,
+				   std::string &errstr,
+				   k8s_audit_shards *shards = NULL);
 
 private:
 	falco_engine *m_engine;
 	falco_outputs *m_outputs;
+	k8s_audit_shards *m_shards;
 	bool accept_uploaded_data(std::string &post_data, std::string &errstr);
 };
 
+// Serves falco's counters in the prometheus text exposition
+// format. All counters are read without locks, so a scrape never
+// blocks event processing.
+class metrics_handler : public CivetHandler
+{
+public:
+	metrics_handler(falco_engine *engine, falco_outputs *outputs, syscall_evt_drop_mgr *sdropmgr);
+	virtual ~metrics_handler();
+
+	bool handleGet(CivetServer *server, struct mg_connection *conn);
+
+	// Render all metrics. Exposed separately from handleGet so
+	// it can be used without a webserver.
+	static void render(falco_engine *engine,
+			   falco_outputs *outputs,
+			   syscall_evt_drop_mgr *sdropmgr,
+			   std::string &out);
+
+private:
+	falco_engine *m_engine;
+	falco_outputs *m_outputs;
+	syscall_evt_drop_mgr *m_sdropmgr;
+};
+
 class falco_webserver
 {
 public:
@@ -53,7 +103,9 @@ public:
 
 	void init(falco_configuration *config,
 		  falco_engine *engine,
-		  falco_outputs *outputs);
+		  falco_outputs *outputs,
+		  syscall_evt_drop_mgr *sdropmgr,
+		  k8s_audit_shards *shards = NULL);
 
 	void start();
 	void stop();
@@ -63,6 +115,9 @@ private:
 	falco_engine *m_engine;
 	falco_configuration *m_config;
 	falco_outputs *m_outputs;
+	syscall_evt_drop_mgr *m_sdropmgr;
+	k8s_audit_shards *m_shards;
 	unique_ptr<CivetServer> m_server;
 	unique_ptr<k8s_audit_handler> m_k8s_audit_handler;
+	unique_ptr<metrics_handler> m_metrics_handler;
 };